@@ -25,25 +25,47 @@
 #define pr_fmt(fmt) CLEVO_XSM_DRIVER_NAME ": " fmt
 
 #include <linux/acpi.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
 #include <linux/dmi.h>
+#include <linux/hrtimer.h>
 #include <linux/hwmon.h>
 #include <linux/hwmon-sysfs.h>
 #include <linux/input.h>
 #include <linux/kernel.h>
+#include <linux/kfifo.h>
 #include <linux/kthread.h>
+#include <linux/ktime.h>
+#if IS_REACHABLE(CONFIG_LEDS_CLASS_MULTICOLOR)
+#include <linux/led-class-multicolor.h>
+#endif
 #include <linux/leds.h>
+#include <linux/math64.h>
+#include <linux/miscdevice.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/platform_device.h>
+#include <linux/poll.h>
+#include <linux/power_supply.h>
 #include <linux/rfkill.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
 #include <linux/stringify.h>
+#include <linux/uaccess.h>
 #include <linux/version.h>
+#include <linux/vmalloc.h>
 #include <linux/workqueue.h>
 
+#include "clevo_kb.h"
+
+#define CREATE_TRACE_POINTS
+#include "clevo_xsm_wmi_trace.h"
+
 #define __CLEVO_XSM_PR(lvl, fmt, ...) do { pr_##lvl(fmt, ##__VA_ARGS__); } \
 		while (0)
 #define CLEVO_XSM_INFO(fmt, ...) __CLEVO_XSM_PR(info, fmt, ##__VA_ARGS__)
+#define CLEVO_XSM_INFO_RATELIMITED(fmt, ...) \
+		__CLEVO_XSM_PR(info_ratelimited, fmt, ##__VA_ARGS__)
 #define CLEVO_XSM_ERROR(fmt, ...) __CLEVO_XSM_PR(err, fmt, ##__VA_ARGS__)
 #define CLEVO_XSM_DEBUG(fmt, ...) __CLEVO_XSM_PR(debug, "[%s:%u] " fmt, \
 		__func__, __LINE__, ##__VA_ARGS__)
@@ -193,12 +215,166 @@ static const struct kernel_param_ops param_ops_poll_freq = {
 static unsigned char param_poll_freq = POLL_FREQ_DEFAULT;
 #define param_check_poll_freq param_check_byte
 module_param_named(poll_freq, param_poll_freq, poll_freq, S_IRUSR);
-MODULE_PARM_DESC(poll_freq, "Set polling frequency");
+MODULE_PARM_DESC(poll_freq, "Airplane hotkey polling frequency before backoff, used until the WMI event is seen");
+
+
+#define SENSOR_INTERVAL_MIN     100
+#define SENSOR_INTERVAL_MAX     10000
+#define SENSOR_INTERVAL_DEFAULT 1000
+
+static int param_set_sensor_interval(const char *val,
+	const struct kernel_param *kp)
+{
+	int ret;
+
+	ret = param_set_uint(val, kp);
+
+	if (!ret)
+		*((unsigned int *) kp->arg) = clamp_t(unsigned int,
+			*((unsigned int *) kp->arg),
+			SENSOR_INTERVAL_MIN, SENSOR_INTERVAL_MAX);
+
+	return ret;
+}
+
+static const struct kernel_param_ops param_ops_sensor_interval = {
+	.set = param_set_sensor_interval,
+	.get = param_get_uint,
+};
+
+static unsigned int param_sensor_interval = SENSOR_INTERVAL_DEFAULT;
+#define param_check_sensor_interval param_check_uint
+module_param_named(sensor_interval_ms, param_sensor_interval,
+	sensor_interval, 0644);
+MODULE_PARM_DESC(sensor_interval_ms, "Fan and temperature sampling interval in ms (default 1000)");
 
 
 struct platform_device *clevo_xsm_platform_device;
 
 
+/* Statistics */
+
+/*
+ * Latency histogram buckets: bucket 0 counts calls under 1 us, bucket n
+ * calls in [2^(n-1), 2^n) us, the last one everything slower.
+ */
+#define CLEVO_XSM_LAT_BUCKETS 24
+
+/* Method IDs for CLEVO_GET are 7 bit */
+#define CLEVO_XSM_METHOD_MAX  0x80
+
+enum clevo_xsm_kb_cmd {
+	KB_CMD_F0,
+	KB_CMD_F1,
+	KB_CMD_F2,
+	KB_CMD_F3,
+	KB_CMD_F4,
+	KB_CMD_E0,
+	KB_CMD_A3,
+	KB_CMD_RESET,
+	KB_CMD_OTHER,
+	KB_CMD_MAX,
+};
+
+static const char * const clevo_xsm_kb_cmd_names[KB_CMD_MAX] = {
+	"F0", "F1", "F2", "F3", "F4", "E0", "A3", "reset", "other",
+};
+
+struct clevo_xsm_lat_stats {
+	u64 calls;
+	u64 errors;
+	u64 total_ns;
+	u64 min_ns;
+	u64 max_ns;
+	u64 hist[CLEVO_XSM_LAT_BUCKETS];
+};
+
+struct clevo_xsm_stats {
+	struct clevo_xsm_lat_stats wmi;
+	struct clevo_xsm_lat_stats ec_read;
+	struct clevo_xsm_lat_stats ec_write;
+	u64 wmi_method[CLEVO_XSM_METHOD_MAX];
+	u64 kb_cmd[KB_CMD_MAX];
+};
+
+/* Only the command queue worker touches these, resets included */
+static struct clevo_xsm_stats clevo_xsm_stats;
+
+/* call with s protected against concurrent updates */
+static void clevo_xsm_lat_account(struct clevo_xsm_lat_stats *s,
+	u64 ns, int err)
+{
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+
+	if (!s->calls || ns < s->min_ns)
+		s->min_ns = ns;
+	if (ns > s->max_ns)
+		s->max_ns = ns;
+
+	s->calls++;
+	s->total_ns += ns;
+	s->hist[min_t(unsigned int, fls64(us), CLEVO_XSM_LAT_BUCKETS - 1)]++;
+
+	if (unlikely(err))
+		s->errors++;
+}
+
+static enum clevo_xsm_kb_cmd clevo_xsm_kb_cmd_class(u32 cmd)
+{
+	switch (cmd >> 24) {
+	case 0xF0 ... 0xF4:
+		return KB_CMD_F0 + (cmd >> 24) - 0xF0;
+	case 0xE0:
+		return KB_CMD_E0;
+	case 0xA3:
+		return KB_CMD_A3;
+	}
+
+	if (cmd == 0x10000000 || cmd == 0x20000000)
+		return KB_CMD_RESET;
+
+	return KB_CMD_OTHER;
+}
+
+/* Run by the command queue worker, caller is the queuing call site */
+static int __clevo_xsm_ec_read(u8 addr, u8 *val, unsigned long caller)
+{
+	u64 start = ktime_get_ns();
+	u64 ns;
+	int ret;
+
+	ret = ec_read(addr, val);
+	ns = ktime_get_ns() - start;
+
+	clevo_xsm_lat_account(&clevo_xsm_stats.ec_read, ns, ret);
+
+	trace_clevo_xsm_ec_access(false, addr, ret ? 0 : *val, ret, ns,
+		caller);
+
+	return ret;
+}
+
+static int __clevo_xsm_ec_write(u8 addr, u8 val, unsigned long caller)
+{
+	u64 start = ktime_get_ns();
+	u64 ns;
+	int ret;
+
+	ret = ec_write(addr, val);
+	ns = ktime_get_ns() - start;
+
+	clevo_xsm_lat_account(&clevo_xsm_stats.ec_write, ns, ret);
+
+	trace_clevo_xsm_ec_access(true, addr, val, ret, ns, caller);
+
+	return ret;
+}
+
+/* Queued through clevo_cmdq, see below */
+static int clevo_xsm_ec_read(u8 addr, u8 *val);
+static int clevo_xsm_ec_write(u8 addr, u8 val);
+
+
 /* LED sub-driver */
 
 static bool param_led_invert;
@@ -219,12 +395,12 @@ static void airplane_led_update(struct work_struct *work)
 
 	w = container_of(work, struct _led_work, work);
 
-	ec_read(0xD9, &byte);
+	clevo_xsm_ec_read(0xD9, &byte);
 
 	if (param_led_invert)
-		ec_write(0xD9, w->wk ? byte & ~0x40 : byte | 0x40);
+		clevo_xsm_ec_write(0xD9, w->wk ? byte & ~0x40 : byte | 0x40);
 	else
-		ec_write(0xD9, w->wk ? byte | 0x40 : byte & ~0x40);
+		clevo_xsm_ec_write(0xD9, w->wk ? byte | 0x40 : byte & ~0x40);
 
 	/* wmbb 0x6C 1 (?) */
 }
@@ -233,7 +409,7 @@ static enum led_brightness airplane_led_get(struct led_classdev *led_cdev)
 {
 	u8 byte;
 
-	ec_read(0xD9, &byte);
+	clevo_xsm_ec_read(0xD9, &byte);
 
 	if (param_led_invert)
 		return byte & 0x40 ? LED_OFF : LED_FULL;
@@ -288,20 +464,33 @@ static void __exit clevo_xsm_led_exit(void)
 		destroy_workqueue(led_workqueue);
 }
 
+/* LED Mode definitions - matching CC30 */
+#define LED_MODE_STATIC  0
+#define LED_MODE_WAVE    1
+#define LED_MODE_BREATH  2
+#define LED_MODE_BLINK   3
+#define LED_MODE_ZONE_WAVE 4
+#define LED_MODE_REACTIVE  5
+#define LED_MODE_STREAM    6  /* only while /dev/clevo_kb is open */
+
+static int current_led_mode = LED_MODE_STATIC;
+
 /* Kernel-space wave animation - uses direct WMI for minimal latency */
-static struct delayed_work wave_work;
-static struct workqueue_struct *wave_workqueue;
-static bool wave_running = false;
-static unsigned int wave_step = 0;
 static unsigned int wave_color_idx = 0;
 static unsigned int wave_interval_ms = 40;
 module_param(wave_interval_ms, uint, 0644);
 MODULE_PARM_DESC(wave_interval_ms, "Wave animation step interval in ms (default 40)");
+/* Full wave cycle set through kb_wave_period, 0 = use wave_interval_ms */
+static unsigned int wave_period_ms = 0;
 
-static unsigned int wave_last_brightness = 99;
+static bool fx_rt_prio = false;
+module_param(fx_rt_prio, bool, 0444);
+MODULE_PARM_DESC(fx_rt_prio, "Run the LED effect worker with SCHED_FIFO priority (default off)");
 
-/* Forward declaration */
+/* Forward declarations */
 static int clevo_xsm_wmi_evaluate_wmbb_method(u32 method_id, u32 arg, u32 *retval);
+static int clevo_xsm_kb_led_write(u32 cmd);
+static void kb_attr_changed(void);
 
 /* Color values for wave effect (mutable, max 16) */
 #define WAVE_MAX_COLORS 16
@@ -320,1596 +509,5472 @@ static u32 wave_color_values[WAVE_MAX_COLORS] = {
 };
 static unsigned int wave_num_colors = 11;
 
-/* Sine table for brightness 0-9 (0=bright, 9=dim) */
-static const u8 sine_table[] = {9, 8, 7, 5, 3, 1, 0, 1, 3, 5, 7, 8, 9};
-#define WAVE_TABLE_SIZE 13
+/* (1 + sin(2 * pi * i / 256)) / 2 in 0.8 fixed point */
+static const u8 kb_fx_sine_lut[256] = {
+	128, 131, 134, 137, 140, 143, 146, 149, 152, 155, 158, 162, 165, 167, 170, 173,
+	176, 179, 182, 185, 188, 190, 193, 196, 198, 201, 203, 206, 208, 211, 213, 215,
+	218, 220, 222, 224, 226, 228, 230, 232, 234, 235, 237, 238, 240, 241, 243, 244,
+	245, 246, 248, 249, 250, 250, 251, 252, 253, 253, 254, 254, 254, 255, 255, 255,
+	255, 255, 255, 255, 254, 254, 254, 253, 253, 252, 251, 250, 250, 249, 248, 246,
+	245, 244, 243, 241, 240, 238, 237, 235, 234, 232, 230, 228, 226, 224, 222, 220,
+	218, 215, 213, 211, 208, 206, 203, 201, 198, 196, 193, 190, 188, 185, 182, 179,
+	176, 173, 170, 167, 165, 162, 158, 155, 152, 149, 146, 143, 140, 137, 134, 131,
+	128, 124, 121, 118, 115, 112, 109, 106, 103, 100,  97,  93,  90,  88,  85,  82,
+	 79,  76,  73,  70,  67,  65,  62,  59,  57,  54,  52,  49,  47,  44,  42,  40,
+	 37,  35,  33,  31,  29,  27,  25,  23,  21,  20,  18,  17,  15,  14,  12,  11,
+	 10,   9,   7,   6,   5,   5,   4,   3,   2,   2,   1,   1,   1,   0,   0,   0,
+	  0,   0,   0,   0,   1,   1,   1,   2,   2,   3,   4,   5,   5,   6,   7,   9,
+	 10,  11,  12,  14,  15,  17,  18,  20,  21,  23,  25,  27,  29,  31,  33,  35,
+	 37,  40,  42,  44,  47,  49,  52,  54,  57,  59,  62,  65,  67,  70,  73,  76,
+	 79,  82,  85,  88,  90,  93,  97, 100, 103, 106, 109, 112, 115, 118, 121, 124,
+};
 #define NUM_WAVE_STEPS 19
 
-static void wave_set_brightness_direct(unsigned int level)
+/*
+ * Perceptual brightness (CIE L*, 255 = brightest) to raw F4 value. The
+ * effects run on this scale so fades step evenly to the eye.
+ */
+static const u8 kb_fx_lstar_lut[256] = {
+	  0,   0,   0,   0,   0,   1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,
+	  2,   2,   2,   2,   2,   2,   2,   3,   3,   3,   3,   3,   3,   3,   3,   4,
+	  4,   4,   4,   4,   4,   5,   5,   5,   5,   5,   6,   6,   6,   6,   6,   7,
+	  7,   7,   7,   8,   8,   8,   8,   9,   9,   9,  10,  10,  10,  10,  11,  11,
+	 11,  12,  12,  12,  13,  13,  13,  14,  14,  15,  15,  15,  16,  16,  17,  17,
+	 17,  18,  18,  19,  19,  20,  20,  21,  21,  22,  22,  23,  23,  24,  24,  25,
+	 25,  26,  26,  27,  28,  28,  29,  29,  30,  31,  31,  32,  32,  33,  34,  34,
+	 35,  36,  37,  37,  38,  39,  39,  40,  41,  42,  43,  43,  44,  45,  46,  47,
+	 47,  48,  49,  50,  51,  52,  53,  54,  54,  55,  56,  57,  58,  59,  60,  61,
+	 62,  63,  64,  65,  66,  67,  68,  70,  71,  72,  73,  74,  75,  76,  77,  79,
+	 80,  81,  82,  83,  85,  86,  87,  88,  90,  91,  92,  94,  95,  96,  98,  99,
+	100, 102, 103, 105, 106, 108, 109, 110, 112, 113, 115, 116, 118, 120, 121, 123,
+	124, 126, 128, 129, 131, 132, 134, 136, 138, 139, 141, 143, 145, 146, 148, 150,
+	152, 154, 155, 157, 159, 161, 163, 165, 167, 169, 171, 173, 175, 177, 179, 181,
+	183, 185, 187, 189, 191, 193, 196, 198, 200, 202, 204, 207, 209, 211, 214, 216,
+	218, 220, 223, 225, 228, 230, 232, 235, 237, 240, 242, 245, 247, 250, 252, 255,
+};
+
+#define KB_FX_LEVEL_MAX 255
+#define KB_FX_LEVEL_DIM 104  /* raw 0x1E, the dimmest firmware level */
+
+static void kb_fx_set_level(u8 level)
 {
-	u8 raw = 0xFF - (level * 0x19);
-	clevo_xsm_wmi_evaluate_wmbb_method(0x67, 0xF4000000 | raw, NULL);
+	clevo_xsm_kb_led_write(0xF4000000 | kb_fx_lstar_lut[level]);
 }
 
-static void wave_set_color_direct(unsigned int idx)
+/* Brightest perceptual level that does not exceed a raw F4 value */
+static u8 kb_fx_raw_to_level(u8 raw)
 {
-	u32 color = wave_color_values[idx % wave_num_colors];
-	/* Color format: B << 16 | R << 8 | G << 0 */
-	u8 r = (color >> 16) & 0xFF;
-	u8 g = (color >> 8) & 0xFF;
-	u8 b = color & 0xFF;
-	u32 cmd_val = (b << 16) | (r << 8) | g;
-	
-	/* Set all 3 zones: left (F0), center (F1), right (F2) */
-	clevo_xsm_wmi_evaluate_wmbb_method(0x67, 0xF0000000 | cmd_val, NULL);
-	clevo_xsm_wmi_evaluate_wmbb_method(0x67, 0xF1000000 | cmd_val, NULL);
-	clevo_xsm_wmi_evaluate_wmbb_method(0x67, 0xF2000000 | cmd_val, NULL);
+	unsigned int level = KB_FX_LEVEL_MAX;
+
+	while (level && kb_fx_lstar_lut[level] > raw)
+		level--;
+
+	return level;
 }
 
-static void wave_work_handler(struct work_struct *work)
+/* Zones driven by the effects: left (F0), center (F1), right (F2) */
+#define KB_FX_ZONES 3
+#define KB_FX_MAX_ZONES 4  /* plus extra (F3) on some models */
+
+/*
+ * Color pipeline
+ *
+ * Effect colors pass through a per-channel LUT that combines gamma and
+ * calibration, since the LEDs have very uneven red and blue output. The
+ * LUT is built in fixed point (no FPU) whenever gamma or calibration
+ * change. Crossfades between palette entries are precomputed in output
+ * space whenever the palette or the LUT change, so frames only index
+ * tables.
+ */
+#define KB_FX_FADE_SHIFT 5
+#define KB_FX_FADE_STEPS (1 << KB_FX_FADE_SHIFT)
+
+static unsigned int kb_color_gamma[3] = { 100, 100, 100 };  /* R G B, x100 */
+static unsigned int kb_color_cal[3] = { 255, 255, 255 };    /* R G B, 255 = 1.0 */
+static u8 kb_fx_lut[3][256];
+static u32 wave_fade[WAVE_MAX_COLORS][KB_FX_FADE_STEPS + 1];
+
+/* 2^(-1/2^k) for k = 1..16 in Q2.30 */
+static const u32 kb_fx_exp2_tab[16] = {
+	0x2d413ccd, 0x35d13f33, 0x3ab031ba, 0x3d495f45,
+	0x3ea0ecb7, 0x3f4f8303, 0x3fa78457, 0x3fd3b2d6,
+	0x3fe9d595, 0x3ff4e9d4, 0x3ffa74ad, 0x3ffd3a47,
+	0x3ffe9d20, 0x3fff4e8f, 0x3fffa747, 0x3fffd3a4,
+};
+
+/* log2(x) in Q16.16, x > 0 */
+static u32 kb_fx_log2_q16(u32 x)
 {
-	/* Smooth wave with all 10 brightness levels */
-	/* 0=bright, 9=dim */
-	static const u8 brightness_levels[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0};
-	
-	if (!wave_running)
-		return;
-	
-	/* Set brightness */
-	wave_set_brightness_direct(brightness_levels[wave_step]);
-	
-	/* Change color at step 9 (brightness 9 = dimmest) */
-	if (wave_step == 9) {
-		wave_color_idx = (wave_color_idx + 1) % wave_num_colors;
-		wave_set_color_direct(wave_color_idx);
+	int ip = fls(x) - 1;
+	u64 m = ((u64) x << 31) >> ip;  /* mantissa in [1, 2) as Q31 */
+	u32 r = ip << 16;
+	int i;
+
+	for (i = 15; i >= 0; i--) {
+		m = (m * m) >> 31;
+		if (m >= (2ULL << 31)) {
+			m >>= 1;
+			r |= 1U << i;
+		}
 	}
-	
-	wave_step++;
-	if (wave_step >= NUM_WAVE_STEPS)
-		wave_step = 0;
-	
-	if (wave_running)
-		queue_delayed_work(wave_workqueue, &wave_work,
-			msecs_to_jiffies(wave_interval_ms));
+
+	return r;
 }
 
-static void wave_start(void)
+/* 2^(-n) with n in Q16.16, result in Q16.16 */
+static u32 kb_fx_exp2_neg_q16(u64 n)
 {
-	if (wave_running)
-		return;
-	
-	wave_running = true;
-	wave_step = 0;
-	wave_last_brightness = 99;
-	
-	/* Set max brightness (0 = max in inverted system) */
-	wave_set_brightness_direct(0);
-	
-	if (!wave_workqueue)
-		wave_workqueue = create_singlethread_workqueue("kb_wave_wq");
-	
-	if (wave_workqueue)
-		queue_delayed_work(wave_workqueue, &wave_work, 0);
+	u64 r = 1ULL << 30;
+	int i;
+
+	if ((n >> 16) >= 30)
+		return 0;
+
+	for (i = 0; i < 16; i++) {
+		if (n & (1U << (15 - i)))
+			r = (r * kb_fx_exp2_tab[i]) >> 30;
+	}
+
+	return (r >> (n >> 16)) >> 14;
 }
 
-static void wave_stop(void)
+static void kb_fx_rebuild_lut(void)
 {
-	wave_running = false;
-	
-	if (wave_workqueue)
-		cancel_delayed_work_sync(&wave_work);
-	
-	wave_set_brightness_direct(0);  /* 0 = max brightness */
+	u32 log2_max = kb_fx_log2_q16(255);
+	unsigned int ch, i, v;
+	u64 n;
+
+	for (ch = 0; ch < 3; ch++) {
+		for (i = 0; i < 256; i++) {
+			v = i;
+			if (i && kb_color_gamma[ch] != 100) {
+				/* 255 * (i / 255)^gamma */
+				n = div_u64((u64) (log2_max - kb_fx_log2_q16(i)) *
+					kb_color_gamma[ch], 100);
+				v = (255 * (u64) kb_fx_exp2_neg_q16(n) + 0x8000) >> 16;
+			}
+			kb_fx_lut[ch][i] = v * kb_color_cal[ch] / 255;
+		}
+	}
 }
 
-/* input sub-driver */
+static u32 kb_fx_correct(u32 rgb)
+{
+	return kb_fx_lut[0][(rgb >> 16) & 0xFF] << 16 |
+		kb_fx_lut[1][(rgb >> 8) & 0xFF] << 8 |
+		kb_fx_lut[2][rgb & 0xFF];
+}
 
-static struct input_dev *clevo_xsm_input_device;
-static DEFINE_MUTEX(clevo_xsm_input_report_mutex);
+/* a + (b - a) * step / KB_FX_FADE_STEPS on each channel */
+static u32 kb_fx_mix_rgb(u32 a, u32 b, unsigned int step)
+{
+	u32 rgb = 0;
+	int shift, ca, cb;
+
+	for (shift = 16; shift >= 0; shift -= 8) {
+		ca = (a >> shift) & 0xFF;
+		cb = (b >> shift) & 0xFF;
+		rgb |= (u32) (ca + (((cb - ca) * (int) step) >>
+			KB_FX_FADE_SHIFT)) << shift;
+	}
 
-static unsigned int global_report_cnt;
+	return rgb;
+}
 
-/* call with clevo_xsm_input_report_mutex held */
-static void clevo_xsm_input_report_key(unsigned int code)
+/* call after changing the palette or the LUT */
+static void wave_rebuild_fade(void)
 {
-	input_report_key(clevo_xsm_input_device, code, 1);
-	input_report_key(clevo_xsm_input_device, code, 0);
-	input_sync(clevo_xsm_input_device);
+	unsigned int i, step;
+	u32 a, b;
+
+	for (i = 0; i < wave_num_colors; i++) {
+		a = wave_color_values[i];
+		b = wave_color_values[(i + 1) % wave_num_colors];
+		for (step = 0; step <= KB_FX_FADE_STEPS; step++)
+			wave_fade[i][step] = kb_fx_correct(kb_fx_mix_rgb(a, b, step));
+	}
+}
 
-	global_report_cnt++;
+/* color must already be corrected */
+static void wave_set_zone_color_direct(unsigned int zone, u32 color)
+{
+	/* Color format: B << 16 | R << 8 | G << 0 */
+	u8 r = (color >> 16) & 0xFF;
+	u8 g = (color >> 8) & 0xFF;
+	u8 b = color & 0xFF;
+	u32 cmd_val = (b << 16) | (r << 8) | g;
+	
+	clevo_xsm_kb_led_write((0xF0000000 + (zone << 24)) | cmd_val);
 }
 
-static struct task_struct *clevo_xsm_input_polling_task;
+/* Show step 0..KB_FX_FADE_STEPS of the fade from palette idx to idx + 1 */
+static void wave_set_fade_direct(unsigned int idx, unsigned int step)
+{
+	u32 color = wave_fade[idx % wave_num_colors][step];
+	unsigned int zone;
+	
+	for (zone = 0; zone < KB_FX_ZONES; zone++)
+		wave_set_zone_color_direct(zone, color);
+}
 
-static int clevo_xsm_input_polling_thread(void *data)
+static void wave_set_color_direct(unsigned int idx)
 {
-	unsigned int report_cnt = 0;
+	wave_set_fade_direct(idx, 0);
+}
 
-	CLEVO_XSM_INFO("Polling thread started (PID: %i), polling at %i Hz\n",
-				current->pid, param_poll_freq);
+/*
+ * Keyframe effects
+ *
+ * An effect is a list of keys. Each key holds for 'frames' engine frames
+ * and, with KB_FX_LINEAR, interpolates towards the following key over that
+ * time. After the last key playback continues at key 'loop'. Brightness
+ * levels are perceptual, see kb_fx_lstar_lut.
+ */
+enum kb_fx_interp {
+	KB_FX_STEP,
+	KB_FX_LINEAR,
+};
 
-	while (!kthread_should_stop()) {
+#define KB_FX_COLOR      BIT(0)  /* key sets color[] on every zone */
+#define KB_FX_NEXT_COLOR BIT(1)  /* key advances the wave palette */
+#define KB_FX_FADE_NEXT  BIT(2)  /* key crossfades to the next palette color */
 
-		u8 byte;
+struct kb_fx_key {
+	u16 frames;
+	u8 level;
+	u8 interp;
+	u8 flags;
+	u32 color[KB_FX_ZONES];  /* 0xRRGGBB, with KB_FX_COLOR */
+};
 
-		ec_read(0xDB, &byte);
-		if (byte & 0x40) {
-			ec_write(0xDB, byte & ~0x40);
+struct kb_fx_desc {
+	const char *name;
+	int mode;
+	const struct kb_fx_key *keys;
+	unsigned int nkeys;
+	unsigned int loop;
+	unsigned int period_ms;
+	u64 (*period_ns)(void);  /* overrides period_ms, 0 = wait for kb_fx_kick() */
+	void (*render)(void);    /* procedural effects draw each frame here */
+};
 
-			CLEVO_XSM_DEBUG("Airplane-Mode Hotkey pressed\n");
+/*
+ * Effect frame engine
+ *
+ * An hrtimer armed on absolute CLOCK_MONOTONIC deadlines kicks a dedicated
+ * kthread_worker, which runs one frame of the active effect. The next
+ * deadline is the previous one plus the frame period, so the time spent
+ * in WMI calls does not accumulate as drift. Deadlines that already passed
+ * are skipped and counted as missed frames instead of being replayed.
+ */
+#define KB_FX_HOLD_IDLE BIT(0)  /* no input for idle_timeout */
+#define KB_FX_HOLD_LID  BIT(1)  /* lid closed */
+#define KB_FX_HOLD_OFF  BIT(2)  /* backlight off or all zones black */
 
-			mutex_lock(&clevo_xsm_input_report_mutex);
+static struct {
+	struct kthread_worker *worker;
+	struct kthread_work work;
+	struct hrtimer timer;
+	ktime_t deadline;
+	const struct kb_fx_desc *desc;
+	unsigned int key;
+	unsigned int tick;
+	int mode;
+	bool running;
+	bool frozen;    /* showing one static frame, see fx_battery */
+	bool paused;    /* effect selected but held, see kb_fx_hold() */
+	bool asleep;    /* waiting for kb_fx_kick(), worker only */
+	unsigned long hold;  /* KB_FX_HOLD_* */
+	unsigned int seq;
+	spinlock_t stats_lock;
+	u64 frames;
+	u64 missed;
+	struct clevo_xsm_lat_stats jitter;
+} kb_fx;
+
+static DEFINE_MUTEX(kb_fx_lock);
 
-			if (global_report_cnt > report_cnt) {
-				mutex_unlock(&clevo_xsm_input_report_mutex);
-				break;
-			}
+/*
+ * Frame rate limits and battery policy
+ *
+ * fx_max_fps always applies. On battery, fx_battery picks what effects do:
+ * keep running as is, run at no more than fx_battery_fps, or show a single
+ * static frame. Keyframe effects meet a limit by skipping in-between
+ * frames, so they keep their speed.
+ */
+enum {
+	KB_FX_BATTERY_FULL,
+	KB_FX_BATTERY_THROTTLE,
+	KB_FX_BATTERY_STATIC,
+};
 
-			clevo_xsm_input_report_key(KEY_RFKILL);
-			report_cnt++;
+static const char * const kb_fx_battery_names[] = {
+	[KB_FX_BATTERY_FULL]     = "full",
+	[KB_FX_BATTERY_THROTTLE] = "throttle",
+	[KB_FX_BATTERY_STATIC]   = "static",
+};
 
-			CLEVO_XSM_DEBUG("Led status: %d",
-				airplane_led_get(&airplane_led));
+static bool kb_fx_on_battery;
+static bool kb_fx_power_ready;
+static struct work_struct kb_fx_power_work;
 
-			airplane_led_set(&airplane_led,
-				(airplane_led_get(&airplane_led) ? 0 : 1));
+static int param_set_fx_battery(const char *val, const struct kernel_param *kp)
+{
+	int policy = sysfs_match_string(kb_fx_battery_names, val);
 
-			mutex_unlock(&clevo_xsm_input_report_mutex);
-		}
-		msleep_interruptible(1000 / param_poll_freq);
-	}
+	if (policy < 0)
+		return policy;
 
-	CLEVO_XSM_INFO("Polling thread exiting\n");
+	WRITE_ONCE(*((int *) kp->arg), policy);
+
+	/* Apply a change to or from "static" right away */
+	if (READ_ONCE(kb_fx_power_ready))
+		schedule_work(&kb_fx_power_work);
 
 	return 0;
 }
 
-static int clevo_xsm_input_open(struct input_dev *dev)
+static int param_get_fx_battery(char *buffer, const struct kernel_param *kp)
 {
-	clevo_xsm_input_polling_task = kthread_run(
-		clevo_xsm_input_polling_thread,
-		NULL, "clevo_xsm-polld");
+	return sprintf(buffer, "%s\n",
+		kb_fx_battery_names[*((int *) kp->arg)]);
+}
 
-	if (unlikely(IS_ERR(clevo_xsm_input_polling_task))) {
-		clevo_xsm_input_polling_task = NULL;
-		CLEVO_XSM_ERROR("Could not create polling thread\n");
-				return PTR_ERR(clevo_xsm_input_polling_task);
-	}
+static const struct kernel_param_ops param_ops_fx_battery = {
+	.set = param_set_fx_battery,
+	.get = param_get_fx_battery,
+};
 
-		return 0;
+static int fx_battery = KB_FX_BATTERY_THROTTLE;
+module_param_cb(fx_battery, &param_ops_fx_battery, &fx_battery, 0644);
+MODULE_PARM_DESC(fx_battery, "LED effects on battery: full, throttle or static (default throttle)");
+
+static unsigned int fx_battery_fps = 10;
+module_param(fx_battery_fps, uint, 0644);
+MODULE_PARM_DESC(fx_battery_fps, "LED effect frame rate cap on battery with fx_battery=throttle (default 10)");
+
+/* Set by the userspace profile engine, trades smoothness for wakeups */
+static unsigned int fx_max_fps = 0;
+module_param(fx_max_fps, uint, 0644);
+MODULE_PARM_DESC(fx_max_fps, "LED effect frame rate cap, 0 = none (default 0)");
+
+static bool kb_fx_battery_static(void)
+{
+	return READ_ONCE(kb_fx_on_battery) &&
+		READ_ONCE(fx_battery) == KB_FX_BATTERY_STATIC;
 }
 
-static void clevo_xsm_input_close(struct input_dev *dev)
+/* Shortest frame period allowed right now, 0 = no limit */
+static u64 kb_fx_min_frame_ns(void)
 {
-	if (unlikely(IS_ERR_OR_NULL(clevo_xsm_input_polling_task)))
-		return;
+	unsigned int fps = READ_ONCE(fx_max_fps);
+	unsigned int bat = READ_ONCE(fx_battery_fps);
 
-	kthread_stop(clevo_xsm_input_polling_task);
-	clevo_xsm_input_polling_task = NULL;
+	if (READ_ONCE(kb_fx_on_battery) &&
+		READ_ONCE(fx_battery) == KB_FX_BATTERY_THROTTLE &&
+		bat && (!fps || bat < fps))
+		fps = bat;
+
+	return fps ? div_u64(NSEC_PER_SEC, fps) : 0;
 }
 
-static int __init clevo_xsm_input_init(void)
+static int kb_fx_lerp(int a, int b, unsigned int t, unsigned int n)
 {
-	int err;
-	u8 byte;
+	return a + (b - a) * (int) t / (int) n;
+}
 
-	clevo_xsm_input_device = input_allocate_device();
-	if (unlikely(!clevo_xsm_input_device)) {
-		CLEVO_XSM_ERROR("Error allocating input device\n");
-		return -ENOMEM;
-	}
+static u32 kb_fx_lerp_rgb(u32 a, u32 b, unsigned int t, unsigned int n)
+{
+	u32 rgb = 0;
+	int shift;
 
-	clevo_xsm_input_device->name = "Clevo Airplane-Mode Hotkey";
-	clevo_xsm_input_device->phys = CLEVO_XSM_DRIVER_NAME "/input0";
-	clevo_xsm_input_device->id.bustype = BUS_HOST;
-	clevo_xsm_input_device->dev.parent = &clevo_xsm_platform_device->dev;
+	for (shift = 16; shift >= 0; shift -= 8)
+		rgb |= kb_fx_lerp((a >> shift) & 0xFF, (b >> shift) & 0xFF,
+			t, n) << shift;
 
-	clevo_xsm_input_device->open  = clevo_xsm_input_open;
-	clevo_xsm_input_device->close = clevo_xsm_input_close;
+	return rgb;
+}
 
-	set_bit(EV_KEY, clevo_xsm_input_device->evbit);
-	set_bit(KEY_RFKILL, clevo_xsm_input_device->keybit);
-	set_bit(KEY_KBDILLUMTOGGLE, clevo_xsm_input_device->keybit);
-	set_bit(KEY_KBDILLUMUP, clevo_xsm_input_device->keybit);
-	set_bit(KEY_KBDILLUMDOWN, clevo_xsm_input_device->keybit);
+static u64 kb_fx_period_ns(const struct kb_fx_desc *d)
+{
+	return d->period_ns ? d->period_ns() :
+		(u64) d->period_ms * NSEC_PER_MSEC;
+}
 
-	ec_read(0xDB, &byte);
-	ec_write(0xDB, byte & ~0x40);
+/* Runs one frame of the active effect, returns the next period in ns */
+static u64 kb_fx_frame(void)
+{
+	const struct kb_fx_desc *d = kb_fx.desc;
+	const struct kb_fx_key *k;
+	const struct kb_fx_key *nk;
+	unsigned int next, zone, steps;
+	u64 period, min_ns;
+	bool lerp;
+
+	if (d->render) {
+		d->render();
+		return kb_fx_period_ns(d);
+	}
 
-	err = input_register_device(clevo_xsm_input_device);
-	if (unlikely(err)) {
-		CLEVO_XSM_ERROR("Error registering input device\n");
-		goto err_free_input_device;
+	k = &d->keys[kb_fx.key];
+	next = kb_fx.key + 1 < d->nkeys ? kb_fx.key + 1 : d->loop;
+	nk = &d->keys[next];
+	lerp = k->interp == KB_FX_LINEAR && kb_fx.tick;
+
+	kb_fx_set_level(lerp ?
+		kb_fx_lerp(k->level, nk->level, kb_fx.tick, k->frames) :
+		k->level);
+
+	if ((k->flags & KB_FX_COLOR) &&
+		(!kb_fx.tick || (lerp && (nk->flags & KB_FX_COLOR)))) {
+		for (zone = 0; zone < KB_FX_ZONES; zone++)
+			wave_set_zone_color_direct(zone, kb_fx_correct(lerp ?
+				kb_fx_lerp_rgb(k->color[zone], nk->color[zone],
+					kb_fx.tick, k->frames) :
+				k->color[zone]));
 	}
 
-	return 0;
+	if ((k->flags & KB_FX_NEXT_COLOR) && !kb_fx.tick) {
+		wave_color_idx = (wave_color_idx + 1) % wave_num_colors;
+		wave_set_color_direct(wave_color_idx);
+	}
 
-err_free_input_device:
-		input_free_device(clevo_xsm_input_device);
+	if (k->flags & KB_FX_FADE_NEXT) {
+		wave_set_fade_direct(wave_color_idx,
+			((kb_fx.tick + 1) << KB_FX_FADE_SHIFT) / k->frames);
+		if (kb_fx.tick + 1 >= k->frames)
+			wave_color_idx = (wave_color_idx + 1) % wave_num_colors;
+	}
 
-		return err;
+	/* Under a frame rate limit, skip frames but never a key's last one */
+	period = kb_fx_period_ns(d);
+	min_ns = kb_fx_min_frame_ns();
+	steps = 1;
+	if (min_ns > period && kb_fx.tick + 1 < k->frames)
+		steps = min_t(u64, DIV64_U64_ROUND_UP(min_ns, period),
+			k->frames - 1 - kb_fx.tick);
+
+	kb_fx.tick += steps;
+	if (kb_fx.tick >= k->frames) {
+		kb_fx.tick = 0;
+		kb_fx.key = next;
+	}
+
+	return period * steps;
 }
 
-static void __exit clevo_xsm_input_exit(void)
+static enum hrtimer_restart kb_fx_timer_fn(struct hrtimer *timer)
 {
-	if (unlikely(!clevo_xsm_input_device))
-		return;
-
-	input_unregister_device(clevo_xsm_input_device);
-		clevo_xsm_input_device = NULL;
+	kthread_queue_work(kb_fx.worker, &kb_fx.work);
+	return HRTIMER_NORESTART;
 }
 
-
-static int clevo_xsm_wmi_evaluate_wmbb_method(u32 method_id, u32 arg,
-	u32 *retval)
+static void kb_fx_work_fn(struct kthread_work *work)
 {
-	struct acpi_buffer in  = { (acpi_size) sizeof(arg), &arg };
-		struct acpi_buffer out = { ACPI_ALLOCATE_BUFFER, NULL };
-		union acpi_object *obj;
-		acpi_status status;
-	u32 tmp;
+	ktime_t now = ktime_get();
+	ktime_t next;
+	u64 late, period, skip = 0;
+	unsigned long flags;
 
-	CLEVO_XSM_DEBUG("%0#4x  IN : %0#6x\n", method_id, arg);
+	if (!READ_ONCE(kb_fx.running))
+		return;
 
-	status = wmi_evaluate_method(CLEVO_GET_GUID, 0x00,
-		method_id, &in, &out);
+	/* Kicked awake, this frame is due right now */
+	if (kb_fx.asleep) {
+		kb_fx.asleep = false;
+		kb_fx.deadline = now;
+	}
 
-	if (unlikely(ACPI_FAILURE(status)))
-		goto exit;
+	late = ktime_after(now, kb_fx.deadline) ?
+		ktime_to_ns(ktime_sub(now, kb_fx.deadline)) : 0;
 
-	obj = (union acpi_object *) out.pointer;
-	if (obj && obj->type == ACPI_TYPE_INTEGER)
-			tmp = (u32) obj->integer.value;
-	else
-			tmp = 0;
+	trace_clevo_xsm_effect_frame(kb_fx.mode, kb_fx.seq,
+		ktime_to_ns(kb_fx.deadline), ktime_to_ns(now));
 
-	CLEVO_XSM_DEBUG("%0#4x  OUT: %0#6x (IN: %0#6x)\n", method_id, tmp, arg);
+	period = kb_fx_frame();
+	kb_fx.seq++;
 
-	if (likely(retval))
-			*retval = tmp;
+	if (period) {
+		next = ktime_add_ns(kb_fx.deadline, period);
+		now = ktime_get();
+		if (!ktime_after(next, now)) {
+			skip = div64_u64(ktime_to_ns(ktime_sub(now, next)),
+				period) + 1;
+			next = ktime_add_ns(next, skip * period);
+		}
+		kb_fx.deadline = next;
+	} else {
+		/* Event driven effect with nothing to draw */
+		kb_fx.asleep = true;
+	}
 
-	kfree(obj);
+	spin_lock_irqsave(&kb_fx.stats_lock, flags);
+	kb_fx.frames++;
+	kb_fx.missed += skip;
+	clevo_xsm_lat_account(&kb_fx.jitter, late, 0);
+	spin_unlock_irqrestore(&kb_fx.stats_lock, flags);
 
-exit:
-	if (unlikely(ACPI_FAILURE(status)))
-		return -EIO;
+	if (period && READ_ONCE(kb_fx.running))
+		hrtimer_start(&kb_fx.timer, next, HRTIMER_MODE_ABS_HARD);
+}
 
-	return 0;
+/* Wakes an effect waiting for input, safe in atomic context */
+static void kb_fx_kick(void)
+{
+	if (READ_ONCE(kb_fx.running))
+		kthread_queue_work(kb_fx.worker, &kb_fx.work);
 }
 
+/* call with kb_fx_lock held */
+static void kb_fx_stop(void)
+{
+	if (!kb_fx.worker)
+		return;
 
-static struct {
-	enum kb_extra {
-		KB_HAS_EXTRA_TRUE,
-		KB_HAS_EXTRA_FALSE,
-	} extra;
+	WRITE_ONCE(kb_fx.running, false);
+	kb_fx.frozen = false;
+	kb_fx.paused = false;
+	kthread_cancel_work_sync(&kb_fx.work);
+	hrtimer_cancel(&kb_fx.timer);
+	kthread_cancel_work_sync(&kb_fx.work);
+}
 
-	enum kb_state {
-		KB_STATE_OFF,
-		KB_STATE_ON,
-	} state;
+/* call with kb_fx_lock held, the first frame runs right away */
+static void kb_fx_start(const struct kb_fx_desc *desc)
+{
+	kb_fx_stop();
 
-	struct {
-		unsigned left;
-		unsigned center;
-		unsigned right;
-		unsigned extra;
-	} color;
+	if (!kb_fx.worker)
+		return;
 
-	unsigned brightness;
+	kb_fx.desc = desc;
+	kb_fx.mode = desc->mode;
+	kb_fx.key = 0;
+	kb_fx.tick = 0;
+	kb_fx.seq = 0;
+	kb_fx.deadline = ktime_get();
+	kb_fx.asleep = false;
+
+	/* Held: keep the effect, kb_fx_hold() starts it when released */
+	if (kb_fx.hold) {
+		kb_fx.paused = true;
+		return;
+	}
 
-	enum kb_mode {
-		KB_MODE_RANDOM_COLOR,
-		KB_MODE_CUSTOM,
-		KB_MODE_BREATHE,
-		KB_MODE_CYCLE,
-		KB_MODE_WAVE,
-		KB_MODE_DANCE,
-		KB_MODE_TEMPO,
-		KB_MODE_FLASH,
-	} mode;
+	/* fx_battery=static: draw the first frame and leave it there */
+	if (kb_fx_battery_static()) {
+		kb_fx.frozen = true;
+		kb_fx_frame();
+		return;
+	}
 
-	struct kb_backlight_ops {
-		void (*set_state)(enum kb_state state);
-		void (*set_color)(unsigned left, unsigned center,
-			unsigned right, unsigned extra);
-		void (*set_brightness)(unsigned brightness);
-		void (*set_mode)(enum kb_mode);
-		void (*init)(void);
-	} *ops;
+	WRITE_ONCE(kb_fx.running, true);
+	kthread_queue_work(kb_fx.worker, &kb_fx.work);
+}
 
-} kb_backlight = { .ops = NULL, };
+/*
+ * call with kb_fx_lock held. While any hold reason is set the engine
+ * issues no frames and arms no timers. The selected effect starts over
+ * once the last reason is gone. Returns true if this stopped an effect.
+ */
+static bool kb_fx_hold(unsigned long reason, bool on)
+{
+	unsigned long was = kb_fx.hold;
+	bool active = READ_ONCE(kb_fx.running) || kb_fx.frozen;
 
+	if (on)
+		kb_fx.hold |= reason;
+	else
+		kb_fx.hold &= ~reason;
 
-static void kb_dec_brightness(void)
-{
-	if (kb_backlight.state == KB_STATE_OFF)
-		return;
-	if (kb_backlight.brightness == 0)
-		return;
+	if (!was && kb_fx.hold && active) {
+		kb_fx_stop();
+		kb_fx.paused = true;
+		return true;
+	}
 
-	CLEVO_XSM_DEBUG();
+	if (was && !kb_fx.hold && kb_fx.paused)
+		kb_fx_start(kb_fx.desc);
 
-	kb_backlight.ops->set_brightness(kb_backlight.brightness - 1);
+	return false;
 }
 
-static void kb_inc_brightness(void)
+/*
+ * call with kb_fx_lock held. The worker reads the palette, the fade
+ * tables and wave_color_idx without kb_fx_lock, so a running effect is
+ * stopped while they change; kb_fx_unpark() starts it over.
+ */
+static bool kb_fx_park(void)
 {
-	if (kb_backlight.state == KB_STATE_OFF)
-		return;
-
-	CLEVO_XSM_DEBUG();
+	if (!READ_ONCE(kb_fx.running))
+		return false;
 
-	kb_backlight.ops->set_brightness(kb_backlight.brightness + 1);
+	kb_fx_stop();
+	return true;
 }
 
-static void kb_toggle_state(void)
+/* call with kb_fx_lock held */
+static void kb_fx_unpark(bool parked)
 {
-	/* Static vars to save last colors before turning off */
-	static unsigned saved_left = 1;   /* default cyan */
-	static unsigned saved_center = 1;
-	static unsigned saved_right = 1;
-	static unsigned saved_extra = 1;
-	
-	switch (kb_backlight.state) {
-	case KB_STATE_OFF:
-		/* Turn ON: restore saved colors */
-		kb_backlight.ops->set_color(saved_left, saved_center, 
-					    saved_right, saved_extra);
-		kb_backlight.ops->set_brightness(0); /* max brightness */
-		kb_backlight.state = KB_STATE_ON;
-		break;
-	case KB_STATE_ON:
-		/* Turn OFF: save current colors, set to black (index 0) */
-		saved_left = kb_backlight.color.left;
-		saved_center = kb_backlight.color.center;
-		saved_right = kb_backlight.color.right;
-		saved_extra = kb_backlight.color.extra;
-		kb_backlight.ops->set_color(0, 0, 0, 0); /* black = off */
-		kb_backlight.state = KB_STATE_OFF;
-		break;
-	default:
-		BUG();
-	}
+	if (parked)
+		kb_fx_start(kb_fx.desc);
 }
 
-static void kb_next_mode(void)
+static int __init kb_fx_init(void)
 {
-	static enum kb_mode modes[] = {
-		KB_MODE_RANDOM_COLOR,
-		KB_MODE_DANCE,
-		KB_MODE_TEMPO,
-		KB_MODE_FLASH,
-		KB_MODE_WAVE,
-		KB_MODE_BREATHE,
-		KB_MODE_CYCLE,
-		KB_MODE_CUSTOM,
-	};
+	kb_fx_rebuild_lut();
+	wave_rebuild_fade();
 
-	size_t i;
+	spin_lock_init(&kb_fx.stats_lock);
+	kthread_init_work(&kb_fx.work, kb_fx_work_fn);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+	hrtimer_setup(&kb_fx.timer, kb_fx_timer_fn, CLOCK_MONOTONIC,
+		HRTIMER_MODE_ABS_HARD);
+#else
+	hrtimer_init(&kb_fx.timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_HARD);
+	kb_fx.timer.function = kb_fx_timer_fn;
+#endif
 
-	if (kb_backlight.state == KB_STATE_OFF)
-		return;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+	kb_fx.worker = kthread_run_worker(0, "kb_fx");
+#else
+	kb_fx.worker = kthread_create_worker(0, "kb_fx");
+#endif
+	if (IS_ERR(kb_fx.worker)) {
+		int err = PTR_ERR(kb_fx.worker);
 
-	for (i = 0; i < ARRAY_SIZE(modes); i++) {
-		if (modes[i] == kb_backlight.mode)
-			break;
+		kb_fx.worker = NULL;
+		return err;
 	}
 
-	BUG_ON(i == ARRAY_SIZE(modes));
+	if (fx_rt_prio) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+		sched_set_fifo_low(kb_fx.worker->task);
+#else
+		struct sched_param param = { .sched_priority = 1 };
 
-	kb_backlight.ops->set_mode(modes[(i + 1) % ARRAY_SIZE(modes)]);
+		sched_setscheduler(kb_fx.worker->task, SCHED_FIFO, &param);
+#endif
+	}
+
+	return 0;
 }
 
-static void kb_next_color(void)
+static void kb_fx_exit(void)
 {
-	size_t i;
-	unsigned int nc;
-
-	if (kb_backlight.state == KB_STATE_OFF)
+	if (!kb_fx.worker)
 		return;
 
-	for (i = 0; i < ARRAY_SIZE(kb_colors); i++) {
-		if (i == kb_backlight.color.left)
-			break;
-	}
+	mutex_lock(&kb_fx_lock);
+	kb_fx_stop();
+	mutex_unlock(&kb_fx_lock);
 
-	if (i + 1 > ARRAY_SIZE(kb_colors))
-		nc = 0;
-	else
-		nc = i + 1;
+	kthread_destroy_worker(kb_fx.worker);
+	kb_fx.worker = NULL;
+}
 
-	kb_backlight.ops->set_color(nc, nc, nc, nc);
+/*
+ * Follows AC/battery for fx_battery. The power_supply notifier runs in
+ * atomic context and fires on every property change, so it only kicks
+ * kb_fx_power_work, which restarts a running effect when it has to move
+ * into or out of its static frame.
+ */
+static void kb_fx_power_work_fn(struct work_struct *work)
+{
+	/* No power supplies at all (< 0) counts as AC */
+	bool battery = power_supply_is_system_supplied() == 0;
+
+	mutex_lock(&kb_fx_lock);
+	WRITE_ONCE(kb_fx_on_battery, battery);
+	if ((READ_ONCE(kb_fx.running) || kb_fx.frozen) &&
+		kb_fx_battery_static() != kb_fx.frozen)
+		kb_fx_start(kb_fx.desc);
+	mutex_unlock(&kb_fx_lock);
 }
 
-/* full color backlight keyboard */
+#if IS_REACHABLE(CONFIG_POWER_SUPPLY)
+static int kb_fx_power_notify(struct notifier_block *nb,
+	unsigned long event, void *data)
+{
+	if (event == PSY_EVENT_PROP_CHANGED)
+		schedule_work(&kb_fx_power_work);
 
-static void kb_full_color__set_color(unsigned left, unsigned center,
-	unsigned right, unsigned extra)
+	return NOTIFY_OK;
+}
+
+static struct notifier_block kb_fx_power_nb = {
+	.notifier_call = kb_fx_power_notify,
+};
+#endif
+
+static void __init kb_fx_power_init(void)
 {
-	u32 cmd;
+	INIT_WORK(&kb_fx_power_work, kb_fx_power_work_fn);
+	kb_fx_power_work_fn(&kb_fx_power_work);
+	WRITE_ONCE(kb_fx_power_ready, true);
 
-	cmd = 0xF0000000;
-	cmd |= kb_colors[left].value.b << 16;
-	cmd |= kb_colors[left].value.r <<  8;
-	cmd |= kb_colors[left].value.g <<  0;
+#if IS_REACHABLE(CONFIG_POWER_SUPPLY)
+	if (power_supply_reg_notifier(&kb_fx_power_nb))
+		CLEVO_XSM_ERROR("Could not register power supply notifier\n");
+#endif
+}
 
-	if (!clevo_xsm_wmi_evaluate_wmbb_method(SET_KB_LED, cmd, NULL))
-		kb_backlight.color.left = left;
+static void kb_fx_power_exit(void)
+{
+#if IS_REACHABLE(CONFIG_POWER_SUPPLY)
+	power_supply_unreg_notifier(&kb_fx_power_nb);
+#endif
+	WRITE_ONCE(kb_fx_power_ready, false);
+	cancel_work_sync(&kb_fx_power_work);
+}
 
-	cmd = 0xF1000000;
-	cmd |= kb_colors[center].value.b << 16;
-	cmd |= kb_colors[center].value.r <<  8;
-	cmd |= kb_colors[center].value.g <<  0;
+static u64 wave_frame_ns(void)
+{
+	if (wave_period_ms)
+		return div_u64((u64) wave_period_ms * NSEC_PER_MSEC,
+			NUM_WAVE_STEPS);
 
-	if (!clevo_xsm_wmi_evaluate_wmbb_method(SET_KB_LED, cmd, NULL))
-		kb_backlight.color.center = center;
+	return (u64) max(wave_interval_ms, 10U) * NSEC_PER_MSEC;
+}
 
-	cmd = 0xF2000000;
-	cmd |= kb_colors[right].value.b << 16;
-	cmd |= kb_colors[right].value.r <<  8;
-	cmd |= kb_colors[right].value.g <<  0;
+/* Built-in effects, frame counts match the former hard-coded tables */
+static const struct kb_fx_key kb_fx_wave_keys[] = {
+	/* Fade to the next color while dimming, done at the dimmest point */
+	{ .frames = 9, .level = KB_FX_LEVEL_MAX, .interp = KB_FX_LINEAR,
+	  .flags = KB_FX_FADE_NEXT },
+	{ .frames = 9, .level = KB_FX_LEVEL_DIM, .interp = KB_FX_LINEAR },
+	{ .frames = 1, .level = KB_FX_LEVEL_MAX, .interp = KB_FX_STEP },
+};
 
-	if (!clevo_xsm_wmi_evaluate_wmbb_method(SET_KB_LED, cmd, NULL))
-		kb_backlight.color.right = right;
+static const struct kb_fx_desc kb_fx_wave = {
+	.name = "wave",
+	.mode = LED_MODE_WAVE,
+	.keys = kb_fx_wave_keys,
+	.nkeys = ARRAY_SIZE(kb_fx_wave_keys),
+	.loop = 0,
+	.period_ns = wave_frame_ns,
+};
 
-	if (kb_backlight.extra == KB_HAS_EXTRA_TRUE) {
-		cmd = 0xF3000000;
-		cmd |= kb_colors[extra].value.b << 16;
-		cmd |= kb_colors[extra].value.r << 8;
-		cmd |= kb_colors[extra].value.g << 0;
+/* Breath effect - fade in/out without color change, 1.8 s per cycle */
+static const struct kb_fx_key kb_fx_breath_keys[] = {
+	{ .frames = 18, .level = KB_FX_LEVEL_MAX, .interp = KB_FX_LINEAR },
+	{ .frames = 18, .level = KB_FX_LEVEL_DIM, .interp = KB_FX_LINEAR },
+};
 
-		if(!clevo_xsm_wmi_evaluate_wmbb_method(SET_KB_LED, cmd, NULL))
-			kb_backlight.color.extra = extra;
-	}
+static const struct kb_fx_desc kb_fx_breath = {
+	.name = "breath",
+	.mode = LED_MODE_BREATH,
+	.keys = kb_fx_breath_keys,
+	.nkeys = ARRAY_SIZE(kb_fx_breath_keys),
+	.loop = 0,
+	.period_ms = 50,
+};
 
-	kb_backlight.mode = KB_MODE_CUSTOM;
+/* Blink effect - flash on/off, starting dim */
+static const struct kb_fx_key kb_fx_blink_keys[] = {
+	{ .frames = 1, .level = KB_FX_LEVEL_DIM, .interp = KB_FX_STEP },
+	{ .frames = 1, .level = KB_FX_LEVEL_MAX, .interp = KB_FX_STEP },
+};
+
+static const struct kb_fx_desc kb_fx_blink = {
+	.name = "blink",
+	.mode = LED_MODE_BLINK,
+	.keys = kb_fx_blink_keys,
+	.nkeys = ARRAY_SIZE(kb_fx_blink_keys),
+	.loop = 0,
+	.period_ms = 500,
+};
+
+/*
+ * Zone wave - a wave travelling from left to right. Each zone reads the
+ * sine LUT at its own phase offset and scales the palette color with it.
+ * Unchanged zone colors are dropped by the shadow cache, so a frame costs
+ * at most one WMI call per zone.
+ */
+#define ZONE_WAVE_FRAMES   64  /* frames per cycle, if the period allows */
+#define ZONE_WAVE_FRAME_MIN_NS (20 * NSEC_PER_MSEC)
+
+static unsigned int zone_wave_phase = 64;
+module_param(zone_wave_phase, uint, 0644);
+MODULE_PARM_DESC(zone_wave_phase, "Zone wave phase offset between zones, 256 = one cycle (default 64)");
+
+static unsigned int zone_wave_zones = KB_FX_ZONES;
+static u32 zone_wave_acc;  /* one cycle = 2^32 */
+
+static u64 zone_wave_cycle_ns(void)
+{
+	if (wave_period_ms)
+		return (u64) wave_period_ms * NSEC_PER_MSEC;
+
+	return (u64) max(wave_interval_ms, 10U) * NUM_WAVE_STEPS *
+		NSEC_PER_MSEC;
 }
 
-static void kb_full_color__set_brightness(unsigned i)
+static u64 zone_wave_frame_ns(void)
 {
-	/* Firmware-native 10 brightness levels (0-9)
-	 * From DSDT: raw = 0xFF - (level * 0x19)
-	 * Level 0 = 0xFF (max), Level 9 = 0x0E (min)
-	 */
-	u8 raw_brightness;
-	
-	i = clamp_t(unsigned, i, 0, 9);
-	raw_brightness = 0xFF - (i * 0x19);  /* Match EC firmware formula */
+	u64 min_ns = max_t(u64, kb_fx_min_frame_ns(), ZONE_WAVE_FRAME_MIN_NS);
 
-	if (!clevo_xsm_wmi_evaluate_wmbb_method(SET_KB_LED,
-		0xF4000000 | raw_brightness, NULL))
-		kb_backlight.brightness = i;
+	return max(div_u64(zone_wave_cycle_ns(), ZONE_WAVE_FRAMES), min_ns);
 }
 
-static void kb_full_color__set_mode(unsigned mode)
+static u32 kb_fx_scale_rgb(u32 rgb, u8 level)
 {
-	static u32 cmds[] = {
-		[KB_MODE_BREATHE]      = 0x1002a000,
-		[KB_MODE_CUSTOM]       = 0,
-		[KB_MODE_CYCLE]        = 0x33010000,
-		[KB_MODE_DANCE]        = 0x80000000,
-		[KB_MODE_FLASH]        = 0xA0000000,
-		[KB_MODE_RANDOM_COLOR] = 0x70000000,
-		[KB_MODE_TEMPO]        = 0x90000000,
-		[KB_MODE_WAVE]         = 0xB0000000,
-	};
+	u32 out = 0;
+	int shift;
 
-	BUG_ON(mode >= ARRAY_SIZE(cmds));
+	for (shift = 16; shift >= 0; shift -= 8)
+		out |= ((((rgb >> shift) & 0xFF) * (level + 1)) >> 8) << shift;
 
-	clevo_xsm_wmi_evaluate_wmbb_method(SET_KB_LED, 0x10000000, NULL);
+	return out;
+}
 
-	if (mode == KB_MODE_CUSTOM) {
-		kb_full_color__set_color(kb_backlight.color.left,
-			kb_backlight.color.center,
-			kb_backlight.color.right,
-			kb_backlight.color.extra);
-		kb_full_color__set_brightness(kb_backlight.brightness);
-		return;
+static void zone_wave_render(void)
+{
+	u32 color = wave_color_values[wave_color_idx % wave_num_colors];
+	u32 prev = zone_wave_acc;
+	u64 step;
+	unsigned int zone;
+	u8 idx;
+
+	for (zone = 0; zone < zone_wave_zones; zone++) {
+		idx = (zone_wave_acc >> 24) - zone * zone_wave_phase;
+		wave_set_zone_color_direct(zone, kb_fx_correct(
+			kb_fx_scale_rgb(color, kb_fx_sine_lut[idx])));
 	}
 
-	if (!clevo_xsm_wmi_evaluate_wmbb_method(SET_KB_LED, cmds[mode], NULL))
-		kb_backlight.mode = mode;
+	step = div64_u64(zone_wave_frame_ns() << 32, zone_wave_cycle_ns());
+	zone_wave_acc += (u32) min_t(u64, step, U32_MAX);
+
+	/* Next palette color once per cycle */
+	if (zone_wave_acc < prev)
+		wave_color_idx = (wave_color_idx + 1) % wave_num_colors;
 }
 
-static void kb_full_color__set_state(enum kb_state state)
-{
-	u32 cmd = 0xE0000000;
+static const struct kb_fx_desc kb_fx_zone_wave = {
+	.name = "zone_wave",
+	.mode = LED_MODE_ZONE_WAVE,
+	.period_ns = zone_wave_frame_ns,
+	.render = zone_wave_render,
+};
 
-	CLEVO_XSM_DEBUG("State: %d\n", state);
+/*
+ * Reactive typing - each key press on the internal keyboard flashes all
+ * zones towards react_color at full brightness, and the flash decays back
+ * to the keyboard colors over react_decay_ms. Presses come in through
+ * kb_react_handler; all presses since the previous frame make one flash.
+ * Once the flash has decayed the effect sleeps until the next press kicks
+ * it, so a keyboard at rest costs no frames.
+ */
+#define REACT_FRAME_MIN_NS (20 * NSEC_PER_MSEC)
 
-	switch (state) {
-	case KB_STATE_OFF:
-		cmd |= 0x003001;
-		break;
-	case KB_STATE_ON:
-		cmd |= 0x07F001;
-		break;
-	default:
-		BUG();
+static unsigned int react_decay_ms = 500;
+module_param(react_decay_ms, uint, 0644);
+MODULE_PARM_DESC(react_decay_ms, "Reactive effect flash decay time in ms (default 500)");
+
+static unsigned int react_color = 0xFFFFFF;
+module_param(react_color, uint, 0644);
+MODULE_PARM_DESC(react_color, "Reactive effect flash color as 0xRRGGBB (default 0xFFFFFF)");
+
+static struct {
+	spinlock_t lock;    /* press_ns, sleeping and the statistics */
+	u64 press_ns;       /* first press since the last frame, 0 = none */
+	bool sleeping;      /* no frames until the next press */
+	bool active;
+	u64 flash_ns;       /* start of the current flash, worker only */
+	unsigned int zones;
+	u32 base[KB_FX_MAX_ZONES];  /* keyboard colors, 0xRRGGBB */
+	u64 presses;
+	u64 coalesced;      /* presses merged into an earlier one's frame */
+	struct clevo_xsm_lat_stats latency;  /* press to LEDs written */
+} kb_react;
+
+static void kb_react_render(void)
+{
+	u64 decay = (u64) max(READ_ONCE(react_decay_ms), 1U) * NSEC_PER_MSEC;
+	u32 flash = READ_ONCE(react_color) & 0xFFFFFF;
+	u64 now = ktime_get_ns();
+	u64 press, elapsed;
+	unsigned int zone, t = 0;
+
+	spin_lock_irq(&kb_react.lock);
+	press = kb_react.press_ns;
+	kb_react.press_ns = 0;
+	spin_unlock_irq(&kb_react.lock);
+
+	if (press)
+		kb_react.flash_ns = now;
+
+	elapsed = now - kb_react.flash_ns;
+	if (kb_react.flash_ns && elapsed < decay) {
+		/* 256 at the press, easing out to 0 */
+		t = 256 - div64_u64(elapsed << 8, decay);
+		t = t * t >> 8;
+	} else {
+		kb_react.flash_ns = 0;
 	}
 
-	if (!clevo_xsm_wmi_evaluate_wmbb_method(SET_KB_LED, cmd, NULL))
-		kb_backlight.state = state;
+	for (zone = 0; zone < kb_react.zones; zone++)
+		wave_set_zone_color_direct(zone, kb_fx_correct(kb_fx_lerp_rgb(
+			READ_ONCE(kb_react.base[zone]), flash, t, 256)));
+	kb_fx_set_level(kb_fx_lerp(KB_FX_LEVEL_DIM, KB_FX_LEVEL_MAX, t, 256));
+
+	spin_lock_irq(&kb_react.lock);
+	if (press)
+		clevo_xsm_lat_account(&kb_react.latency,
+			ktime_get_ns() - press, 0);
+	/* Back at rest, unless a press came in while drawing */
+	if (!kb_react.flash_ns && !kb_react.press_ns)
+		kb_react.sleeping = true;
+	spin_unlock_irq(&kb_react.lock);
 }
 
-static void kb_full_color__init(void)
+static u64 kb_react_frame_ns(void)
 {
-	CLEVO_XSM_DEBUG();
-
-	kb_backlight.extra = KB_HAS_EXTRA_FALSE;
+	if (READ_ONCE(kb_react.sleeping))
+		return 0;
 
-	kb_full_color__set_state(param_kb_off ? KB_STATE_OFF : KB_STATE_ON);
-	kb_full_color__set_color(param_kb_color[0], param_kb_color[1],
-		param_kb_color[2], param_kb_color[3]);
-	kb_full_color__set_brightness(param_kb_brightness);
+	return max_t(u64, kb_fx_min_frame_ns(), REACT_FRAME_MIN_NS);
 }
 
-static struct kb_backlight_ops kb_full_color_ops = {
-	.set_state      = kb_full_color__set_state,
-	.set_color      = kb_full_color__set_color,
-	.set_brightness = kb_full_color__set_brightness,
-	.set_mode       = kb_full_color__set_mode,
-	.init           = kb_full_color__init,
+static const struct kb_fx_desc kb_fx_react = {
+	.name = "reactive",
+	.mode = LED_MODE_REACTIVE,
+	.period_ns = kb_react_frame_ns,
+	.render = kb_react_render,
 };
 
-static void kb_full_color__init_extra(void)
+/*
+ * Stream - frames from /dev/clevo_kb, see clevo_kb.h. Each frame draws
+ * the latest frame that is due and sleeps until the next one is. With
+ * the ring empty the effect keeps polling it for STREAM_IDLE_NS, so a
+ * producer going through mmap() alone needs no syscalls while it keeps
+ * up, then sleeps until write() kicks it. The ring is shared with
+ * userspace: the kernel keeps its own tail and reads each frame once.
+ */
+#define STREAM_FRAME_MIN_NS (5 * NSEC_PER_MSEC)
+#define STREAM_IDLE_NS      (500 * NSEC_PER_MSEC)
+
+static struct {
+	struct clevo_kb_ring *ring;  /* NULL while /dev/clevo_kb is closed */
+	u32 tail;           /* next frame to consume, see smp_store_release() */
+	u64 period;         /* until the next frame, 0 = sleep, worker only */
+	u64 idle_ns;        /* ring empty since, 0 = not empty, worker only */
+	u32 dropped;        /* since open, worker only */
+	bool sleeping;      /* no frames until kb_stream_kick() */
+	unsigned int zones;
+	int prev_mode;      /* put back when the device is closed */
+	unsigned long busy; /* bit 0: open */
+	bool registered;
+	struct mutex write_lock;
+	wait_queue_head_t space;
+	spinlock_t lock;    /* the statistics */
+	u64 frames;
+	u64 frames_dropped;
+	struct clevo_xsm_lat_stats latency;  /* time_ns to LEDs written */
+} kb_stream;
+
+static void kb_stream_draw(const struct clevo_kb_frame *f)
 {
-	CLEVO_XSM_DEBUG();
+	unsigned int zone;
+	u32 rgb;
 
-	kb_backlight.extra = KB_HAS_EXTRA_TRUE;
+	for (zone = 0; zone < kb_stream.zones; zone++) {
+		if (!(f->zones & BIT(zone)))
+			continue;
+		rgb = f->rgb[zone][0] << 16 | f->rgb[zone][1] << 8 |
+			f->rgb[zone][2];
+		wave_set_zone_color_direct(zone,
+			f->flags & CLEVO_KB_FRAME_RAW ? rgb : kb_fx_correct(rgb));
+	}
 
-	kb_full_color__set_state(param_kb_off ? KB_STATE_OFF : KB_STATE_ON);
-	kb_full_color__set_color(param_kb_color[0], param_kb_color[1],
-		param_kb_color[2], param_kb_color[3]);
-	kb_full_color__set_brightness(param_kb_brightness);
+	if (f->flags & CLEVO_KB_FRAME_BRIGHTNESS)
+		clevo_xsm_kb_led_write(0xF4000000 | f->brightness);
 }
 
-static struct kb_backlight_ops kb_full_color_with_extra_ops = {
-	.set_state      = kb_full_color__set_state,
-	.set_color      = kb_full_color__set_color,
-	.set_brightness = kb_full_color__set_brightness,
-	.set_mode       = kb_full_color__set_mode,
-	.init           = kb_full_color__init_extra,
-};
-
-/* 8 color backlight keyboard */
-
-static void kb_8_color__set_color(unsigned left, unsigned center,
-	unsigned right, unsigned extra)
+static void kb_stream_render(void)
 {
-	u32 cmd = 0x02010000;
+	struct clevo_kb_ring *ring = kb_stream.ring;
+	struct clevo_kb_frame f, next;
+	u64 now = ktime_get_ns();
+	u64 min_ns = max_t(u64, kb_fx_min_frame_ns(), STREAM_FRAME_MIN_NS);
+	u32 head, tail = kb_stream.tail;
+	unsigned int dropped = 0;
+	bool draw = false, pending = false;
+
+	kb_stream.period = min_ns;
+	if (!ring)
+		return;
 
-	cmd |= kb_backlight.brightness << 12;
-	cmd |= right  << 8;
-	cmd |= center << 4;
-	cmd |= left;
+	if (kb_stream.sleeping) {
+		WRITE_ONCE(kb_stream.sleeping, false);
+		WRITE_ONCE(ring->flags, 0);
+	}
 
-	if (!clevo_xsm_wmi_evaluate_wmbb_method(SET_KB_LED, cmd, NULL)) {
-		kb_backlight.color.left   = left;
-		kb_backlight.color.center = center;
-		kb_backlight.color.right  = right;
+	/* A producer more than a ring ahead lost what it wrote */
+	head = smp_load_acquire(&ring->head);
+	if (head - tail > CLEVO_KB_RING_FRAMES) {
+		dropped += head - tail;
+		tail = head;
 	}
 
-	kb_backlight.mode = KB_MODE_CUSTOM;
-}
+	while (tail != head) {
+		memcpy(&next, &ring->frames[tail % CLEVO_KB_RING_FRAMES],
+			sizeof(next));
+		if (next.time_ns > now) {
+			pending = true;
+			break;
+		}
+		if (draw)
+			dropped++;
+		f = next;
+		draw = true;
+		tail++;
+	}
+	if (tail != kb_stream.tail) {
+		smp_store_release(&kb_stream.tail, tail);
+		WRITE_ONCE(ring->tail, tail);
+		wake_up_interruptible(&kb_stream.space);
+	}
 
-static void kb_8_color__set_brightness(unsigned i)
-{
-	u32 cmd = 0xD2010000;
+	if (draw)
+		kb_stream_draw(&f);
 
-	i = clamp_t(unsigned, i, 0, KB_BRIGHTNESS_MAX);
+	if (dropped) {
+		kb_stream.dropped += dropped;
+		WRITE_ONCE(ring->dropped, kb_stream.dropped);
+	}
 
-	cmd |= i << 12;
-	cmd |= kb_backlight.color.right  << 8;
-	cmd |= kb_backlight.color.center << 4;
-	cmd |= kb_backlight.color.left;
+	spin_lock(&kb_stream.lock);
+	kb_stream.frames += draw;
+	kb_stream.frames_dropped += dropped;
+	if (draw && f.time_ns)
+		clevo_xsm_lat_account(&kb_stream.latency,
+			ktime_get_ns() - f.time_ns, 0);
+	spin_unlock(&kb_stream.lock);
+
+	if (pending) {
+		/* Wake up at the frame's time, the engine adds to its deadline */
+		kb_stream.idle_ns = 0;
+		if (next.time_ns > ktime_to_ns(kb_fx.deadline) + min_ns)
+			kb_stream.period = next.time_ns -
+				ktime_to_ns(kb_fx.deadline);
+		return;
+	}
 
-	if (!clevo_xsm_wmi_evaluate_wmbb_method(SET_KB_LED, cmd, NULL))
-		kb_backlight.brightness = i;
+	if (draw || !kb_stream.idle_ns) {
+		kb_stream.idle_ns = now;
+		return;
+	}
+	if (now - kb_stream.idle_ns < STREAM_IDLE_NS)
+		return;
+
+	/* Pairs with the barrier in kb_stream_kick() and in the producer */
+	WRITE_ONCE(kb_stream.sleeping, true);
+	WRITE_ONCE(ring->flags, CLEVO_KB_RING_NEED_WAKEUP);
+	smp_mb();
+	if (READ_ONCE(ring->head) == tail)
+		kb_stream.period = 0;
 }
 
-static void kb_8_color__set_mode(unsigned mode)
+static u64 kb_stream_frame_ns(void)
 {
-	static u32 cmds[] = {
-		[KB_MODE_BREATHE]      = 0x12010000,
-		[KB_MODE_CUSTOM]       = 0,
-		[KB_MODE_CYCLE]        = 0x32010000,
-		[KB_MODE_DANCE]        = 0x80000000,
-		[KB_MODE_FLASH]        = 0xA0000000,
-		[KB_MODE_RANDOM_COLOR] = 0x70000000,
-		[KB_MODE_TEMPO]        = 0x90000000,
-		[KB_MODE_WAVE]         = 0xB0000000,
-	};
+	return kb_stream.period;
+}
 
-	BUG_ON(mode >= ARRAY_SIZE(cmds));
+/* After publishing frames, wakes the effect if it went to sleep */
+static void kb_stream_kick(void)
+{
+	smp_mb();
+	if (READ_ONCE(kb_stream.sleeping))
+		kb_fx_kick();
+}
 
-	clevo_xsm_wmi_evaluate_wmbb_method(SET_KB_LED, 0x20000000, NULL);
+static const struct kb_fx_desc kb_fx_stream = {
+	.name = "stream",
+	.mode = LED_MODE_STREAM,
+	.period_ns = kb_stream_frame_ns,
+	.render = kb_stream_render,
+};
 
-	if (mode == KB_MODE_CUSTOM) {
-		kb_8_color__set_color(kb_backlight.color.left,
-			kb_backlight.color.center,
-			kb_backlight.color.right, kb_backlight.color.extra);
-		kb_8_color__set_brightness(kb_backlight.brightness);
-		return;
-	}
+static const struct kb_fx_desc *const kb_fx_builtin[] = {
+	[LED_MODE_WAVE]      = &kb_fx_wave,
+	[LED_MODE_BREATH]    = &kb_fx_breath,
+	[LED_MODE_BLINK]     = &kb_fx_blink,
+	[LED_MODE_ZONE_WAVE] = &kb_fx_zone_wave,
+	[LED_MODE_REACTIVE]  = &kb_fx_react,
+	[LED_MODE_STREAM]    = &kb_fx_stream,
+};
 
-	if (!clevo_xsm_wmi_evaluate_wmbb_method(SET_KB_LED,
-		cmds[mode], NULL))
-		kb_backlight.mode = mode;
+static bool wave_running(void)
+{
+	return (READ_ONCE(kb_fx.running) || kb_fx.frozen || kb_fx.paused) &&
+		kb_fx.mode == LED_MODE_WAVE;
 }
 
-static void kb_8_color__set_state(enum kb_state state)
+/* call with kb_fx_lock held */
+static void wave_start(void)
 {
-	CLEVO_XSM_DEBUG("State: %d\n", state);
-
-	switch (state) {
-	case KB_STATE_OFF:
-		if (!clevo_xsm_wmi_evaluate_wmbb_method(SET_KB_LED,
-			0x22010000, NULL))
-			kb_backlight.state = state;
-		break;
-	case KB_STATE_ON:
-		kb_8_color__set_mode(kb_backlight.mode);
-		kb_backlight.state = state;
-		break;
-	default:
-		BUG();
-	}
+	if (wave_running())
+		return;
+	
+	current_led_mode = LED_MODE_WAVE;
+	
+	kb_fx_set_level(KB_FX_LEVEL_MAX);
+	
+	kb_fx_start(&kb_fx_wave);
 }
 
-static void kb_8_color__init(void)
+/* call with kb_fx_lock held */
+static void wave_stop(void)
 {
-	CLEVO_XSM_DEBUG();
-
-	kb_8_color__set_state(KB_STATE_OFF);
+	if (!wave_running())
+		return;
+	
+	kb_fx_stop();
+	current_led_mode = LED_MODE_STATIC;
+	
+	kb_fx_set_level(KB_FX_LEVEL_MAX);
+}
 
-	kb_backlight.color.left   = param_kb_color[0];
-	kb_backlight.color.center = param_kb_color[1];
-	kb_backlight.color.right  = param_kb_color[2];
+/* input sub-driver */
 
-	kb_backlight.brightness = param_kb_brightness;
-	kb_backlight.mode       = KB_MODE_CUSTOM;
-	kb_backlight.extra      = KB_HAS_EXTRA_FALSE;
+static struct input_dev *clevo_xsm_input_device;
+static DEFINE_MUTEX(clevo_xsm_input_report_mutex);
 
-	if (!param_kb_off) {
-		kb_8_color__set_color(kb_backlight.color.left,
-			kb_backlight.color.center,
-			kb_backlight.color.right, kb_backlight.color.extra);
-		kb_8_color__set_brightness(kb_backlight.brightness);
-		kb_8_color__set_state(KB_STATE_ON);
-	}
+/* call with clevo_xsm_input_report_mutex held */
+static void clevo_xsm_input_report_key(unsigned int code)
+{
+	input_report_key(clevo_xsm_input_device, code, 1);
+	input_report_key(clevo_xsm_input_device, code, 0);
+	input_sync(clevo_xsm_input_device);
 }
 
-static struct kb_backlight_ops kb_8_color_ops = {
-	.set_state      = kb_8_color__set_state,
-	.set_color      = kb_8_color__set_color,
-	.set_brightness = kb_8_color__set_brightness,
-	.set_mode       = kb_8_color__set_mode,
-	.init           = kb_8_color__init,
-};
+/*
+ * Airplane-Mode hotkey
+ *
+ * Most firmwares raise WMI event 0xF4 for the key. Until the first such
+ * event is seen the EC flag (0xDB bit 6) is polled while the input device
+ * is open. The poll interval starts at 1000 / poll_freq ms and doubles on
+ * every idle poll up to HOTKEY_POLL_MAX_MS, so an idle machine only wakes
+ * up a few times a minute. Once the event has been seen polling stops for
+ * good.
+ */
+#define HOTKEY_POLL_MAX_MS 1600
 
+static struct delayed_work clevo_xsm_hotkey_poll_work;
+static DEFINE_MUTEX(clevo_xsm_hotkey_lock);  /* serialises start and stop */
+static bool clevo_xsm_hotkey_has_event;
+static bool clevo_xsm_hotkey_polling;
+static unsigned int clevo_xsm_hotkey_poll_ms;
+static u64 clevo_xsm_hotkey_press_ns;  /* last poller report, input mutex */
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
-static void clevo_xsm_wmi_notify(union acpi_object *obj, void *context)
-{
-	/* On newer kernels, we don't get the u32 value directly. 
-	 * We assume the event is relevant if we received it.
-	 */
-#else
-static void clevo_xsm_wmi_notify(u32 value, void *context)
+static struct {
+	u64 polls;
+	u64 events;
+	u64 presses;
+	u64 poll_start_ns;
+	u64 poll_ns;  /* time spent polling, excluding the current run */
+} clevo_xsm_hotkey_stats;
+
+static void clevo_xsm_hotkey_poll(struct work_struct *work)
 {
-	if (value != 0xD0) {
-		CLEVO_XSM_INFO("Unexpected WMI event (%0#6x)\n", value);
-		return;
-	}
-#endif
+	unsigned int min_ms = 1000 / param_poll_freq;
+	u8 byte;
 
-	static unsigned int report_cnt;
-	u32 event;
+	clevo_xsm_hotkey_stats.polls++;
 
-	clevo_xsm_wmi_evaluate_wmbb_method(GET_EVENT, 0, &event);
-	
-	/* Log all events to help identify key codes */
-	CLEVO_XSM_INFO("WMI event received: 0x%02x\n", event);
+	if (!clevo_xsm_ec_read(0xDB, &byte) && (byte & 0x40)) {
+		clevo_xsm_ec_write(0xDB, byte & ~0x40);
 
-	switch (event) {
-	case 0xF4:
 		CLEVO_XSM_DEBUG("Airplane-Mode Hotkey pressed\n");
 
-		if (clevo_xsm_input_polling_task) {
-			CLEVO_XSM_INFO("Stopping polling thread\n");
-			kthread_stop(clevo_xsm_input_polling_task);
-			clevo_xsm_input_polling_task = NULL;
-		}
-
 		mutex_lock(&clevo_xsm_input_report_mutex);
 
-		if (global_report_cnt > report_cnt) {
-			mutex_unlock(&clevo_xsm_input_report_mutex);
-			break;
-		}
-
 		clevo_xsm_input_report_key(KEY_RFKILL);
-		report_cnt++;
+		clevo_xsm_hotkey_stats.presses++;
+		clevo_xsm_hotkey_press_ns = ktime_get_ns();
+
+		CLEVO_XSM_DEBUG("Led status: %d",
+			airplane_led_get(&airplane_led));
+
+		airplane_led_set(&airplane_led,
+			(airplane_led_get(&airplane_led) ? 0 : 1));
 
 		mutex_unlock(&clevo_xsm_input_report_mutex);
-		break;
-	default:
-		if (!kb_backlight.ops)
-			break;
 
-		switch (event) {
-		case 0x81:
-			kb_dec_brightness();
-			clevo_xsm_input_report_key(KEY_KBDILLUMDOWN);
-			break;
-		case 0x82:
-			kb_inc_brightness();
-			clevo_xsm_input_report_key(KEY_KBDILLUMUP);
-			break;
-		case 0x83:
-			if (!param_kb_cycle_colors)
-				kb_next_mode();
-			else
-				kb_next_color();
-			break;
-		case 0x9F:
-			kb_toggle_state();
-			clevo_xsm_input_report_key(KEY_KBDILLUMTOGGLE);
-			break;
-		}
-		break;
+		clevo_xsm_hotkey_poll_ms = min_ms;
+	} else {
+		clevo_xsm_hotkey_poll_ms = clamp(clevo_xsm_hotkey_poll_ms * 2,
+			min_ms, (unsigned int) HOTKEY_POLL_MAX_MS);
 	}
+
+	if (!READ_ONCE(clevo_xsm_hotkey_has_event))
+		queue_delayed_work(system_power_efficient_wq,
+			&clevo_xsm_hotkey_poll_work,
+			msecs_to_jiffies(clevo_xsm_hotkey_poll_ms));
 }
 
-static int clevo_xsm_wmi_probe(struct platform_device *dev)
+static void clevo_xsm_hotkey_poll_start(void)
 {
-	int status;
+	mutex_lock(&clevo_xsm_hotkey_lock);
 
-	status = wmi_install_notify_handler(CLEVO_EVENT_GUID,
-		clevo_xsm_wmi_notify, NULL);
-	if (unlikely(ACPI_FAILURE(status))) {
-		CLEVO_XSM_ERROR("Could not register WMI notify handler (%0#6x)\n",
-			status);
-		return -EIO;
+	if (READ_ONCE(clevo_xsm_hotkey_has_event) || clevo_xsm_hotkey_polling) {
+		mutex_unlock(&clevo_xsm_hotkey_lock);
+		return;
 	}
 
-	clevo_xsm_wmi_evaluate_wmbb_method(GET_AP, 0, NULL);
+	CLEVO_XSM_INFO("Polling airplane hotkey, starting at %i Hz\n",
+		param_poll_freq);
 
-	if (kb_backlight.ops)
-		kb_backlight.ops->init();
+	clevo_xsm_hotkey_polling = true;
+	clevo_xsm_hotkey_poll_ms = 1000 / param_poll_freq;
+	clevo_xsm_hotkey_stats.poll_start_ns = ktime_get_ns();
+	queue_delayed_work(system_power_efficient_wq,
+		&clevo_xsm_hotkey_poll_work, 0);
 
-	return 0;
+	mutex_unlock(&clevo_xsm_hotkey_lock);
 }
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 11, 0)
-static void clevo_xsm_wmi_remove(struct platform_device *dev)
-{
-	wmi_remove_notify_handler(CLEVO_EVENT_GUID);
-}
-#else
-static int clevo_xsm_wmi_remove(struct platform_device *dev)
+static void clevo_xsm_hotkey_poll_stop(void)
 {
-	wmi_remove_notify_handler(CLEVO_EVENT_GUID);
-	return 0;
+	mutex_lock(&clevo_xsm_hotkey_lock);
+
+	if (clevo_xsm_hotkey_polling) {
+		cancel_delayed_work_sync(&clevo_xsm_hotkey_poll_work);
+
+		clevo_xsm_hotkey_polling = false;
+		clevo_xsm_hotkey_stats.poll_ns += ktime_get_ns() -
+			clevo_xsm_hotkey_stats.poll_start_ns;
+	}
+
+	mutex_unlock(&clevo_xsm_hotkey_lock);
 }
-#endif
 
-static int clevo_xsm_wmi_resume(struct platform_device *dev)
+/*
+ * The EC sets 0xDB bit 6 for the key press that raises the event as well.
+ * Whoever clears the bit owns the press: the event path takes it here so
+ * the poller can never see it, and when the poller got there first during
+ * the last poll period the event is not reported a second time.
+ */
+static void clevo_xsm_hotkey_event(void)
 {
-	clevo_xsm_wmi_evaluate_wmbb_method(GET_AP, 0, NULL);
+	u64 now = ktime_get_ns();
+	bool polled = false;
+	u8 byte;
 
-	if (kb_backlight.ops && kb_backlight.state == KB_STATE_ON)
-		kb_backlight.ops->set_mode(kb_backlight.mode);
+	clevo_xsm_hotkey_stats.events++;
 
-	return 0;
-}
+	if (!READ_ONCE(clevo_xsm_hotkey_has_event)) {
+		CLEVO_XSM_INFO("Airplane hotkey event seen, stopping polling\n");
+		WRITE_ONCE(clevo_xsm_hotkey_has_event, true);
+		clevo_xsm_hotkey_poll_stop();
+	}
 
-static struct platform_driver clevo_xsm_platform_driver = {
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 11, 0)
-	.remove = clevo_xsm_wmi_remove,
-#else
-	.remove = clevo_xsm_wmi_remove,
-#endif
-	.resume = clevo_xsm_wmi_resume,
-	.driver = {
-		.name  = CLEVO_XSM_DRIVER_NAME,
-		.owner = THIS_MODULE,
-	},
-};
+	mutex_lock(&clevo_xsm_input_report_mutex);
 
+	if (!clevo_xsm_ec_read(0xDB, &byte) && (byte & 0x40))
+		clevo_xsm_ec_write(0xDB, byte & ~0x40);
+	else if (clevo_xsm_hotkey_press_ns &&
+	    now - clevo_xsm_hotkey_press_ns < HOTKEY_POLL_MAX_MS * NSEC_PER_MSEC)
+		polled = true;
 
-/* RFKILL sub-driver */
+	clevo_xsm_hotkey_press_ns = 0;
 
-static bool param_rfkill;
-module_param_named(rfkill, param_rfkill, bool, 0);
-MODULE_PARM_DESC(rfkill, "Enable WWAN-RFKILL capability.");
+	if (!polled) {
+		clevo_xsm_input_report_key(KEY_RFKILL);
+		clevo_xsm_hotkey_stats.presses++;
+	}
 
-static struct rfkill *clevo_xsm_wwan_rfkill_device;
+	mutex_unlock(&clevo_xsm_input_report_mutex);
+}
 
-static int clevo_xsm_wwan_rfkill_set_block(void *data, bool blocked)
+static int clevo_xsm_input_open(struct input_dev *dev)
 {
-	CLEVO_XSM_DEBUG("blocked=%i\n", blocked);
+	clevo_xsm_hotkey_poll_start();
 
-	if (clevo_xsm_wmi_evaluate_wmbb_method(SET_3G, !blocked, NULL))
-		CLEVO_XSM_ERROR("Setting 3G power state failed!\n");
 	return 0;
 }
 
-static const struct rfkill_ops clevo_xsm_wwan_rfkill_ops = {
-	.set_block = clevo_xsm_wwan_rfkill_set_block,
-};
+static void clevo_xsm_input_close(struct input_dev *dev)
+{
+	clevo_xsm_hotkey_poll_stop();
+}
 
-static int __init clevo_xsm_rfkill_init(void)
+static int __init clevo_xsm_input_init(void)
 {
 	int err;
-	u32 unblocked = 0;
-
-	if (!param_rfkill)
-		return 0;
-
-	clevo_xsm_wmi_evaluate_wmbb_method(TALK_BIOS_3G, 1, NULL);
+	u8 byte;
 
-	clevo_xsm_wwan_rfkill_device = rfkill_alloc("clevo_xsm-wwan",
-		&clevo_xsm_platform_device->dev,
-		RFKILL_TYPE_WWAN,
-		&clevo_xsm_wwan_rfkill_ops, NULL);
-	if (unlikely(!clevo_xsm_wwan_rfkill_device))
+	clevo_xsm_input_device = input_allocate_device();
+	if (unlikely(!clevo_xsm_input_device)) {
+		CLEVO_XSM_ERROR("Error allocating input device\n");
 		return -ENOMEM;
+	}
 
-	err = rfkill_register(clevo_xsm_wwan_rfkill_device);
-	if (unlikely(err))
-		goto err_destroy_wwan;
+	clevo_xsm_input_device->name = "Clevo Airplane-Mode Hotkey";
+	clevo_xsm_input_device->phys = CLEVO_XSM_DRIVER_NAME "/input0";
+	clevo_xsm_input_device->id.bustype = BUS_HOST;
+	clevo_xsm_input_device->dev.parent = &clevo_xsm_platform_device->dev;
 
-	if (clevo_xsm_wmi_evaluate_wmbb_method(GET_POWER_STATE_FOR_3G, 0,
-		&unblocked))
-		CLEVO_XSM_ERROR("Could not get 3G power state!\n");
-	else
-		rfkill_set_sw_state(clevo_xsm_wwan_rfkill_device, !unblocked);
+	INIT_DELAYED_WORK(&clevo_xsm_hotkey_poll_work, clevo_xsm_hotkey_poll);
+
+	clevo_xsm_input_device->open  = clevo_xsm_input_open;
+	clevo_xsm_input_device->close = clevo_xsm_input_close;
+
+	set_bit(EV_KEY, clevo_xsm_input_device->evbit);
+	set_bit(KEY_RFKILL, clevo_xsm_input_device->keybit);
+	set_bit(KEY_KBDILLUMTOGGLE, clevo_xsm_input_device->keybit);
+	set_bit(KEY_KBDILLUMUP, clevo_xsm_input_device->keybit);
+	set_bit(KEY_KBDILLUMDOWN, clevo_xsm_input_device->keybit);
+
+	clevo_xsm_ec_read(0xDB, &byte);
+	clevo_xsm_ec_write(0xDB, byte & ~0x40);
+
+	err = input_register_device(clevo_xsm_input_device);
+	if (unlikely(err)) {
+		CLEVO_XSM_ERROR("Error registering input device\n");
+		goto err_free_input_device;
+	}
 
 	return 0;
 
-err_destroy_wwan:
-	rfkill_destroy(clevo_xsm_wwan_rfkill_device);
-	clevo_xsm_wmi_evaluate_wmbb_method(TALK_BIOS_3G, 0, NULL);
-	return err;
+err_free_input_device:
+		input_free_device(clevo_xsm_input_device);
+
+		return err;
 }
 
-static void __exit clevo_xsm_rfkill_exit(void)
+static void __exit clevo_xsm_input_exit(void)
 {
-	if (!clevo_xsm_wwan_rfkill_device)
+	if (unlikely(!clevo_xsm_input_device))
 		return;
 
-	clevo_xsm_wmi_evaluate_wmbb_method(TALK_BIOS_3G, 0, NULL);
-
-	rfkill_unregister(clevo_xsm_wwan_rfkill_device);
-	rfkill_destroy(clevo_xsm_wwan_rfkill_device);
+	input_unregister_device(clevo_xsm_input_device);
+		clevo_xsm_input_device = NULL;
 }
 
 
-/* Sysfs interface */
+/* WMI method sub-driver */
 
-static ssize_t clevo_xsm_brightness_show(struct device *child,
-	struct device_attribute *attr, char *buf)
-{
-	return sprintf(buf, "%d\n", kb_backlight.brightness);
-}
+static struct wmi_device *clevo_xsm_wmi_device;
+static DEFINE_MUTEX(clevo_xsm_wmi_lock);
 
-static ssize_t clevo_xsm_brightness_store(struct device *child,
-	struct device_attribute *attr, const char *buf, size_t size)
+/*
+ * Result buffer shared by all WMBB calls (under clevo_xsm_wmi_lock). The
+ * methods we use return a single integer; anything that does not fit is
+ * reported by ACPI as AE_BUFFER_OVERFLOW and read back as 0, just like a
+ * non-integer result.
+ */
+static union acpi_object clevo_xsm_wmi_out[2];
+
+/* call with clevo_xsm_wmi_lock held */
+static int __clevo_xsm_wmi_evaluate_wmbb_method(u32 method_id, u32 arg,
+	u32 *retval)
 {
-	unsigned int val;
-	int ret;
+	struct acpi_buffer in  = { (acpi_size) sizeof(arg), &arg };
+	struct acpi_buffer out = { sizeof(clevo_xsm_wmi_out), clevo_xsm_wmi_out };
+	union acpi_object *obj = clevo_xsm_wmi_out;
+	struct clevo_xsm_stats *st = &clevo_xsm_stats;
+	acpi_status status;
+	u64 start, ns;
+	u32 tmp = 0;
 
-	if (!kb_backlight.ops)
-		return -EINVAL;
+	CLEVO_XSM_DEBUG("%0#4x  IN : %0#6x\n", method_id, arg);
 
-	ret = kstrtouint(buf, 0, &val);
-	if (ret)
-		return ret;
+	if (unlikely(!clevo_xsm_wmi_device))
+		return -ENODEV;
 
-	kb_backlight.ops->set_brightness(val);
+	trace_clevo_xsm_wmi_call_enter(method_id, arg);
+	start = ktime_get_ns();
 
-	return ret ? : size;
+	status = wmidev_evaluate_method(clevo_xsm_wmi_device, 0x00,
+		method_id, &in, &out);
+
+	ns = ktime_get_ns() - start;
+
+	if (status == AE_BUFFER_OVERFLOW)
+		status = AE_OK;
+	else if (ACPI_SUCCESS(status) && out.length >= sizeof(*obj) &&
+		obj->type == ACPI_TYPE_INTEGER)
+		tmp = (u32) obj->integer.value;
+
+	clevo_xsm_lat_account(&st->wmi, ns, ACPI_FAILURE(status));
+	if (method_id < CLEVO_XSM_METHOD_MAX)
+		st->wmi_method[method_id]++;
+	if (method_id == SET_KB_LED)
+		st->kb_cmd[clevo_xsm_kb_cmd_class(arg)]++;
+
+	trace_clevo_xsm_wmi_call_exit(method_id, arg, tmp,
+		ACPI_FAILURE(status) ? -EIO : 0, ns);
+
+	if (unlikely(ACPI_FAILURE(status)))
+		return -EIO;
+
+	CLEVO_XSM_DEBUG("%0#4x  OUT: %0#6x (IN: %0#6x)\n", method_id, tmp, arg);
+
+	if (likely(retval))
+		*retval = tmp;
+
+	return 0;
 }
 
-static DEVICE_ATTR(kb_brightness, 0644,
-	clevo_xsm_brightness_show, clevo_xsm_brightness_store);
 
-static ssize_t clevo_xsm_state_show(struct device *child,
-	struct device_attribute *attr, char *buf)
+/*
+ * SET_KB_LED shadow registers
+ *
+ * Last value written to each register the firmware keeps as plain state.
+ * Writes that would not change anything are dropped before they reach
+ * ACPI. Commands we do not know the side effects of invalidate the whole
+ * cache. So do resets (0x10/0x20) and hardware effects (0x33, 0x70-0xB0),
+ * which are actions rather than state: sending one again restarts it, so
+ * they are never dropped either.
+ */
+
+enum kb_shadow_reg {
+	KB_SHADOW_LEFT,         /* 0xF0 */
+	KB_SHADOW_CENTER,       /* 0xF1 */
+	KB_SHADOW_RIGHT,        /* 0xF2 */
+	KB_SHADOW_EXTRA,        /* 0xF3 */
+	KB_SHADOW_BRIGHTNESS,   /* 0xF4 */
+	KB_SHADOW_STATE,        /* 0xE0 */
+	KB_SHADOW_PROFILE,      /* 0xA3 */
+	KB_SHADOW_MAX,
+};
+
+/* protected by clevo_cmdq.lock */
+static struct {
+	u32 value[KB_SHADOW_MAX];
+	unsigned long valid;
+	unsigned long hits;
+	unsigned long misses;
+} kb_shadow;
+
+static int kb_shadow_reg(u32 cmd)
 {
-	return sprintf(buf, "%d\n", kb_backlight.state);
+	switch (cmd >> 24) {
+	case 0xF0 ... 0xF4:
+		return KB_SHADOW_LEFT + (cmd >> 24) - 0xF0;
+	case 0xE0:
+		return KB_SHADOW_STATE;
+	case 0xA3:
+		return KB_SHADOW_PROFILE;
+	default:
+		return -1;
+	}
 }
 
-static ssize_t clevo_xsm_state_store(struct device *child,
-	struct device_attribute *attr, const char *buf, size_t size)
-{
-	unsigned int val;
-	int ret;
+/*
+ * Command queue
+ *
+ * All EC and WMBB accesses go through one kfifo drained by a dedicated
+ * kthread worker, so the firmware only ever sees one caller at a time and
+ * commands run in the order they were queued. SET_KB_LED writes to shadow
+ * registers are posted: the caller returns as soon as the command is
+ * queued, and a later write to the same register that is already queued
+ * replaces it. Everything else, and anything that needs a result, waits
+ * for the worker.
+ */
 
-	if (!kb_backlight.ops)
-		return -EINVAL;
+#define CLEVO_CMDQ_SIZE  128
+#define CLEVO_CMDQ_BATCH 32
 
-	ret = kstrtouint(buf, 0, &val);
-	if (ret)
-		return ret;
+enum clevo_cmd_type {
+	CLEVO_CMD_NOP,
+	CLEVO_CMD_WMI,
+	CLEVO_CMD_EC_READ,
+	CLEVO_CMD_EC_WRITE,
+	CLEVO_CMD_FN,           /* fn() on the worker, for batches of accesses */
+};
 
-	val = clamp_t(unsigned, val, 0, 1);
-	kb_backlight.ops->set_state(val);
+struct clevo_cmd_wait {
+	struct completion done;
+	int ret;
+	u32 retval;
+};
 
-	return ret ? : size;
+struct clevo_cmd {
+	u8 type;
+	u8 addr;
+	u8 val;
+	u32 method;
+	u32 arg;
+	u64 queued_ns;
+	unsigned long caller;
+	void (*fn)(void);
+	struct clevo_cmd_wait *wait;    /* NULL for posted commands */
+};
+
+static struct {
+	spinlock_t lock;                /* producers and kb_shadow */
+	DECLARE_KFIFO(fifo, struct clevo_cmd, CLEVO_CMDQ_SIZE);
+	wait_queue_head_t space;
+	struct kthread_worker *worker;
+	struct kthread_work work;
+	struct clevo_cmd batch[CLEVO_CMDQ_BATCH];       /* worker only */
+
+	/* statistics, under lock */
+	u64 queued;
+	u64 posted;
+	u64 coalesced;
+	u64 stalls;
+	u64 depth_sum;
+	unsigned int max_depth;
+	struct clevo_xsm_lat_stats wait;        /* queued to started */
+} clevo_cmdq;
+
+static void clevo_xsm_kb_shadow_invalidate(void)
+{
+	spin_lock(&clevo_cmdq.lock);
+	kb_shadow.valid = 0;
+	spin_unlock(&clevo_cmdq.lock);
 }
 
-static DEVICE_ATTR(kb_state, 0644,
-	clevo_xsm_state_show, clevo_xsm_state_store);
+/* Last command written to a register, false if not known */
+static bool clevo_xsm_kb_shadow_get(enum kb_shadow_reg reg, u32 *cmd)
+{
+	bool valid;
 
-static ssize_t clevo_xsm_mode_show(struct device *child,
-	struct device_attribute *attr, char *buf)
+	spin_lock(&clevo_cmdq.lock);
+	valid = test_bit(reg, &kb_shadow.valid);
+	if (valid)
+		*cmd = kb_shadow.value[reg];
+	spin_unlock(&clevo_cmdq.lock);
+
+	return valid;
+}
+
+static bool clevo_cmd_is_led(const struct clevo_cmd *c)
 {
-	return sprintf(buf, "%d\n", kb_backlight.mode);
+	return c->type == CLEVO_CMD_WMI && c->method == SET_KB_LED;
 }
 
-static ssize_t clevo_xsm_mode_store(struct device *child,
-	struct device_attribute *attr, const char *buf, size_t size)
+/*
+ * Latest wins: walking the batch backwards, a posted write to a shadow
+ * register that is written again later is dropped. Anything somebody
+ * waits for, and any mode change or unknown LED command, is a barrier.
+ */
+static void clevo_cmdq_coalesce(struct clevo_cmd *batch, unsigned int n)
 {
-	static enum kb_mode modes[] = {
-		KB_MODE_RANDOM_COLOR,
-		KB_MODE_CUSTOM,
-		KB_MODE_BREATHE,
-		KB_MODE_CYCLE,
-		KB_MODE_WAVE,
-		KB_MODE_DANCE,
-		KB_MODE_TEMPO,
-		KB_MODE_FLASH,
-	};
+	unsigned long seen = 0;
+	unsigned int dropped = 0;
+	int i, reg;
 
-	unsigned int val;
-	int ret;
+	for (i = n - 1; i >= 0; i--) {
+		struct clevo_cmd *c = &batch[i];
 
-	if (!kb_backlight.ops)
-		return -EINVAL;
+		if (c->wait || !clevo_cmd_is_led(c)) {
+			if (c->wait)
+				seen = 0;
+			continue;
+		}
 
-	ret = kstrtouint(buf, 0, &val);
-	if (ret)
-		return ret;
+		reg = kb_shadow_reg(c->arg);
+		if (reg < 0) {
+			seen = 0;
+			continue;
+		}
 
-	val = clamp_t(unsigned, val, 0, 7);
-	kb_backlight.ops->set_mode(modes[val]);
+		if (__test_and_set_bit(reg, &seen)) {
+			c->type = CLEVO_CMD_NOP;
+			dropped++;
+		}
+	}
 
-	return ret ? : size;
+	if (dropped) {
+		spin_lock(&clevo_cmdq.lock);
+		clevo_cmdq.coalesced += dropped;
+		spin_unlock(&clevo_cmdq.lock);
+	}
 }
 
-static DEVICE_ATTR(kb_mode, 0644,
-	clevo_xsm_mode_show, clevo_xsm_mode_store);
-
-static ssize_t clevo_xsm_color_show(struct device *child,
-	struct device_attribute *attr, char *buf)
+static int clevo_cmdq_run(struct clevo_cmd *c, u32 *retval)
 {
-	if (kb_backlight.extra == KB_HAS_EXTRA_TRUE)
-		return sprintf(buf, "%s %s %s %s\n",
-			kb_colors[kb_backlight.color.left].name,
-			kb_colors[kb_backlight.color.center].name,
-			kb_colors[kb_backlight.color.right].name,
-			kb_colors[kb_backlight.color.extra].name);
-	else
-		return sprintf(buf, "%s %s %s\n",
-			kb_colors[kb_backlight.color.left].name,
-			kb_colors[kb_backlight.color.center].name,
-			kb_colors[kb_backlight.color.right].name);
+	int ret;
+
+	switch (c->type) {
+	case CLEVO_CMD_WMI:
+		mutex_lock(&clevo_xsm_wmi_lock);
+		ret = __clevo_xsm_wmi_evaluate_wmbb_method(c->method, c->arg,
+			retval);
+		mutex_unlock(&clevo_xsm_wmi_lock);
+		return ret;
+	case CLEVO_CMD_EC_READ:
+		ret = __clevo_xsm_ec_read(c->addr, &c->val, c->caller);
+		*retval = c->val;
+		return ret;
+	case CLEVO_CMD_EC_WRITE:
+		return __clevo_xsm_ec_write(c->addr, c->val, c->caller);
+	case CLEVO_CMD_FN:
+		c->fn();
+		return 0;
+	default:
+		return 0;
+	}
 }
 
-static ssize_t clevo_xsm_color_store(struct device *child,
-	struct device_attribute *attr, const char *buf, size_t size)
+static void clevo_cmdq_work_fn(struct kthread_work *work)
 {
-	unsigned int i, j;
-	unsigned int val[4] = {0};
-	char left[8];
-	char right[8];
-	char center[8];
-	char extra[8];
+	struct clevo_cmd *batch = clevo_cmdq.batch;
+	unsigned int n, i;
+	u32 retval;
+	int ret, reg;
 
-	if (!kb_backlight.ops)
-		return -EINVAL;
+	while ((n = kfifo_out(&clevo_cmdq.fifo, batch, CLEVO_CMDQ_BATCH))) {
+		u64 now = ktime_get_ns();
 
-	i = sscanf(buf, "%7s %7s %7s %7s", left, center, right, extra);
+		wake_up(&clevo_cmdq.space);
 
-	if (i == 1) {
-		for (j = 0; j < ARRAY_SIZE(kb_colors); j++) {
-			if (!strcmp(left, kb_colors[j].name))
-				val[0] = j;
-		}
-		val[0] = clamp_t(unsigned, val[0], 0, ARRAY_SIZE(kb_colors));
-		val[3] = val[2] = val[1] = val[0];
+		clevo_cmdq_coalesce(batch, n);
 
-	} else if (i == 3 || i == 4) {
-		for (j = 0; j < ARRAY_SIZE(kb_colors); j++) {
-			if (!strcmp(left, kb_colors[j].name))
-				val[0] = j;
-			if (!strcmp(center, kb_colors[j].name))
-				val[1] = j;
-			if (!strcmp(right, kb_colors[j].name))
-				val[2] = j;
-			if (!strcmp(extra, kb_colors[j].name))
-				val[3] = j;
+		spin_lock(&clevo_cmdq.lock);
+		for (i = 0; i < n; i++)
+			clevo_xsm_lat_account(&clevo_cmdq.wait,
+				now - batch[i].queued_ns, 0);
+		spin_unlock(&clevo_cmdq.lock);
+
+		for (i = 0; i < n; i++) {
+			struct clevo_cmd *c = &batch[i];
+
+			retval = 0;
+			ret = clevo_cmdq_run(c, &retval);
+
+			/* A posted write that failed leaves the register unknown */
+			if (ret && !c->wait && clevo_cmd_is_led(c)) {
+				reg = kb_shadow_reg(c->arg);
+				spin_lock(&clevo_cmdq.lock);
+				if (reg >= 0 && kb_shadow.value[reg] == c->arg)
+					__clear_bit(reg, &kb_shadow.valid);
+				spin_unlock(&clevo_cmdq.lock);
+			}
+
+			if (c->wait) {
+				c->wait->ret = ret;
+				c->wait->retval = retval;
+				complete(&c->wait->done);
+			}
 		}
-		val[0] = clamp_t(unsigned, val[0], 0, ARRAY_SIZE(kb_colors));
-		val[1] = clamp_t(unsigned, val[1], 0, ARRAY_SIZE(kb_colors));
-		val[2] = clamp_t(unsigned, val[2], 0, ARRAY_SIZE(kb_colors));
-		val[3] = clamp_t(unsigned, val[3], 0, ARRAY_SIZE(kb_colors));
+	}
+}
 
-	} else
-		return -EINVAL;
+/*
+ * Call with clevo_cmdq.lock held, drops it while waiting for space. The
+ * wait only lasts until the worker pulls the next batch: the worker takes
+ * no lock besides clevo_xsm_wmi_lock and the ACPI EC's own, so callers
+ * may sit here holding kb_fx_lock or kb_backlight_lock, but never from
+ * atomic context.
+ */
+static int clevo_cmdq_put_locked(struct clevo_cmd *c)
+{
+	unsigned int depth;
 
-	kb_backlight.ops->set_color(val[0], val[1], val[2], val[3]);
+	while (kfifo_is_full(&clevo_cmdq.fifo) && clevo_cmdq.worker) {
+		clevo_cmdq.stalls++;
+		spin_unlock(&clevo_cmdq.lock);
+		wait_event(clevo_cmdq.space, !kfifo_is_full(&clevo_cmdq.fifo));
+		spin_lock(&clevo_cmdq.lock);
+	}
 
-	return size;
+	if (unlikely(!clevo_cmdq.worker))
+		return -ENODEV;
+
+	c->queued_ns = ktime_get_ns();
+	kfifo_put(&clevo_cmdq.fifo, *c);
+
+	depth = kfifo_len(&clevo_cmdq.fifo);
+	clevo_cmdq.queued++;
+	clevo_cmdq.depth_sum += depth;
+	if (depth > clevo_cmdq.max_depth)
+		clevo_cmdq.max_depth = depth;
+
+	return 0;
 }
-static DEVICE_ATTR(kb_color, 0644,
-	clevo_xsm_color_show, clevo_xsm_color_store);
 
-/* Wave effect sysfs control */
-static ssize_t clevo_xsm_wave_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
+static int clevo_cmdq_call(struct clevo_cmd *c, u32 *retval)
 {
-	return sprintf(buf, "%d\n", wave_running ? 1 : 0);
+	struct kthread_worker *worker;
+	struct clevo_cmd_wait wait;
+	int ret;
+
+	init_completion(&wait.done);
+	c->wait = &wait;
+
+	spin_lock(&clevo_cmdq.lock);
+	ret = clevo_cmdq_put_locked(c);
+	worker = clevo_cmdq.worker;
+	spin_unlock(&clevo_cmdq.lock);
+	if (ret)
+		return ret;
+
+	kthread_queue_work(worker, &clevo_cmdq.work);
+	wait_for_completion(&wait.done);
+
+	if (!wait.ret && retval)
+		*retval = wait.retval;
+
+	return wait.ret;
 }
 
-static ssize_t clevo_xsm_wave_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
+static int clevo_xsm_wmi_evaluate_wmbb_method(u32 method_id, u32 arg,
+	u32 *retval)
 {
-	unsigned int val;
-	
-	if (kstrtouint(buf, 10, &val))
-		return -EINVAL;
-	
-	if (val)
-		wave_start();
-	else
-		wave_stop();
-	
-	return size;
+	struct clevo_cmd c = {
+		.type = CLEVO_CMD_WMI,
+		.method = method_id,
+		.arg = arg,
+	};
+
+	return clevo_cmdq_call(&c, retval);
 }
-static DEVICE_ATTR(kb_wave, 0644,
-	clevo_xsm_wave_show, clevo_xsm_wave_store);
 
-static ssize_t clevo_xsm_wave_period_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
+/* noinline so the tracepoint can report the real call site */
+static noinline int clevo_xsm_ec_read(u8 addr, u8 *val)
 {
-	return sprintf(buf, "%d\n", wave_interval_ms * NUM_WAVE_STEPS);
+	struct clevo_cmd c = {
+		.type = CLEVO_CMD_EC_READ,
+		.addr = addr,
+		.caller = _RET_IP_,
+	};
+	u32 tmp;
+	int ret;
+
+	ret = clevo_cmdq_call(&c, &tmp);
+	if (!ret)
+		*val = tmp;
+
+	return ret;
 }
 
-static ssize_t clevo_xsm_wave_period_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
+static noinline int clevo_xsm_ec_write(u8 addr, u8 val)
+{
+	struct clevo_cmd c = {
+		.type = CLEVO_CMD_EC_WRITE,
+		.addr = addr,
+		.val = val,
+		.caller = _RET_IP_,
+	};
+
+	return clevo_cmdq_call(&c, NULL);
+}
+
+/* Waits until everything queued so far has been run */
+static int clevo_cmdq_sync(void)
+{
+	struct clevo_cmd c = { .type = CLEVO_CMD_NOP };
+
+	return clevo_cmdq_call(&c, NULL);
+}
+
+/*
+ * Posted: returns once the command is queued, which may sleep while the
+ * queue is full. A write that later fails only clears the register from
+ * the shadow, so the next write of the same value goes out again.
+ */
+static int clevo_xsm_kb_led_write(u32 cmd)
+{
+	struct clevo_cmd c = {
+		.type = CLEVO_CMD_WMI,
+		.method = SET_KB_LED,
+		.arg = cmd,
+	};
+	struct kthread_worker *worker;
+	int reg = kb_shadow_reg(cmd);
+	int ret;
+
+	might_sleep();
+
+	spin_lock(&clevo_cmdq.lock);
+
+	if (reg >= 0 && test_bit(reg, &kb_shadow.valid) &&
+		kb_shadow.value[reg] == cmd) {
+		kb_shadow.hits++;
+		spin_unlock(&clevo_cmdq.lock);
+		return 0;
+	}
+
+	ret = clevo_cmdq_put_locked(&c);
+	if (ret) {
+		spin_unlock(&clevo_cmdq.lock);
+		return ret;
+	}
+
+	kb_shadow.misses++;
+	clevo_cmdq.posted++;
+
+	if (reg < 0) {
+		kb_shadow.valid = 0;
+	} else {
+		kb_shadow.value[reg] = cmd;
+		__set_bit(reg, &kb_shadow.valid);
+	}
+
+	worker = clevo_cmdq.worker;
+	spin_unlock(&clevo_cmdq.lock);
+
+	kthread_queue_work(worker, &clevo_cmdq.work);
+
+	return 0;
+}
+
+/*
+ * Posted: fn runs on the worker in queue order and may use the __ EC
+ * accessors directly, so a batch of reads costs one queued command. Like
+ * clevo_xsm_kb_led_write() this may sleep while the queue is full, and fn
+ * must not take any lock a poster can hold.
+ */
+static int clevo_cmdq_post_fn(void (*fn)(void))
+{
+	struct clevo_cmd c = {
+		.type = CLEVO_CMD_FN,
+		.fn = fn,
+	};
+	struct kthread_worker *worker;
+	int ret;
+
+	might_sleep();
+
+	spin_lock(&clevo_cmdq.lock);
+	ret = clevo_cmdq_put_locked(&c);
+	if (!ret)
+		clevo_cmdq.posted++;
+	worker = clevo_cmdq.worker;
+	spin_unlock(&clevo_cmdq.lock);
+	if (ret)
+		return ret;
+
+	kthread_queue_work(worker, &clevo_cmdq.work);
+
+	return 0;
+}
+
+static int __init clevo_cmdq_init(void)
+{
+	spin_lock_init(&clevo_cmdq.lock);
+	INIT_KFIFO(clevo_cmdq.fifo);
+	init_waitqueue_head(&clevo_cmdq.space);
+	kthread_init_work(&clevo_cmdq.work, clevo_cmdq_work_fn);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+	clevo_cmdq.worker = kthread_run_worker(0, "clevo_cmdq");
+#else
+	clevo_cmdq.worker = kthread_create_worker(0, "clevo_cmdq");
+#endif
+	if (IS_ERR(clevo_cmdq.worker)) {
+		int err = PTR_ERR(clevo_cmdq.worker);
+
+		clevo_cmdq.worker = NULL;
+		return err;
+	}
+
+	return 0;
+}
+
+/* Runs whatever is still queued before the worker goes away */
+static void clevo_cmdq_exit(void)
+{
+	struct kthread_worker *worker = clevo_cmdq.worker;
+
+	if (!worker)
+		return;
+
+	spin_lock(&clevo_cmdq.lock);
+	clevo_cmdq.worker = NULL;
+	spin_unlock(&clevo_cmdq.lock);
+
+	kthread_destroy_worker(worker);
+}
+
+static int clevo_xsm_wmi_method_probe(struct wmi_device *wdev,
+	const void *context)
+{
+	mutex_lock(&clevo_xsm_wmi_lock);
+	clevo_xsm_wmi_device = wdev;
+	mutex_unlock(&clevo_xsm_wmi_lock);
+
+	return 0;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 13, 0)
+static void clevo_xsm_wmi_method_remove(struct wmi_device *wdev)
+{
+	mutex_lock(&clevo_xsm_wmi_lock);
+	clevo_xsm_wmi_device = NULL;
+	mutex_unlock(&clevo_xsm_wmi_lock);
+}
+#else
+static int clevo_xsm_wmi_method_remove(struct wmi_device *wdev)
+{
+	mutex_lock(&clevo_xsm_wmi_lock);
+	clevo_xsm_wmi_device = NULL;
+	mutex_unlock(&clevo_xsm_wmi_lock);
+	return 0;
+}
+#endif
+
+static const struct wmi_device_id clevo_xsm_wmi_method_id_table[] = {
+	{ .guid_string = CLEVO_GET_GUID },
+	{ }
+};
+
+static struct wmi_driver clevo_xsm_wmi_method_driver = {
+	.driver = {
+		.name = CLEVO_XSM_DRIVER_NAME,
+	},
+	.id_table = clevo_xsm_wmi_method_id_table,
+	.probe    = clevo_xsm_wmi_method_probe,
+	.remove   = clevo_xsm_wmi_method_remove,
+};
+
+static int __init clevo_xsm_wmi_method_init(void)
+{
+	int err;
+
+	err = wmi_driver_register(&clevo_xsm_wmi_method_driver);
+	if (unlikely(err))
+		return err;
+
+	/* WMI bus probing is synchronous, so the device is bound by now */
+	if (!clevo_xsm_wmi_device) {
+		CLEVO_XSM_INFO("WMI control method device is claimed by another driver\n");
+		wmi_driver_unregister(&clevo_xsm_wmi_method_driver);
+		return -ENODEV;
+	}
+
+	return 0;
+}
+
+static void clevo_xsm_wmi_method_exit(void)
+{
+	wmi_driver_unregister(&clevo_xsm_wmi_method_driver);
+}
+
+
+/*
+ * Serialises the ops and every read-modify-write of kb_backlight. Taken
+ * inside kb_fx_lock; the effect worker never takes it, so it may be held
+ * while the engine is stopped.
+ */
+static DEFINE_MUTEX(kb_backlight_lock);
+
+static struct {
+	enum kb_extra {
+		KB_HAS_EXTRA_TRUE,
+		KB_HAS_EXTRA_FALSE,
+	} extra;
+
+	enum kb_state {
+		KB_STATE_OFF,
+		KB_STATE_ON,
+	} state;
+
+	struct {
+		unsigned left;
+		unsigned center;
+		unsigned right;
+		unsigned extra;
+	} color;
+
+	/* Zones showing rgb[] (0xRRGGBB, as written) instead of their color */
+	u32 rgb[KB_FX_MAX_ZONES];
+	unsigned long rgb_zones;
+
+	unsigned brightness;
+	unsigned brightness_raw;
+	unsigned brightness_max;
+
+	enum kb_mode {
+		KB_MODE_RANDOM_COLOR,
+		KB_MODE_CUSTOM,
+		KB_MODE_BREATHE,
+		KB_MODE_CYCLE,
+		KB_MODE_WAVE,
+		KB_MODE_DANCE,
+		KB_MODE_TEMPO,
+		KB_MODE_FLASH,
+	} mode;
+
+	/* called with kb_backlight_lock held */
+	struct kb_backlight_ops {
+		void (*set_state)(enum kb_state state);
+		void (*set_color)(unsigned left, unsigned center,
+			unsigned right, unsigned extra);
+		void (*set_brightness)(unsigned brightness);
+		void (*set_brightness_raw)(u8 raw);  /* optional */
+		void (*set_zone_rgb)(unsigned zone, u32 rgb);  /* optional */
+		void (*set_mode)(enum kb_mode);
+		void (*init)(void);
+	} *ops;
+
+} kb_backlight = { .ops = NULL, };
+
+
+/*
+ * call with kb_backlight_lock held. Sets the palette colors, then the
+ * zones in rgb_zones to their arbitrary rgb[] on top.
+ */
+static void kb_set_colors(const unsigned int *color, const u32 *rgb,
+	unsigned long rgb_zones)
+{
+	unsigned int zone;
+
+	kb_backlight.ops->set_color(color[0], color[1], color[2], color[3]);
+
+	if (!kb_backlight.ops->set_zone_rgb)
+		return;
+
+	for_each_set_bit(zone, &rgb_zones, KB_FX_MAX_ZONES)
+		kb_backlight.ops->set_zone_rgb(zone, rgb[zone]);
+}
+
+/* call with kb_backlight_lock held, puts the user's colors back */
+static void kb_restore_colors(void)
+{
+	unsigned int color[KB_FX_MAX_ZONES] = {
+		kb_backlight.color.left, kb_backlight.color.center,
+		kb_backlight.color.right, kb_backlight.color.extra,
+	};
+
+	kb_set_colors(color, kb_backlight.rgb, kb_backlight.rgb_zones);
+}
+
+/* call with kb_backlight_lock held. The 0xRRGGBB a zone shows */
+static u32 kb_zone_rgb(unsigned int zone)
+{
+	unsigned int color[KB_FX_MAX_ZONES] = {
+		kb_backlight.color.left, kb_backlight.color.center,
+		kb_backlight.color.right, kb_backlight.color.extra,
+	};
+
+	if (test_bit(zone, &kb_backlight.rgb_zones))
+		return kb_backlight.rgb[zone];
+
+	return color[zone] < ARRAY_SIZE(kb_colors) ?
+		kb_colors[color[zone]].value.rgb : 0;
+}
+
+/* call with kb_backlight_lock held */
+static void kb_toggle_state(void)
+{
+	/* Static vars to save last colors before turning off */
+	static unsigned int saved_color[KB_FX_MAX_ZONES] = {
+		[0 ... KB_FX_MAX_ZONES - 1] = 1,  /* default cyan */
+	};
+	static u32 saved_rgb[KB_FX_MAX_ZONES];
+	static unsigned long saved_rgb_zones;
+	
+	switch (kb_backlight.state) {
+	case KB_STATE_OFF:
+		/* Turn ON: restore saved colors */
+		kb_set_colors(saved_color, saved_rgb, saved_rgb_zones);
+		kb_backlight.ops->set_brightness(0); /* max brightness */
+		kb_backlight.state = KB_STATE_ON;
+		break;
+	case KB_STATE_ON:
+		/* Turn OFF: save current colors, set to black (index 0) */
+		saved_color[0] = kb_backlight.color.left;
+		saved_color[1] = kb_backlight.color.center;
+		saved_color[2] = kb_backlight.color.right;
+		saved_color[3] = kb_backlight.color.extra;
+		memcpy(saved_rgb, kb_backlight.rgb, sizeof(saved_rgb));
+		saved_rgb_zones = kb_backlight.rgb_zones;
+		kb_backlight.ops->set_color(0, 0, 0, 0); /* black = off */
+		kb_backlight.state = KB_STATE_OFF;
+		break;
+	default:
+		BUG();
+	}
+}
+
+/* call with kb_backlight_lock held */
+static void kb_next_mode(void)
+{
+	static enum kb_mode modes[] = {
+		KB_MODE_RANDOM_COLOR,
+		KB_MODE_DANCE,
+		KB_MODE_TEMPO,
+		KB_MODE_FLASH,
+		KB_MODE_WAVE,
+		KB_MODE_BREATHE,
+		KB_MODE_CYCLE,
+		KB_MODE_CUSTOM,
+	};
+
+	size_t i;
+
+	if (kb_backlight.state == KB_STATE_OFF)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(modes); i++) {
+		if (modes[i] == kb_backlight.mode)
+			break;
+	}
+
+	BUG_ON(i == ARRAY_SIZE(modes));
+
+	kb_backlight.ops->set_mode(modes[(i + 1) % ARRAY_SIZE(modes)]);
+}
+
+/* call with kb_backlight_lock held */
+static void kb_next_color(void)
+{
+	size_t i;
+	unsigned int nc;
+
+	if (kb_backlight.state == KB_STATE_OFF)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(kb_colors); i++) {
+		if (i == kb_backlight.color.left)
+			break;
+	}
+
+	if (i + 1 > ARRAY_SIZE(kb_colors))
+		nc = 0;
+	else
+		nc = i + 1;
+
+	kb_backlight.ops->set_color(nc, nc, nc, nc);
+}
+
+/* full color backlight keyboard */
+
+static void kb_full_color__set_color(unsigned left, unsigned center,
+	unsigned right, unsigned extra)
+{
+	u32 cmd;
+
+	cmd = 0xF0000000;
+	cmd |= kb_colors[left].value.b << 16;
+	cmd |= kb_colors[left].value.r <<  8;
+	cmd |= kb_colors[left].value.g <<  0;
+
+	if (!clevo_xsm_kb_led_write(cmd)) {
+		kb_backlight.color.left = left;
+		__clear_bit(0, &kb_backlight.rgb_zones);
+	}
+
+	cmd = 0xF1000000;
+	cmd |= kb_colors[center].value.b << 16;
+	cmd |= kb_colors[center].value.r <<  8;
+	cmd |= kb_colors[center].value.g <<  0;
+
+	if (!clevo_xsm_kb_led_write(cmd)) {
+		kb_backlight.color.center = center;
+		__clear_bit(1, &kb_backlight.rgb_zones);
+	}
+
+	cmd = 0xF2000000;
+	cmd |= kb_colors[right].value.b << 16;
+	cmd |= kb_colors[right].value.r <<  8;
+	cmd |= kb_colors[right].value.g <<  0;
+
+	if (!clevo_xsm_kb_led_write(cmd)) {
+		kb_backlight.color.right = right;
+		__clear_bit(2, &kb_backlight.rgb_zones);
+	}
+
+	if (kb_backlight.extra == KB_HAS_EXTRA_TRUE) {
+		cmd = 0xF3000000;
+		cmd |= kb_colors[extra].value.b << 16;
+		cmd |= kb_colors[extra].value.r << 8;
+		cmd |= kb_colors[extra].value.g << 0;
+
+		if (!clevo_xsm_kb_led_write(cmd)) {
+			kb_backlight.color.extra = extra;
+			__clear_bit(3, &kb_backlight.rgb_zones);
+		}
+	}
+
+	kb_backlight.mode = KB_MODE_CUSTOM;
+}
+
+static void kb_full_color__set_brightness(unsigned i)
+{
+	/* Firmware-native 10 brightness levels (0-9)
+	 * From DSDT: raw = 0xFF - (level * 0x19)
+	 * Level 0 = 0xFF (max), Level 9 = 0x0E (min)
+	 */
+	u8 raw_brightness;
+	
+	i = clamp_t(unsigned, i, 0, 9);
+	raw_brightness = 0xFF - (i * 0x19);  /* Match EC firmware formula */
+
+	if (!clevo_xsm_kb_led_write(
+		0xF4000000 | raw_brightness)) {
+		kb_backlight.brightness = i;
+		kb_backlight.brightness_raw = raw_brightness;
+	}
+}
+
+static void kb_full_color__set_brightness_raw(u8 raw)
+{
+	if (!clevo_xsm_kb_led_write(0xF4000000 | raw)) {
+		kb_backlight.brightness_raw = raw;
+		/* Nearest firmware level for the kb_brightness view */
+		kb_backlight.brightness = min(DIV_ROUND_CLOSEST(0xFF - raw, 0x19), 9);
+	}
+}
+
+/* rgb is 0xRRGGBB, for colors outside the kb_colors palette */
+static void kb_full_color__set_zone_rgb(unsigned zone, u32 rgb)
+{
+	u32 cmd = 0xF0000000 + (zone << 24);
+
+	cmd |= (rgb & 0xFF) << 16;
+	cmd |= ((rgb >> 16) & 0xFF) << 8;
+	cmd |= (rgb >> 8) & 0xFF;
+
+	if (!clevo_xsm_kb_led_write(cmd)) {
+		kb_backlight.rgb[zone] = rgb;
+		__set_bit(zone, &kb_backlight.rgb_zones);
+		kb_backlight.mode = KB_MODE_CUSTOM;
+	}
+}
+
+static void kb_full_color__set_mode(unsigned mode)
+{
+	static u32 cmds[] = {
+		[KB_MODE_BREATHE]      = 0x1002a000,
+		[KB_MODE_CUSTOM]       = 0,
+		[KB_MODE_CYCLE]        = 0x33010000,
+		[KB_MODE_DANCE]        = 0x80000000,
+		[KB_MODE_FLASH]        = 0xA0000000,
+		[KB_MODE_RANDOM_COLOR] = 0x70000000,
+		[KB_MODE_TEMPO]        = 0x90000000,
+		[KB_MODE_WAVE]         = 0xB0000000,
+	};
+
+	BUG_ON(mode >= ARRAY_SIZE(cmds));
+
+	clevo_xsm_kb_led_write(0x10000000);
+
+	if (mode == KB_MODE_CUSTOM) {
+		kb_restore_colors();
+		kb_full_color__set_brightness(kb_backlight.brightness);
+		return;
+	}
+
+	if (!clevo_xsm_kb_led_write(cmds[mode]))
+		kb_backlight.mode = mode;
+}
+
+static void kb_full_color__set_state(enum kb_state state)
+{
+	u32 cmd = 0xE0000000;
+
+	CLEVO_XSM_DEBUG("State: %d\n", state);
+
+	switch (state) {
+	case KB_STATE_OFF:
+		cmd |= 0x003001;
+		break;
+	case KB_STATE_ON:
+		cmd |= 0x07F001;
+		break;
+	default:
+		BUG();
+	}
+
+	if (!clevo_xsm_kb_led_write(cmd))
+		kb_backlight.state = state;
+}
+
+static void kb_full_color__init(void)
+{
+	CLEVO_XSM_DEBUG();
+
+	kb_backlight.extra = KB_HAS_EXTRA_FALSE;
+	kb_backlight.brightness_max = 9;
+
+	kb_full_color__set_state(param_kb_off ? KB_STATE_OFF : KB_STATE_ON);
+	kb_full_color__set_color(param_kb_color[0], param_kb_color[1],
+		param_kb_color[2], param_kb_color[3]);
+	kb_full_color__set_brightness(param_kb_brightness);
+}
+
+static struct kb_backlight_ops kb_full_color_ops = {
+	.set_state      = kb_full_color__set_state,
+	.set_color      = kb_full_color__set_color,
+	.set_brightness = kb_full_color__set_brightness,
+	.set_brightness_raw = kb_full_color__set_brightness_raw,
+	.set_zone_rgb   = kb_full_color__set_zone_rgb,
+	.set_mode       = kb_full_color__set_mode,
+	.init           = kb_full_color__init,
+};
+
+static void kb_full_color__init_extra(void)
+{
+	CLEVO_XSM_DEBUG();
+
+	kb_backlight.extra = KB_HAS_EXTRA_TRUE;
+	kb_backlight.brightness_max = 9;
+
+	kb_full_color__set_state(param_kb_off ? KB_STATE_OFF : KB_STATE_ON);
+	kb_full_color__set_color(param_kb_color[0], param_kb_color[1],
+		param_kb_color[2], param_kb_color[3]);
+	kb_full_color__set_brightness(param_kb_brightness);
+}
+
+static struct kb_backlight_ops kb_full_color_with_extra_ops = {
+	.set_state      = kb_full_color__set_state,
+	.set_color      = kb_full_color__set_color,
+	.set_brightness = kb_full_color__set_brightness,
+	.set_brightness_raw = kb_full_color__set_brightness_raw,
+	.set_zone_rgb   = kb_full_color__set_zone_rgb,
+	.set_mode       = kb_full_color__set_mode,
+	.init           = kb_full_color__init_extra,
+};
+
+/* 8 color backlight keyboard */
+
+static void kb_8_color__set_color(unsigned left, unsigned center,
+	unsigned right, unsigned extra)
+{
+	u32 cmd = 0x02010000;
+
+	cmd |= kb_backlight.brightness << 12;
+	cmd |= right  << 8;
+	cmd |= center << 4;
+	cmd |= left;
+
+	if (!clevo_xsm_kb_led_write(cmd)) {
+		kb_backlight.color.left   = left;
+		kb_backlight.color.center = center;
+		kb_backlight.color.right  = right;
+	}
+
+	kb_backlight.mode = KB_MODE_CUSTOM;
+}
+
+static void kb_8_color__set_brightness(unsigned i)
+{
+	u32 cmd = 0xD2010000;
+
+	i = clamp_t(unsigned, i, 0, KB_BRIGHTNESS_MAX);
+
+	cmd |= i << 12;
+	cmd |= kb_backlight.color.right  << 8;
+	cmd |= kb_backlight.color.center << 4;
+	cmd |= kb_backlight.color.left;
+
+	if (!clevo_xsm_kb_led_write(cmd))
+		kb_backlight.brightness = i;
+}
+
+static void kb_8_color__set_mode(unsigned mode)
+{
+	static u32 cmds[] = {
+		[KB_MODE_BREATHE]      = 0x12010000,
+		[KB_MODE_CUSTOM]       = 0,
+		[KB_MODE_CYCLE]        = 0x32010000,
+		[KB_MODE_DANCE]        = 0x80000000,
+		[KB_MODE_FLASH]        = 0xA0000000,
+		[KB_MODE_RANDOM_COLOR] = 0x70000000,
+		[KB_MODE_TEMPO]        = 0x90000000,
+		[KB_MODE_WAVE]         = 0xB0000000,
+	};
+
+	BUG_ON(mode >= ARRAY_SIZE(cmds));
+
+	clevo_xsm_kb_led_write(0x20000000);
+
+	if (mode == KB_MODE_CUSTOM) {
+		kb_8_color__set_color(kb_backlight.color.left,
+			kb_backlight.color.center,
+			kb_backlight.color.right, kb_backlight.color.extra);
+		kb_8_color__set_brightness(kb_backlight.brightness);
+		return;
+	}
+
+	if (!clevo_xsm_kb_led_write(cmds[mode]))
+		kb_backlight.mode = mode;
+}
+
+static void kb_8_color__set_state(enum kb_state state)
+{
+	CLEVO_XSM_DEBUG("State: %d\n", state);
+
+	switch (state) {
+	case KB_STATE_OFF:
+		if (!clevo_xsm_kb_led_write(0x22010000))
+			kb_backlight.state = state;
+		break;
+	case KB_STATE_ON:
+		kb_8_color__set_mode(kb_backlight.mode);
+		kb_backlight.state = state;
+		break;
+	default:
+		BUG();
+	}
+}
+
+static void kb_8_color__init(void)
+{
+	CLEVO_XSM_DEBUG();
+
+	kb_8_color__set_state(KB_STATE_OFF);
+
+	kb_backlight.color.left   = param_kb_color[0];
+	kb_backlight.color.center = param_kb_color[1];
+	kb_backlight.color.right  = param_kb_color[2];
+
+	kb_backlight.brightness = param_kb_brightness;
+	kb_backlight.brightness_max = KB_BRIGHTNESS_MAX;
+	kb_backlight.mode       = KB_MODE_CUSTOM;
+	kb_backlight.extra      = KB_HAS_EXTRA_FALSE;
+
+	if (!param_kb_off) {
+		kb_8_color__set_color(kb_backlight.color.left,
+			kb_backlight.color.center,
+			kb_backlight.color.right, kb_backlight.color.extra);
+		kb_8_color__set_brightness(kb_backlight.brightness);
+		kb_8_color__set_state(KB_STATE_ON);
+	}
+}
+
+static struct kb_backlight_ops kb_8_color_ops = {
+	.set_state      = kb_8_color__set_state,
+	.set_color      = kb_8_color__set_color,
+	.set_brightness = kb_8_color__set_brightness,
+	.set_mode       = kb_8_color__set_mode,
+	.init           = kb_8_color__init,
+};
+
+/*
+ * Effect suspension
+ *
+ * An input handler watches keyboards, touchpads and the lid switch. After
+ * idle_timeout seconds without input the backlight fades out and the
+ * effect engine is held, so an idle machine makes no WMI calls at all.
+ * The next event wakes it through kb_idle.wake_work, as input handlers
+ * run in atomic context, and the effect's first frame runs right away.
+ * Each fade step is a run of kb_idle.work of its own, so kb_fx_lock is
+ * never held across the sleeps and a wake simply ends the fade.
+ * The engine is also held while the lid is closed and while the backlight
+ * is off or all zones are black.
+ */
+#define KB_IDLE_FADE_STEPS   16
+#define KB_IDLE_FADE_STEP_MS 30
+
+static struct {
+	struct delayed_work work;
+	struct work_struct wake_work;
+	struct work_struct lid_work;
+	unsigned long last_input;  /* jiffies */
+	bool ready;
+	bool idle;
+	bool lid_closed;
+	bool faded;     /* F4 was faded out, put saved_raw back on wake */
+	u8 saved_raw;
+	u8 user_raw;    /* kb_backlight.brightness_raw when the fade began */
+	unsigned int fade_steps;    /* left in the current fade */
+	unsigned int fade_level;    /* kb_fx level the fade started from */
+	unsigned long fade_since;   /* kb_idle.last_input the fade is for */
+	u64 fades;
+	u64 wakes;
+} kb_idle;
+
+static int param_set_idle_timeout(const char *val,
+	const struct kernel_param *kp)
+{
+	int ret;
+
+	ret = param_set_uint(val, kp);
+
+	/* Restart the countdown with the new timeout */
+	if (!ret && READ_ONCE(kb_idle.ready))
+		mod_delayed_work(system_power_efficient_wq, &kb_idle.work, 0);
+
+	return ret;
+}
+
+static const struct kernel_param_ops param_ops_idle_timeout = {
+	.set = param_set_idle_timeout,
+	.get = param_get_uint,
+};
+
+static unsigned int idle_timeout = 0;
+module_param_cb(idle_timeout, &param_ops_idle_timeout, &idle_timeout, 0644);
+MODULE_PARM_DESC(idle_timeout, "Fade out the keyboard backlight and pause LED effects after this many seconds without input, 0 = never (default 0)");
+
+static void kb_idle_arm(unsigned long delay)
+{
+	if (READ_ONCE(kb_idle.ready))
+		queue_delayed_work(system_power_efficient_wq, &kb_idle.work,
+			delay);
+}
+
+/* call with kb_fx_lock held */
+static void kb_idle_wake_locked(void)
+{
+	if (!kb_idle.idle)
+		return;
+
+	WRITE_ONCE(kb_idle.idle, false);
+	kb_idle.fade_steps = 0;
+	kb_idle.wakes++;
+
+	/* Unless the brightness was changed in the meantime */
+	mutex_lock(&kb_backlight_lock);
+	if (kb_idle.faded && kb_backlight.brightness_raw == kb_idle.user_raw)
+		clevo_xsm_kb_led_write(0xF4000000 | kb_idle.saved_raw);
+	mutex_unlock(&kb_backlight_lock);
+	kb_idle.faded = false;
+
+	kb_fx_hold(KB_FX_HOLD_IDLE, false);
+
+	if (READ_ONCE(idle_timeout))
+		kb_idle_arm((unsigned long) READ_ONCE(idle_timeout) * HZ);
+}
+
+/* call with kb_fx_lock held */
+static void kb_idle_fade_step(void)
+{
+	kb_idle.fade_steps--;
+	kb_fx_set_level(kb_idle.fade_level * kb_idle.fade_steps /
+		KB_IDLE_FADE_STEPS);
+
+	if (kb_idle.fade_steps)
+		kb_idle_arm(msecs_to_jiffies(KB_IDLE_FADE_STEP_MS));
+}
+
+static void kb_idle_work_fn(struct work_struct *work)
+{
+	unsigned long timeout = (unsigned long) READ_ONCE(idle_timeout) * HZ;
+	unsigned long since = READ_ONCE(kb_idle.last_input);
+	bool lit;
+	u32 cmd;
+
+	mutex_lock(&kb_fx_lock);
+
+	if (!timeout || !kb_backlight.ops) {
+		kb_idle_wake_locked();
+		goto out;
+	}
+
+	if (kb_idle.idle) {
+		/* Input during the fade */
+		if (since != kb_idle.fade_since)
+			kb_idle_wake_locked();
+		else if (kb_idle.fade_steps)
+			kb_idle_fade_step();
+		goto out;
+	}
+
+	if (time_before(jiffies, since + timeout)) {
+		kb_idle_arm(since + timeout - jiffies);
+		goto out;
+	}
+
+	WRITE_ONCE(kb_idle.idle, true);
+	smp_mb();  /* pairs with kb_idle_event() */
+	kb_idle.fades++;
+	kb_idle.fade_since = since;
+
+	/* Nothing to fade if the backlight is already dark */
+	lit = !kb_fx.hold && kb_backlight.ops->set_brightness_raw;
+	kb_fx_hold(KB_FX_HOLD_IDLE, true);
+
+	if (lit && clevo_xsm_kb_shadow_get(KB_SHADOW_BRIGHTNESS, &cmd)) {
+		kb_idle.saved_raw = cmd & 0xFF;
+		kb_idle.user_raw = READ_ONCE(kb_backlight.brightness_raw);
+		kb_idle.faded = true;
+
+		kb_idle.fade_level = kb_fx_raw_to_level(kb_idle.saved_raw);
+		kb_idle.fade_steps = KB_IDLE_FADE_STEPS;
+		kb_idle_fade_step();
+	}
+
+	/* Input before kb_idle.idle was visible */
+	if (READ_ONCE(kb_idle.last_input) != since)
+		kb_idle_wake_locked();
+
+out:
+	mutex_unlock(&kb_fx_lock);
+}
+
+static void kb_idle_wake_work_fn(struct work_struct *work)
+{
+	mutex_lock(&kb_fx_lock);
+	kb_idle_wake_locked();
+	mutex_unlock(&kb_fx_lock);
+}
+
+static void kb_idle_lid_work_fn(struct work_struct *work)
+{
+	mutex_lock(&kb_fx_lock);
+	kb_fx_hold(KB_FX_HOLD_LID, READ_ONCE(kb_idle.lid_closed));
+	mutex_unlock(&kb_fx_lock);
+}
+
+static void kb_idle_event(struct input_handle *handle, unsigned int type,
+	unsigned int code, int value)
+{
+	if (type == EV_SW && code == SW_LID) {
+		WRITE_ONCE(kb_idle.lid_closed, !!value);
+		schedule_work(&kb_idle.lid_work);
+
+		/* Opening the lid counts as input */
+		if (value)
+			return;
+	} else if (type != EV_KEY && type != EV_REL && type != EV_ABS) {
+		return;
+	}
+
+	WRITE_ONCE(kb_idle.last_input, jiffies);
+	smp_mb();  /* pairs with kb_idle_work_fn() */
+	if (READ_ONCE(kb_idle.idle))
+		schedule_work(&kb_idle.wake_work);
+}
+
+/* Shared by our input handlers, which only listen */
+static int kb_input_connect(struct input_handler *handler,
+	struct input_dev *dev, const struct input_device_id *id)
+{
+	struct input_handle *handle;
+	int err;
+
+	handle = kzalloc(sizeof(*handle), GFP_KERNEL);
+	if (!handle)
+		return -ENOMEM;
+
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = handler->name;
+
+	err = input_register_handle(handle);
+	if (err)
+		goto err_free_handle;
+
+	err = input_open_device(handle);
+	if (err)
+		goto err_unregister_handle;
+
+	return 0;
+
+err_unregister_handle:
+	input_unregister_handle(handle);
+err_free_handle:
+	kfree(handle);
+
+	return err;
+}
+
+static void kb_input_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+static int kb_idle_connect(struct input_handler *handler,
+	struct input_dev *dev, const struct input_device_id *id)
+{
+	int err;
+
+	err = kb_input_connect(handler, dev, id);
+	if (err)
+		return err;
+
+	if (test_bit(EV_SW, dev->evbit) && test_bit(SW_LID, dev->swbit)) {
+		WRITE_ONCE(kb_idle.lid_closed, test_bit(SW_LID, dev->sw));
+		schedule_work(&kb_idle.lid_work);
+	}
+
+	return 0;
+}
+
+static const struct input_device_id kb_idle_ids[] = {
+	/* Keyboards, touchpads and mice */
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT,
+		.evbit = { BIT_MASK(EV_KEY) },
+	},
+	/* Lid switch */
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT |
+			INPUT_DEVICE_ID_MATCH_SWBIT,
+		.evbit = { BIT_MASK(EV_SW) },
+		.swbit = { [BIT_WORD(SW_LID)] = BIT_MASK(SW_LID) },
+	},
+	{ }
+};
+
+static struct input_handler kb_idle_handler = {
+	.event      = kb_idle_event,
+	.connect    = kb_idle_connect,
+	.disconnect = kb_input_disconnect,
+	.name       = CLEVO_XSM_DRIVER_NAME "_idle",
+	.id_table   = kb_idle_ids,
+};
+
+static void __init kb_idle_init(void)
+{
+	INIT_DELAYED_WORK(&kb_idle.work, kb_idle_work_fn);
+	INIT_WORK(&kb_idle.wake_work, kb_idle_wake_work_fn);
+	INIT_WORK(&kb_idle.lid_work, kb_idle_lid_work_fn);
+	kb_idle.last_input = jiffies;
+
+	/* Without input events nothing would wake us up again */
+	if (input_register_handler(&kb_idle_handler)) {
+		CLEVO_XSM_ERROR("Could not register input handler, idle_timeout disabled\n");
+		return;
+	}
+
+	WRITE_ONCE(kb_idle.ready, true);
+	kb_idle_arm(0);
+}
+
+static void kb_idle_exit(void)
+{
+	if (!READ_ONCE(kb_idle.ready))
+		return;
+
+	input_unregister_handler(&kb_idle_handler);
+	WRITE_ONCE(kb_idle.ready, false);
+	cancel_work_sync(&kb_idle.wake_work);
+	cancel_work_sync(&kb_idle.lid_work);
+	cancel_delayed_work_sync(&kb_idle.work);
+
+	/* Leave the backlight lit */
+	mutex_lock(&kb_fx_lock);
+	kb_idle_wake_locked();
+	mutex_unlock(&kb_fx_lock);
+}
+
+/* Reactive typing input, see kb_react_render() */
+static void kb_react_event(struct input_handle *handle, unsigned int type,
+	unsigned int code, int value)
+{
+	unsigned long flags;
+	bool kick;
+
+	/* Presses only, not releases or autorepeat */
+	if (type != EV_KEY || value != 1 || code >= BTN_MISC ||
+		!READ_ONCE(kb_react.active))
+		return;
+
+	spin_lock_irqsave(&kb_react.lock, flags);
+	kb_react.presses++;
+	if (kb_react.press_ns)
+		kb_react.coalesced++;
+	else
+		kb_react.press_ns = ktime_get_ns();
+	kick = kb_react.sleeping;
+	kb_react.sleeping = false;
+	spin_unlock_irqrestore(&kb_react.lock, flags);
+
+	if (kick)
+		kb_fx_kick();
+}
+
+/* The internal keyboard, not the touchpad behind the same controller */
+static const struct input_device_id kb_react_ids[] = {
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_BUS |
+			INPUT_DEVICE_ID_MATCH_EVBIT |
+			INPUT_DEVICE_ID_MATCH_KEYBIT,
+		.bustype = BUS_I8042,
+		.evbit = { BIT_MASK(EV_KEY) },
+		.keybit = { [BIT_WORD(KEY_A)] = BIT_MASK(KEY_A) },
+	},
+	{ }
+};
+
+static struct input_handler kb_react_handler = {
+	.event      = kb_react_event,
+	.connect    = kb_input_connect,
+	.disconnect = kb_input_disconnect,
+	.name       = CLEVO_XSM_DRIVER_NAME "_react",
+	.id_table   = kb_react_ids,
+};
+
+static bool kb_react_registered;
+
+/* call with kb_fx_lock and kb_backlight_lock held */
+static void kb_react_update_base(void)
+{
+	unsigned int zone;
+
+	kb_react.zones = kb_backlight.extra == KB_HAS_EXTRA_TRUE ?
+		KB_FX_MAX_ZONES : KB_FX_ZONES;
+
+	for (zone = 0; zone < KB_FX_MAX_ZONES; zone++)
+		WRITE_ONCE(kb_react.base[zone], kb_zone_rgb(zone));
+}
+
+/* call with kb_fx_lock and kb_backlight_lock held and the engine stopped */
+static void kb_react_reset(bool active)
+{
+	WRITE_ONCE(kb_react.active, active);
+	kb_react.flash_ns = 0;
+
+	spin_lock_irq(&kb_react.lock);
+	kb_react.press_ns = 0;
+	kb_react.sleeping = false;
+	spin_unlock_irq(&kb_react.lock);
+
+	if (active)
+		kb_react_update_base();
+}
+
+static void __init kb_react_init(void)
+{
+	spin_lock_init(&kb_react.lock);
+
+	if (input_register_handler(&kb_react_handler))
+		CLEVO_XSM_ERROR("Could not register keyboard handler, reactive mode will not react\n");
+	else
+		kb_react_registered = true;
+}
+
+/* Before kb_fx_exit(), the handler kicks the effect worker */
+static void kb_react_exit(void)
+{
+	if (kb_react_registered)
+		input_unregister_handler(&kb_react_handler);
+	kb_react_registered = false;
+}
+
+/* Hold the effect engine while the backlight is off or all zones are black */
+static void kb_backlight_changed(void)
+{
+	unsigned int zones, zone;
+	bool off;
+
+	if (!kb_backlight.ops)
+		return;
+
+	mutex_lock(&kb_fx_lock);
+	mutex_lock(&kb_backlight_lock);
+
+	zones = kb_backlight.extra == KB_HAS_EXTRA_TRUE ?
+		KB_FX_MAX_ZONES : KB_FX_ZONES;
+	/* Switched off, or every zone black */
+	off = true;
+	for (zone = 0; zone < zones; zone++) {
+		if (kb_zone_rgb(zone))
+			off = false;
+	}
+	off = off || kb_backlight.state == KB_STATE_OFF;
+
+	/* A frame may have landed after the change, put the colors back */
+	if (kb_fx_hold(KB_FX_HOLD_OFF, off) &&
+		kb_backlight.state == KB_STATE_ON)
+		kb_restore_colors();
+	if (current_led_mode == LED_MODE_REACTIVE)
+		kb_react_update_base();
+
+	mutex_unlock(&kb_backlight_lock);
+	mutex_unlock(&kb_fx_lock);
+
+	kb_attr_changed();
+}
+
+/*
+ * Keyboard backlight LED class devices
+ *
+ * One multicolor LED per zone, named kbd_backlight so desktop power
+ * managers find it and LED triggers can drive the keyboard. There is a
+ * single brightness register, so every zone reports and sets the
+ * keyboard brightness, while a zone's intensities set its color. A
+ * running effect keeps overwriting both.
+ */
+#if IS_REACHABLE(CONFIG_LEDS_CLASS_MULTICOLOR)
+static const char * const kb_led_names[KB_FX_MAX_ZONES] = {
+	"rgb:kbd_backlight",
+	"rgb:kbd_backlight_1",
+	"rgb:kbd_backlight_2",
+	"rgb:kbd_backlight_3",
+};
+
+static struct led_classdev_mc kb_leds[KB_FX_MAX_ZONES];
+static struct mc_subled kb_led_subleds[KB_FX_MAX_ZONES][3];
+static unsigned int kb_led_count;
+
+static enum led_brightness kb_led_brightness_get(struct led_classdev *led_cdev)
+{
+	enum led_brightness brightness;
+
+	mutex_lock(&kb_backlight_lock);
+	brightness = kb_backlight.state == KB_STATE_ON ?
+		kb_backlight.brightness_raw : LED_OFF;
+	mutex_unlock(&kb_backlight_lock);
+
+	return brightness;
+}
+
+static int kb_led_brightness_set(struct led_classdev *led_cdev,
+	enum led_brightness brightness)
+{
+	struct led_classdev_mc *mc_cdev = lcdev_to_mccdev(led_cdev);
+	struct mc_subled *s = mc_cdev->subled_info;
+	unsigned int zone = mc_cdev - kb_leds;
+	bool toggled = false;
+
+	mutex_lock(&kb_backlight_lock);
+
+	/*
+	 * Brightness 0 switches the backlight off and anything else switches
+	 * it back on, so kb_state and the LED brightness always agree
+	 */
+	if (!brightness != (kb_backlight.state == KB_STATE_OFF)) {
+		kb_toggle_state();
+		toggled = true;
+	}
+
+	if (brightness) {
+		kb_backlight.ops->set_brightness_raw(brightness);
+		kb_backlight.ops->set_zone_rgb(zone, kb_fx_correct(
+			s[0].intensity << 16 | s[1].intensity << 8 |
+			s[2].intensity));
+	}
+
+	mutex_unlock(&kb_backlight_lock);
+
+	if (toggled)
+		kb_backlight_changed();
+	kb_attr_changed();
+
+	return 0;
+}
+
+/* Tell listeners about a brightness change made by a hotkey */
+static void kb_led_hw_changed(void)
+{
+	if (kb_led_count)
+		led_classdev_notify_brightness_hw_changed(&kb_leds[0].led_cdev,
+			kb_led_brightness_get(&kb_leds[0].led_cdev));
+}
+
+static void kb_led_exit(void)
+{
+	while (kb_led_count)
+		led_classdev_multicolor_unregister(&kb_leds[--kb_led_count]);
+}
+
+static int __init kb_led_init(void)
+{
+	u32 rgb[KB_FX_MAX_ZONES];
+	unsigned int zones, zone;
+	union kb_rgb_color c;
+	int err;
+
+	/* Only full color keyboards take arbitrary zone colors */
+	if (!kb_backlight.ops || !kb_backlight.ops->set_zone_rgb ||
+		!kb_backlight.ops->set_brightness_raw)
+		return 0;
+
+	zones = kb_backlight.extra == KB_HAS_EXTRA_TRUE ?
+		KB_FX_MAX_ZONES : KB_FX_ZONES;
+
+	mutex_lock(&kb_backlight_lock);
+	for (zone = 0; zone < zones; zone++)
+		rgb[zone] = kb_zone_rgb(zone);
+	mutex_unlock(&kb_backlight_lock);
+
+	for (zone = 0; zone < zones; zone++) {
+		struct mc_subled *s = kb_led_subleds[zone];
+		struct led_classdev *led_cdev = &kb_leds[zone].led_cdev;
+
+		c.rgb = rgb[zone];
+
+		s[0].color_index = LED_COLOR_ID_RED;
+		s[0].intensity = c.r;
+		s[0].channel = 0;
+		s[1].color_index = LED_COLOR_ID_GREEN;
+		s[1].intensity = c.g;
+		s[1].channel = 1;
+		s[2].color_index = LED_COLOR_ID_BLUE;
+		s[2].intensity = c.b;
+		s[2].channel = 2;
+
+		kb_leds[zone].subled_info = s;
+		kb_leds[zone].num_colors = 3;
+
+		led_cdev->name = kb_led_names[zone];
+		led_cdev->max_brightness = 0xFF;
+		led_cdev->brightness = kb_led_brightness_get(led_cdev);
+		led_cdev->brightness_get = kb_led_brightness_get;
+		led_cdev->brightness_set_blocking = kb_led_brightness_set;
+		if (!zone)
+			led_cdev->flags = LED_BRIGHT_HW_CHANGED;
+
+		err = led_classdev_multicolor_register(
+			&clevo_xsm_platform_device->dev, &kb_leds[zone]);
+		if (err) {
+			kb_led_exit();
+			return err;
+		}
+
+		kb_led_count++;
+	}
+
+	return 0;
+}
+#else
+static void kb_led_hw_changed(void) { }
+static void kb_led_exit(void) { }
+static int __init kb_led_init(void) { return 0; }
+#endif
+
+
+/*
+ * WMI event bottom half
+ *
+ * The notify handler only counts the notification and queues kb_hotkey.work
+ * on an ordered workqueue, which fetches the event codes with GET_EVENT and
+ * handles them. Brightness keys move a target level that is written at most
+ * once per frame, so a held key costs one write per frame rather than one
+ * per key repeat.
+ */
+
+#define KB_HOTKEY_FRAME_NS (NSEC_PER_SEC / 60)
+
+static struct {
+	spinlock_t lock;
+	struct workqueue_struct *wq;
+	struct work_struct work;
+	struct delayed_work apply_work;
+	unsigned int pending;           /* notifications not fetched yet */
+	u64 notify_ns;                  /* time of the oldest of them */
+	bool notify;                    /* WMI notify handler installed */
+
+	/* bottom half only */
+	bool stepping;                  /* level not written yet */
+	unsigned int level;
+	u64 step_ns;                    /* notification of the first step */
+	u64 write_ns;                   /* last brightness write */
+
+	/* statistics, under lock */
+	u64 notifies;
+	u64 steps;
+	u64 writes;
+	struct clevo_xsm_lat_stats latency;     /* notify to LED write queued */
+} kb_hotkey;
+
+/* Held keys are paced at the effect frame rate cap, or 60 Hz without one */
+static u64 kb_hotkey_frame_ns(void)
+{
+	u64 ns = kb_fx_min_frame_ns();
+
+	return ns ? ns : KB_HOTKEY_FRAME_NS;
+}
+
+static void kb_hotkey_account(u64 notify_ns)
+{
+	spin_lock(&kb_hotkey.lock);
+	clevo_xsm_lat_account(&kb_hotkey.latency,
+		ktime_get_ns() - notify_ns, 0);
+	spin_unlock(&kb_hotkey.lock);
+}
+
+static void kb_hotkey_apply(void)
+{
+	if (!kb_hotkey.stepping)
+		return;
+
+	kb_hotkey.stepping = false;
+	kb_hotkey.write_ns = ktime_get_ns();
+
+	mutex_lock(&kb_backlight_lock);
+	kb_backlight.ops->set_brightness(kb_hotkey.level);
+	mutex_unlock(&kb_backlight_lock);
+	kb_led_hw_changed();
+	kb_attr_changed();
+
+	spin_lock(&kb_hotkey.lock);
+	kb_hotkey.writes++;
+	spin_unlock(&kb_hotkey.lock);
+	kb_hotkey_account(kb_hotkey.step_ns);
+}
+
+static void kb_hotkey_apply_work_fn(struct work_struct *work)
+{
+	kb_hotkey_apply();
+}
+
+/* One brightness key press, dir -1 for 0x81 and +1 for 0x82 */
+static void kb_hotkey_step(int dir, u64 notify_ns)
+{
+	u64 now, frame;
+
+	mutex_lock(&kb_backlight_lock);
+
+	if (kb_backlight.state == KB_STATE_OFF) {
+		mutex_unlock(&kb_backlight_lock);
+		return;
+	}
+
+	if (!kb_hotkey.stepping) {
+		kb_hotkey.stepping = true;
+		kb_hotkey.level = kb_backlight.brightness;
+		kb_hotkey.step_ns = notify_ns;
+	}
+
+	if (dir < 0 && kb_hotkey.level > 0)
+		kb_hotkey.level--;
+	else if (dir > 0 && kb_hotkey.level < kb_backlight.brightness_max)
+		kb_hotkey.level++;
+
+	mutex_unlock(&kb_backlight_lock);
+
+	spin_lock(&kb_hotkey.lock);
+	kb_hotkey.steps++;
+	spin_unlock(&kb_hotkey.lock);
+
+	now = ktime_get_ns();
+	frame = kb_hotkey_frame_ns();
+	if (now - kb_hotkey.write_ns >= frame)
+		kb_hotkey_apply();
+	else
+		queue_delayed_work(kb_hotkey.wq, &kb_hotkey.apply_work,
+			nsecs_to_jiffies(kb_hotkey.write_ns + frame - now));
+}
+
+static void kb_hotkey_event(u32 event, u64 notify_ns)
+{
+	CLEVO_XSM_DEBUG("WMI event %0#4x\n", event);
+
+	switch (event) {
+	case 0xF4:
+		CLEVO_XSM_DEBUG("Airplane-Mode Hotkey pressed\n");
+
+		clevo_xsm_hotkey_event();
+		break;
+	default:
+		if (!kb_backlight.ops)
+			break;
+
+		switch (event) {
+		case 0x81:
+			kb_hotkey_step(-1, notify_ns);
+			clevo_xsm_input_report_key(KEY_KBDILLUMDOWN);
+			break;
+		case 0x82:
+			kb_hotkey_step(1, notify_ns);
+			clevo_xsm_input_report_key(KEY_KBDILLUMUP);
+			break;
+		case 0x83:
+			kb_hotkey_apply();
+			mutex_lock(&kb_backlight_lock);
+			if (!param_kb_cycle_colors)
+				kb_next_mode();
+			else
+				kb_next_color();
+			mutex_unlock(&kb_backlight_lock);
+			kb_backlight_changed();
+			kb_hotkey_account(notify_ns);
+			break;
+		case 0x9F:
+			kb_hotkey_apply();
+			mutex_lock(&kb_backlight_lock);
+			kb_toggle_state();
+			mutex_unlock(&kb_backlight_lock);
+			kb_backlight_changed();
+			kb_led_hw_changed();
+			kb_hotkey_account(notify_ns);
+			clevo_xsm_input_report_key(KEY_KBDILLUMTOGGLE);
+			break;
+		default:
+			CLEVO_XSM_INFO_RATELIMITED("Unknown WMI event (%0#4x)\n",
+				event);
+			break;
+		}
+		break;
+	}
+}
+
+static void kb_hotkey_work_fn(struct work_struct *work)
+{
+	unsigned int n;
+	u64 notify_ns;
+	u32 event;
+
+	for (;;) {
+		spin_lock(&kb_hotkey.lock);
+		n = kb_hotkey.pending;
+		notify_ns = kb_hotkey.notify_ns;
+		kb_hotkey.pending = 0;
+		spin_unlock(&kb_hotkey.lock);
+
+		if (!n)
+			break;
+
+		/* One GET_EVENT per notification */
+		while (n--) {
+			if (clevo_xsm_wmi_evaluate_wmbb_method(GET_EVENT, 0,
+				&event))
+				continue;
+			kb_hotkey_event(event, notify_ns);
+		}
+	}
+}
+
+static int __init kb_hotkey_init(void)
+{
+	spin_lock_init(&kb_hotkey.lock);
+	INIT_WORK(&kb_hotkey.work, kb_hotkey_work_fn);
+	INIT_DELAYED_WORK(&kb_hotkey.apply_work, kb_hotkey_apply_work_fn);
+
+	kb_hotkey.wq = alloc_ordered_workqueue("clevo_hotkey", WQ_HIGHPRI);
+	if (!kb_hotkey.wq)
+		return -ENOMEM;
+
+	return 0;
+}
+
+/* call after the notify handler is gone, runs what is still pending */
+static void kb_hotkey_drain(void)
+{
+	flush_workqueue(kb_hotkey.wq);
+	flush_delayed_work(&kb_hotkey.apply_work);
+}
+
+static void kb_hotkey_exit(void)
+{
+	kb_hotkey_drain();
+	destroy_workqueue(kb_hotkey.wq);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+static void clevo_xsm_wmi_notify(union acpi_object *obj, void *context)
+{
+	/* On newer kernels, we don't get the u32 value directly. 
+	 * We assume the event is relevant if we received it.
+	 */
+#else
+static void clevo_xsm_wmi_notify(u32 value, void *context)
+{
+	if (value != 0xD0) {
+		CLEVO_XSM_INFO_RATELIMITED("Unexpected WMI event (%0#6x)\n",
+			value);
+		return;
+	}
+#endif
+
+	spin_lock(&kb_hotkey.lock);
+	if (!kb_hotkey.pending++)
+		kb_hotkey.notify_ns = ktime_get_ns();
+	kb_hotkey.notifies++;
+	spin_unlock(&kb_hotkey.lock);
+
+	queue_work(kb_hotkey.wq, &kb_hotkey.work);
+}
+
+static void clevo_xsm_wmi_notify_remove(void)
+{
+	if (!kb_hotkey.notify)
+		return;
+
+	wmi_remove_notify_handler(CLEVO_EVENT_GUID);
+	kb_hotkey.notify = false;
+}
+
+static int clevo_xsm_wmi_probe(struct platform_device *dev)
+{
+	int status;
+
+	status = wmi_install_notify_handler(CLEVO_EVENT_GUID,
+		clevo_xsm_wmi_notify, NULL);
+	if (unlikely(ACPI_FAILURE(status))) {
+		CLEVO_XSM_ERROR("Could not register WMI notify handler (%0#6x)\n",
+			status);
+		return -EIO;
+	}
+	kb_hotkey.notify = true;
+
+	clevo_xsm_wmi_evaluate_wmbb_method(GET_AP, 0, NULL);
+
+	if (kb_backlight.ops) {
+		mutex_lock(&kb_backlight_lock);
+		kb_backlight.ops->init();
+		mutex_unlock(&kb_backlight_lock);
+		kb_backlight_changed();
+	}
+
+	return 0;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 11, 0)
+static void clevo_xsm_wmi_remove(struct platform_device *dev)
+{
+	clevo_xsm_wmi_notify_remove();
+}
+#else
+static int clevo_xsm_wmi_remove(struct platform_device *dev)
+{
+	clevo_xsm_wmi_notify_remove();
+	return 0;
+}
+#endif
+
+static int clevo_xsm_wmi_resume(struct platform_device *dev)
+{
+	/* Firmware may have reset the LED registers while suspended */
+	clevo_xsm_kb_shadow_invalidate();
+
+	clevo_xsm_wmi_evaluate_wmbb_method(GET_AP, 0, NULL);
+
+	mutex_lock(&kb_backlight_lock);
+	if (kb_backlight.ops && kb_backlight.state == KB_STATE_ON)
+		kb_backlight.ops->set_mode(kb_backlight.mode);
+	mutex_unlock(&kb_backlight_lock);
+	kb_attr_changed();
+
+	return 0;
+}
+
+static struct platform_driver clevo_xsm_platform_driver = {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 11, 0)
+	.remove = clevo_xsm_wmi_remove,
+#else
+	.remove = clevo_xsm_wmi_remove,
+#endif
+	.resume = clevo_xsm_wmi_resume,
+	.driver = {
+		.name  = CLEVO_XSM_DRIVER_NAME,
+		.owner = THIS_MODULE,
+	},
+};
+
+
+/* RFKILL sub-driver */
+
+static bool param_rfkill;
+module_param_named(rfkill, param_rfkill, bool, 0);
+MODULE_PARM_DESC(rfkill, "Enable WWAN-RFKILL capability.");
+
+static struct rfkill *clevo_xsm_wwan_rfkill_device;
+
+static int clevo_xsm_wwan_rfkill_set_block(void *data, bool blocked)
+{
+	CLEVO_XSM_DEBUG("blocked=%i\n", blocked);
+
+	if (clevo_xsm_wmi_evaluate_wmbb_method(SET_3G, !blocked, NULL))
+		CLEVO_XSM_ERROR("Setting 3G power state failed!\n");
+	return 0;
+}
+
+static const struct rfkill_ops clevo_xsm_wwan_rfkill_ops = {
+	.set_block = clevo_xsm_wwan_rfkill_set_block,
+};
+
+static int __init clevo_xsm_rfkill_init(void)
+{
+	int err;
+	u32 unblocked = 0;
+
+	if (!param_rfkill)
+		return 0;
+
+	clevo_xsm_wmi_evaluate_wmbb_method(TALK_BIOS_3G, 1, NULL);
+
+	clevo_xsm_wwan_rfkill_device = rfkill_alloc("clevo_xsm-wwan",
+		&clevo_xsm_platform_device->dev,
+		RFKILL_TYPE_WWAN,
+		&clevo_xsm_wwan_rfkill_ops, NULL);
+	if (unlikely(!clevo_xsm_wwan_rfkill_device))
+		return -ENOMEM;
+
+	err = rfkill_register(clevo_xsm_wwan_rfkill_device);
+	if (unlikely(err))
+		goto err_destroy_wwan;
+
+	if (clevo_xsm_wmi_evaluate_wmbb_method(GET_POWER_STATE_FOR_3G, 0,
+		&unblocked))
+		CLEVO_XSM_ERROR("Could not get 3G power state!\n");
+	else
+		rfkill_set_sw_state(clevo_xsm_wwan_rfkill_device, !unblocked);
+
+	return 0;
+
+err_destroy_wwan:
+	rfkill_destroy(clevo_xsm_wwan_rfkill_device);
+	clevo_xsm_wmi_evaluate_wmbb_method(TALK_BIOS_3G, 0, NULL);
+	return err;
+}
+
+static void __exit clevo_xsm_rfkill_exit(void)
+{
+	if (!clevo_xsm_wwan_rfkill_device)
+		return;
+
+	clevo_xsm_wmi_evaluate_wmbb_method(TALK_BIOS_3G, 0, NULL);
+
+	rfkill_unregister(clevo_xsm_wwan_rfkill_device);
+	rfkill_destroy(clevo_xsm_wwan_rfkill_device);
+}
+
+
+/* Sysfs interface */
+
+/*
+ * Deferred keyboard stores
+ *
+ * kb_brightness, kb_brightness_raw, kb_color, kb_mode and kb_state only
+ * validate and record the value; kb_store.work applies the newest pending value of each, in the order
+ * they were last written, so a slider drag ends up as one update per
+ * attribute instead of one per step. With kb_sync set, a store waits
+ * until its value has reached the firmware.
+ */
+
+enum kb_store_item {
+	KB_STORE_COLOR,
+	KB_STORE_MODE,
+	KB_STORE_BRIGHTNESS,
+	KB_STORE_BRIGHTNESS_RAW,
+	KB_STORE_STATE,
+	KB_STORE_MAX,
+};
+
+static struct {
+	spinlock_t lock;
+	struct work_struct work;
+	unsigned long pending;
+	unsigned int seq[KB_STORE_MAX];         /* order of the last writes */
+	unsigned int next_seq;
+	unsigned int color[4];
+	u32 rgb[4];
+	unsigned long rgb_zones;
+	unsigned int mode;
+	unsigned int brightness;
+	u8 brightness_raw;
+	unsigned int state;
+	bool sync;
+} kb_store;
+
+static void kb_store_work_fn(struct work_struct *work)
+{
+	static const enum kb_mode modes[] = {
+		KB_MODE_RANDOM_COLOR,
+		KB_MODE_CUSTOM,
+		KB_MODE_BREATHE,
+		KB_MODE_CYCLE,
+		KB_MODE_WAVE,
+		KB_MODE_DANCE,
+		KB_MODE_TEMPO,
+		KB_MODE_FLASH,
+	};
+	unsigned int seq[KB_STORE_MAX], color[4], mode, brightness, state;
+	unsigned long pending, rgb_zones;
+	u32 rgb[4];
+	u8 brightness_raw;
+	int i, item;
+
+	spin_lock(&kb_store.lock);
+	pending = kb_store.pending;
+	kb_store.pending = 0;
+	memcpy(seq, kb_store.seq, sizeof(seq));
+	memcpy(color, kb_store.color, sizeof(color));
+	memcpy(rgb, kb_store.rgb, sizeof(rgb));
+	rgb_zones = kb_store.rgb_zones;
+	mode = kb_store.mode;
+	brightness = kb_store.brightness;
+	brightness_raw = kb_store.brightness_raw;
+	state = kb_store.state;
+	spin_unlock(&kb_store.lock);
+
+	while (pending) {
+		item = -1;
+		for_each_set_bit(i, &pending, KB_STORE_MAX) {
+			if (item < 0 || (int) (seq[i] - seq[item]) < 0)
+				item = i;
+		}
+		__clear_bit(item, &pending);
+
+		mutex_lock(&kb_backlight_lock);
+		switch (item) {
+		case KB_STORE_COLOR:
+			kb_set_colors(color, rgb, rgb_zones);
+			break;
+		case KB_STORE_MODE:
+			kb_backlight.ops->set_mode(modes[mode]);
+			break;
+		case KB_STORE_BRIGHTNESS:
+			kb_backlight.ops->set_brightness(brightness);
+			break;
+		case KB_STORE_BRIGHTNESS_RAW:
+			kb_backlight.ops->set_brightness_raw(brightness_raw);
+			break;
+		case KB_STORE_STATE:
+			kb_backlight.ops->set_state(state);
+			break;
+		}
+		mutex_unlock(&kb_backlight_lock);
+
+		if (item == KB_STORE_COLOR || item == KB_STORE_STATE)
+			kb_backlight_changed();
+	}
+
+	kb_attr_changed();
+}
+
+/* call with kb_store.lock held */
+static void kb_store_queue_locked(enum kb_store_item item)
+{
+	kb_store.seq[item] = kb_store.next_seq++;
+	__set_bit(item, &kb_store.pending);
+	schedule_work(&kb_store.work);
+}
+
+static int kb_store_wait(void)
+{
+	if (!READ_ONCE(kb_store.sync))
+		return 0;
+
+	flush_work(&kb_store.work);
+	return clevo_cmdq_sync();
+}
+
+static void __init kb_store_init(void)
+{
+	spin_lock_init(&kb_store.lock);
+	INIT_WORK(&kb_store.work, kb_store_work_fn);
+}
+
+/* Applies what is still pending */
+static void kb_store_exit(void)
+{
+	flush_work(&kb_store.work);
+}
+
+static ssize_t clevo_xsm_sync_show(struct device *child,
+	struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", READ_ONCE(kb_store.sync));
+}
+
+static ssize_t clevo_xsm_sync_store(struct device *child,
+	struct device_attribute *attr, const char *buf, size_t size)
+{
+	bool val;
+	int ret;
+
+	ret = kstrtobool(buf, &val);
+	if (ret)
+		return ret;
+
+	WRITE_ONCE(kb_store.sync, val);
+
+	return size;
+}
+
+static DEVICE_ATTR(kb_sync, 0644,
+	clevo_xsm_sync_show, clevo_xsm_sync_store);
+
+static ssize_t clevo_xsm_brightness_show(struct device *child,
+	struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", kb_backlight.brightness);
+}
+
+static ssize_t clevo_xsm_brightness_store(struct device *child,
+	struct device_attribute *attr, const char *buf, size_t size)
+{
+	unsigned int val;
+	int ret;
+
+	if (!kb_backlight.ops)
+		return -EINVAL;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	if (val > kb_backlight.brightness_max)
+		return -EINVAL;
+
+	spin_lock(&kb_store.lock);
+	kb_store.brightness = val;
+	kb_store_queue_locked(KB_STORE_BRIGHTNESS);
+	spin_unlock(&kb_store.lock);
+
+	ret = kb_store_wait();
+
+	return ret ? : size;
+}
+
+static DEVICE_ATTR(kb_brightness, 0644,
+	clevo_xsm_brightness_show, clevo_xsm_brightness_store);
+
+/* Full 8-bit F4 value, 0xFF = brightest */
+static ssize_t clevo_xsm_brightness_raw_show(struct device *child,
+	struct device_attribute *attr, char *buf)
+{
+	if (!kb_backlight.ops || !kb_backlight.ops->set_brightness_raw)
+		return -EOPNOTSUPP;
+
+	return sprintf(buf, "%u\n", kb_backlight.brightness_raw);
+}
+
+static ssize_t clevo_xsm_brightness_raw_store(struct device *child,
+	struct device_attribute *attr, const char *buf, size_t size)
+{
+	u8 val;
+	int ret;
+
+	if (!kb_backlight.ops || !kb_backlight.ops->set_brightness_raw)
+		return -EOPNOTSUPP;
+
+	ret = kstrtou8(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	spin_lock(&kb_store.lock);
+	kb_store.brightness_raw = val;
+	kb_store_queue_locked(KB_STORE_BRIGHTNESS_RAW);
+	spin_unlock(&kb_store.lock);
+
+	ret = kb_store_wait();
+
+	return ret ? : size;
+}
+
+static DEVICE_ATTR(kb_brightness_raw, 0644,
+	clevo_xsm_brightness_raw_show, clevo_xsm_brightness_raw_store);
+
+static ssize_t clevo_xsm_state_show(struct device *child,
+	struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", kb_backlight.state);
+}
+
+static ssize_t clevo_xsm_state_store(struct device *child,
+	struct device_attribute *attr, const char *buf, size_t size)
+{
+	unsigned int val;
+	int ret;
+
+	if (!kb_backlight.ops)
+		return -EINVAL;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	spin_lock(&kb_store.lock);
+	kb_store.state = clamp_t(unsigned, val, 0, 1);
+	kb_store_queue_locked(KB_STORE_STATE);
+	spin_unlock(&kb_store.lock);
+
+	ret = kb_store_wait();
+
+	return ret ? : size;
+}
+
+static DEVICE_ATTR(kb_state, 0644,
+	clevo_xsm_state_show, clevo_xsm_state_store);
+
+static ssize_t clevo_xsm_mode_show(struct device *child,
+	struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", kb_backlight.mode);
+}
+
+static ssize_t clevo_xsm_mode_store(struct device *child,
+	struct device_attribute *attr, const char *buf, size_t size)
+{
+	unsigned int val;
+	int ret;
+
+	if (!kb_backlight.ops)
+		return -EINVAL;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	spin_lock(&kb_store.lock);
+	kb_store.mode = clamp_t(unsigned, val, 0, 7);
+	kb_store_queue_locked(KB_STORE_MODE);
+	spin_unlock(&kb_store.lock);
+
+	ret = kb_store_wait();
+
+	return ret ? : size;
+}
+
+static DEVICE_ATTR(kb_mode, 0644,
+	clevo_xsm_mode_show, clevo_xsm_mode_store);
+
+/* Palette names, or RRGGBB in hex for a zone set to an arbitrary color */
+static ssize_t clevo_xsm_color_show(struct device *child,
+	struct device_attribute *attr, char *buf)
+{
+	unsigned int color[KB_FX_MAX_ZONES];
+	unsigned int zones, zone;
+	ssize_t len = 0;
+
+	mutex_lock(&kb_backlight_lock);
+	color[0] = kb_backlight.color.left;
+	color[1] = kb_backlight.color.center;
+	color[2] = kb_backlight.color.right;
+	color[3] = kb_backlight.color.extra;
+	zones = kb_backlight.extra == KB_HAS_EXTRA_TRUE ?
+		KB_FX_MAX_ZONES : KB_FX_ZONES;
+	for (zone = 0; zone < zones; zone++) {
+		if (test_bit(zone, &kb_backlight.rgb_zones))
+			len += sprintf(buf + len, "%06x", kb_backlight.rgb[zone]);
+		else
+			len += sprintf(buf + len, "%s",
+				kb_colors[color[zone]].name);
+		buf[len++] = zone + 1 < zones ? ' ' : '\n';
+	}
+	mutex_unlock(&kb_backlight_lock);
+
+	return len;
+}
+
+/* A palette name, or RRGGBB in hex on keyboards that take any color */
+static void clevo_xsm_color_parse(const char *name, unsigned int zone,
+	unsigned int *val, u32 *rgb, unsigned long *rgb_zones)
+{
+	unsigned int j;
+
+	for (j = 0; j < ARRAY_SIZE(kb_colors); j++) {
+		if (!strcmp(name, kb_colors[j].name)) {
+			val[zone] = j;
+			return;
+		}
+	}
+
+	if (strlen(name) == 6 && kb_backlight.ops->set_zone_rgb &&
+		!kstrtou32(name, 16, &rgb[zone]))
+		__set_bit(zone, rgb_zones);
+}
+
+static ssize_t clevo_xsm_color_store(struct device *child,
+	struct device_attribute *attr, const char *buf, size_t size)
+{
+	unsigned int i, zone;
+	unsigned int val[4] = {0};
+	u32 rgb[4] = {0};
+	unsigned long rgb_zones = 0;
+	int ret;
+	char left[8];
+	char right[8];
+	char center[8];
+	char extra[8];
+
+	if (!kb_backlight.ops)
+		return -EINVAL;
+
+	i = sscanf(buf, "%7s %7s %7s %7s", left, center, right, extra);
+
+	if (i == 1) {
+		for (zone = 0; zone < 4; zone++)
+			clevo_xsm_color_parse(left, zone, val, rgb, &rgb_zones);
+
+	} else if (i == 3 || i == 4) {
+		clevo_xsm_color_parse(left, 0, val, rgb, &rgb_zones);
+		clevo_xsm_color_parse(center, 1, val, rgb, &rgb_zones);
+		clevo_xsm_color_parse(right, 2, val, rgb, &rgb_zones);
+		if (i == 4)
+			clevo_xsm_color_parse(extra, 3, val, rgb, &rgb_zones);
+
+	} else
+		return -EINVAL;
+
+	spin_lock(&kb_store.lock);
+	memcpy(kb_store.color, val, sizeof(val));
+	memcpy(kb_store.rgb, rgb, sizeof(rgb));
+	kb_store.rgb_zones = rgb_zones;
+	kb_store_queue_locked(KB_STORE_COLOR);
+	spin_unlock(&kb_store.lock);
+
+	ret = kb_store_wait();
+
+	return ret ? : size;
+}
+static DEVICE_ATTR(kb_color, 0644,
+	clevo_xsm_color_show, clevo_xsm_color_store);
+
+/* SET_KB_LED writes dropped by / passed through the shadow cache */
+static ssize_t clevo_xsm_shadow_stats_show(struct device *child,
+	struct device_attribute *attr, char *buf)
+{
+	unsigned long hits, misses;
+
+	spin_lock(&clevo_cmdq.lock);
+	hits = kb_shadow.hits;
+	misses = kb_shadow.misses;
+	spin_unlock(&clevo_cmdq.lock);
+
+	return sprintf(buf, "%lu %lu\n", hits, misses);
+}
+
+static DEVICE_ATTR(kb_shadow_stats, 0444,
+	clevo_xsm_shadow_stats_show, NULL);
+
+/* Wave effect sysfs control */
+static ssize_t clevo_xsm_wave_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", wave_running() ? 1 : 0);
+}
+
+static ssize_t clevo_xsm_wave_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t size)
+{
+	unsigned int val;
+	
+	if (kstrtouint(buf, 10, &val))
+		return -EINVAL;
+	
+	mutex_lock(&kb_fx_lock);
+	if (val)
+		wave_start();
+	else
+		wave_stop();
+	mutex_unlock(&kb_fx_lock);
+	kb_attr_changed();
+	
+	return size;
+}
+static DEVICE_ATTR(kb_wave, 0644,
+	clevo_xsm_wave_show, clevo_xsm_wave_store);
+
+static ssize_t clevo_xsm_wave_period_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	if (wave_period_ms)
+		return sprintf(buf, "%u\n", wave_period_ms);
+	return sprintf(buf, "%d\n", wave_interval_ms * NUM_WAVE_STEPS);
+}
+
+static ssize_t clevo_xsm_wave_period_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t size)
+{
+	unsigned int val;
+	
+	if (kstrtouint(buf, 10, &val))
+		return -EINVAL;
+	
+	/* Minimum period: roughly 200ms (10ms interval) */
+	if (val < 200) val = 200;
+	
+	/* Frames are paced in ns, so the period is kept exactly */
+	wave_period_ms = val;
+	wave_interval_ms = val / NUM_WAVE_STEPS;
+	
+	return size;
+}
+static DEVICE_ATTR(kb_wave_period, 0644,
+	clevo_xsm_wave_period_show, clevo_xsm_wave_period_store);
+
+static ssize_t clevo_xsm_wave_interval_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", wave_interval_ms);
+}
+
+static ssize_t clevo_xsm_wave_interval_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t size)
+{
+	unsigned int val;
+	
+	if (kstrtouint(buf, 10, &val))
+		return -EINVAL;
+	
+	/* Minimum interval: 10ms */
+	if (val < 10) val = 10;
+	
+	wave_interval_ms = val;
+	wave_period_ms = 0;
+	
+	return size;
+}
+static DEVICE_ATTR(kb_wave_interval, 0644,
+	clevo_xsm_wave_interval_show, clevo_xsm_wave_interval_store);
+
+static ssize_t clevo_xsm_wave_colors_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	ssize_t len = 0;
+	unsigned int i;
+	
+	for (i = 0; i < wave_num_colors; i++) {
+		if (i > 0)
+			len += sprintf(buf + len, " ");
+		len += sprintf(buf + len, "%06X", wave_color_values[i]);
+	}
+	len += sprintf(buf + len, "\n");
+	return len;
+}
+
+static ssize_t clevo_xsm_wave_colors_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t size)
+{
+	u32 new_colors[WAVE_MAX_COLORS];
+	unsigned int count = 0;
+	const char *p = buf;
+	bool parked;
+	
+	while (*p && count < WAVE_MAX_COLORS) {
+		const char *start;
+		char token[16];
+		int len;
+		unsigned int val;
+		
+		/* Skip whitespace */
+		while (*p == ' ' || *p == '\t' || *p == '\n')
+			p++;
+		
+		if (*p == '\0')
+			break;
+		
+		/* Find end of token */
+		start = p;
+		while (*p && *p != ' ' && *p != '\t' && *p != '\n')
+			p++;
+		
+		len = p - start;
+		if (len <= 0 || len >= (int)sizeof(token))
+			continue;
+		
+		/* Copy token to null-terminated buffer */
+		memcpy(token, start, len);
+		token[len] = '\0';
+		
+		/* Parse hex value */
+		if (kstrtouint(token, 16, &val))
+			continue;
+		
+		new_colors[count++] = val & 0xFFFFFF;
+	}
+	
+	if (count == 0)
+		return -EINVAL;
+	
+	/* Apply atomically */
+	mutex_lock(&kb_fx_lock);
+	parked = kb_fx_park();
+	memcpy(wave_color_values, new_colors, count * sizeof(u32));
+	wave_num_colors = count;
+	wave_rebuild_fade();
+
+	/* Reset color index if it's out of bounds */
+	if (wave_color_idx >= wave_num_colors)
+		wave_color_idx = 0;
+	kb_fx_unpark(parked);
+	mutex_unlock(&kb_fx_lock);
+	
+	return size;
+}
+static DEVICE_ATTR(kb_wave_colors, 0644,
+	clevo_xsm_wave_colors_show, clevo_xsm_wave_colors_store);
+
+static ssize_t clevo_xsm_color_triplet_show(char *buf, const unsigned int *v)
+{
+	return sprintf(buf, "%u %u %u\n", v[0], v[1], v[2]);
+}
+
+static int clevo_xsm_color_triplet_parse(const char *buf, unsigned int *v,
+	unsigned int min, unsigned int max)
+{
+	unsigned int r, g, b;
+
+	if (sscanf(buf, "%u %u %u", &r, &g, &b) != 3)
+		return -EINVAL;
+
+	if (r < min || r > max || g < min || g > max || b < min || b > max)
+		return -EINVAL;
+
+	v[0] = r;
+	v[1] = g;
+	v[2] = b;
+
+	return 0;
+}
+
+/* kb_color_gamma sysfs - "R G B" gamma x100, 100 = linear */
+static ssize_t clevo_xsm_color_gamma_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	return clevo_xsm_color_triplet_show(buf, kb_color_gamma);
+}
+
+static ssize_t clevo_xsm_color_gamma_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t size)
+{
+	bool parked;
+	int err;
+
+	mutex_lock(&kb_fx_lock);
+	parked = kb_fx_park();
+	err = clevo_xsm_color_triplet_parse(buf, kb_color_gamma, 10, 500);
+	if (!err) {
+		kb_fx_rebuild_lut();
+		wave_rebuild_fade();
+	}
+	kb_fx_unpark(parked);
+	mutex_unlock(&kb_fx_lock);
+
+	return err ? err : size;
+}
+static DEVICE_ATTR(kb_color_gamma, 0644,
+	clevo_xsm_color_gamma_show, clevo_xsm_color_gamma_store);
+
+/* kb_color_calibration sysfs - "R G B" channel scale, 255 = full */
+static ssize_t clevo_xsm_color_calibration_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	return clevo_xsm_color_triplet_show(buf, kb_color_cal);
+}
+
+static ssize_t clevo_xsm_color_calibration_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t size)
+{
+	bool parked;
+	int err;
+
+	mutex_lock(&kb_fx_lock);
+	parked = kb_fx_park();
+	err = clevo_xsm_color_triplet_parse(buf, kb_color_cal, 0, 255);
+	if (!err) {
+		kb_fx_rebuild_lut();
+		wave_rebuild_fade();
+	}
+	kb_fx_unpark(parked);
+	mutex_unlock(&kb_fx_lock);
+
+	return err ? err : size;
+}
+static DEVICE_ATTR(kb_color_calibration, 0644,
+	clevo_xsm_color_calibration_show, clevo_xsm_color_calibration_store);
+
+static void start_led_mode(int mode)
+{
+	bool from_stream;
+
+	mutex_lock(&kb_fx_lock);
+	kb_fx_stop();
+	mutex_lock(&kb_backlight_lock);
+	
+	/* Zone wave, reactive and stream leave other colors behind, put the user's back */
+	if ((current_led_mode == LED_MODE_ZONE_WAVE ||
+		current_led_mode == LED_MODE_REACTIVE ||
+		current_led_mode == LED_MODE_STREAM) && kb_backlight.ops)
+		kb_restore_colors();
+
+	/* Stream frames can carry a raw brightness as well */
+	from_stream = current_led_mode == LED_MODE_STREAM && kb_backlight.ops;
+	if (from_stream) {
+		if (kb_backlight.ops->set_brightness_raw)
+			kb_backlight.ops->set_brightness_raw(
+				kb_backlight.brightness_raw);
+		kb_backlight.ops->set_state(kb_backlight.state);
+	}
+	
+	current_led_mode = mode;
+	kb_react_reset(mode == LED_MODE_REACTIVE);
+	
+	switch (mode) {
+	case LED_MODE_WAVE:
+		wave_start();
+		break;
+	case LED_MODE_BREATH:
+	case LED_MODE_BLINK:
+	case LED_MODE_REACTIVE:
+		kb_fx_start(kb_fx_builtin[mode]);
+		break;
+	case LED_MODE_ZONE_WAVE:
+		zone_wave_zones = kb_backlight.extra == KB_HAS_EXTRA_TRUE ?
+			KB_FX_MAX_ZONES : KB_FX_ZONES;
+		zone_wave_acc = 0;
+		kb_fx_set_level(KB_FX_LEVEL_MAX);
+		kb_fx_start(kb_fx_builtin[mode]);
+		break;
+	case LED_MODE_STREAM:
+		kb_stream.zones = kb_backlight.extra == KB_HAS_EXTRA_TRUE ?
+			KB_FX_MAX_ZONES : KB_FX_ZONES;
+		kb_stream.idle_ns = 0;
+		kb_fx_start(kb_fx_builtin[mode]);
+		break;
+	case LED_MODE_STATIC:
+	default:
+		/* Keep the brightness the stream just put back */
+		if (!from_stream)
+			kb_fx_set_level(KB_FX_LEVEL_MAX);
+		break;
+	}
+	mutex_unlock(&kb_backlight_lock);
+	mutex_unlock(&kb_fx_lock);
+
+	/* Writers blocked on a full ring fail once the stream is gone */
+	wake_up_interruptible(&kb_stream.space);
+
+	kb_attr_changed();
+}
+
+/* kb_led_mode sysfs - select LED effect mode */
+static ssize_t clevo_xsm_led_mode_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	const char *mode_names[] = {"static", "wave", "breath", "blink",
+		"zone_wave", "reactive", "stream"};
+	return sprintf(buf, "%d (%s)\n", current_led_mode, 
+		mode_names[current_led_mode % ARRAY_SIZE(mode_names)]);
+}
+
+static ssize_t clevo_xsm_led_mode_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t size)
 {
 	unsigned int val;
 	
-	if (kstrtouint(buf, 10, &val))
+	/* Accept number or name */
+	if (strncmp(buf, "static", 6) == 0)
+		val = LED_MODE_STATIC;
+	else if (strncmp(buf, "wave", 4) == 0)
+		val = LED_MODE_WAVE;
+	else if (strncmp(buf, "breath", 6) == 0)
+		val = LED_MODE_BREATH;
+	else if (strncmp(buf, "blink", 5) == 0)
+		val = LED_MODE_BLINK;
+	else if (strncmp(buf, "zone_wave", 9) == 0)
+		val = LED_MODE_ZONE_WAVE;
+	else if (strncmp(buf, "reactive", 8) == 0)
+		val = LED_MODE_REACTIVE;
+	else if (kstrtouint(buf, 10, &val))
 		return -EINVAL;
 	
-	/* Minimum period: roughly 200ms (10ms interval) */
-	if (val < 200) val = 200;
+	if (val > LED_MODE_REACTIVE)
+		return -EINVAL;
 	
-	wave_interval_ms = val / NUM_WAVE_STEPS;
-	if (wave_interval_ms < 10) wave_interval_ms = 10;
+	start_led_mode(val);
 	
 	return size;
 }
-static DEVICE_ATTR(kb_wave_period, 0644,
-	clevo_xsm_wave_period_show, clevo_xsm_wave_period_store);
+static DEVICE_ATTR(kb_led_mode, 0644,
+	clevo_xsm_led_mode_show, clevo_xsm_led_mode_store);
+
+/*
+ * Frame streaming device, see clevo_kb.h
+ *
+ * Opening /dev/clevo_kb selects the stream LED mode and closing it puts
+ * the previous mode back, unless another one was selected in between.
+ * The ring lives as long as the open file; a mapping holds a reference
+ * to the file, so the ring never goes away under it.
+ */
+static bool kb_stream_full(void)
+{
+	return READ_ONCE(kb_stream.ring->head) -
+		smp_load_acquire(&kb_stream.tail) >= CLEVO_KB_RING_FRAMES;
+}
+
+static bool kb_stream_active(void)
+{
+	return READ_ONCE(current_led_mode) == LED_MODE_STREAM;
+}
+
+static int kb_stream_open(struct inode *inode, struct file *file)
+{
+	struct clevo_kb_ring *ring;
+
+	/* Frames are RGB per zone with a raw brightness */
+	if (!kb_backlight.ops || !kb_backlight.ops->set_zone_rgb ||
+		!kb_backlight.ops->set_brightness_raw || !kb_fx.worker)
+		return -ENODEV;
+
+	if (test_and_set_bit_lock(0, &kb_stream.busy))
+		return -EBUSY;
+
+	ring = vmalloc_user(sizeof(*ring));
+	if (!ring) {
+		clear_bit_unlock(0, &kb_stream.busy);
+		return -ENOMEM;
+	}
+
+	kb_stream.ring = ring;
+	kb_stream.tail = 0;
+	kb_stream.dropped = 0;
+	kb_stream.sleeping = false;
+	kb_stream.prev_mode = READ_ONCE(current_led_mode);
+	start_led_mode(LED_MODE_STREAM);
+
+	return nonseekable_open(inode, file);
+}
+
+static int kb_stream_release(struct inode *inode, struct file *file)
+{
+	bool active;
+
+	mutex_lock(&kb_fx_lock);
+	active = current_led_mode == LED_MODE_STREAM;
+	mutex_unlock(&kb_fx_lock);
+
+	/* Stops the effect, after that the worker is done with the ring */
+	if (active)
+		start_led_mode(kb_stream.prev_mode);
+
+	vfree(kb_stream.ring);
+	kb_stream.ring = NULL;
+	clear_bit_unlock(0, &kb_stream.busy);
+
+	return 0;
+}
+
+/* Whole frames only, a zero length write just wakes the effect */
+static ssize_t kb_stream_write(struct file *file, const char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	struct clevo_kb_ring *ring = kb_stream.ring;
+	size_t done = 0;
+	u32 head;
+	int err = 0;
+
+	if (count % sizeof(struct clevo_kb_frame))
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&kb_stream.write_lock))
+		return -ERESTARTSYS;
+
+	while (done < count) {
+		if (!kb_stream_active()) {
+			err = -EBUSY;
+			break;
+		}
+
+		if (kb_stream_full()) {
+			if (file->f_flags & O_NONBLOCK) {
+				err = -EAGAIN;
+				break;
+			}
+			kb_stream_kick();
+			err = wait_event_interruptible(kb_stream.space,
+				!kb_stream_full() || !kb_stream_active());
+			if (err)
+				break;
+			continue;
+		}
+
+		head = READ_ONCE(ring->head);
+		if (copy_from_user(&ring->frames[head % CLEVO_KB_RING_FRAMES],
+			buf + done, sizeof(struct clevo_kb_frame))) {
+			err = -EFAULT;
+			break;
+		}
+		smp_store_release(&ring->head, head + 1);
+		done += sizeof(struct clevo_kb_frame);
+	}
+
+	mutex_unlock(&kb_stream.write_lock);
+
+	kb_stream_kick();
+
+	return done ? done : err;
+}
+
+static __poll_t kb_stream_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &kb_stream.space, wait);
+
+	if (!kb_stream_active())
+		return EPOLLERR;
+
+	return kb_stream_full() ? 0 : EPOLLOUT | EPOLLWRNORM;
+}
+
+static int kb_stream_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	if (vma->vm_pgoff)
+		return -EINVAL;
+
+	return remap_vmalloc_range(vma, kb_stream.ring, 0);
+}
+
+static const struct file_operations kb_stream_fops = {
+	.owner = THIS_MODULE,
+	.open = kb_stream_open,
+	.release = kb_stream_release,
+	.write = kb_stream_write,
+	.poll = kb_stream_poll,
+	.mmap = kb_stream_mmap,
+};
+
+static struct miscdevice kb_stream_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "clevo_kb",
+	.fops = &kb_stream_fops,
+};
+
+static int __init kb_stream_init(void)
+{
+	int err;
+
+	mutex_init(&kb_stream.write_lock);
+	init_waitqueue_head(&kb_stream.space);
+	spin_lock_init(&kb_stream.lock);
+
+	if (!kb_fx.worker)
+		return -ENODEV;
+
+	err = misc_register(&kb_stream_misc);
+	if (!err)
+		kb_stream.registered = true;
+
+	return err;
+}
+
+/* Nobody has the device open, it holds a module reference */
+static void kb_stream_exit(void)
+{
+	if (kb_stream.registered)
+		misc_deregister(&kb_stream_misc);
+	kb_stream.registered = false;
+}
+
+/* Fan Control Mode: 0=auto, 1=max, 2=custom (curve), 3=manual (pwm1) */
+#define FAN_MODE_AUTO   0
+#define FAN_MODE_MAX    1
+#define FAN_MODE_CUSTOM 2
+#define FAN_MODE_MANUAL 3
+
+static int fan_control_mode = FAN_MODE_AUTO;
+/* Duty used in manual mode; 0x00 means auto to the EC, so never below 1 */
+static u8 fan_pwm = 0x80;
+/* Serializes 0xCE writes between mode changes and the curve engine */
+static DEFINE_MUTEX(clevo_fan_lock);
+
+static void clevo_fan_curve_start(void);
+
+static void set_fan_mode(int mode)
+{
+	mutex_lock(&clevo_fan_lock);
+	fan_control_mode = mode;
+	
+	switch (mode) {
+	case FAN_MODE_MAX:
+		/* Set fans to max speed - EC register 0xCE controls fan duty */
+		/* Write 0xFF (100%) to force max speed */
+		clevo_xsm_ec_write(0xCE, 0xFF);
+		break;
+	case FAN_MODE_CUSTOM:
+		clevo_fan_curve_start();
+		break;
+	case FAN_MODE_MANUAL:
+		clevo_xsm_ec_write(0xCE, fan_pwm);
+		break;
+	case FAN_MODE_AUTO:
+	default:
+		/* Restore auto control - write 0x00 to let EC manage */
+		clevo_xsm_ec_write(0xCE, 0x00);
+		break;
+	}
+	mutex_unlock(&clevo_fan_lock);
+
+	kb_attr_changed();
+}
+
+static ssize_t clevo_xsm_fan_mode_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	const char *mode_names[] = {"auto", "max", "custom", "manual"};
+	return sprintf(buf, "%d (%s)\n", fan_control_mode,
+		mode_names[fan_control_mode % 4]);
+}
+
+static ssize_t clevo_xsm_fan_mode_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t size)
+{
+	unsigned int val;
+	
+	if (strncmp(buf, "auto", 4) == 0)
+		val = FAN_MODE_AUTO;
+	else if (strncmp(buf, "max", 3) == 0)
+		val = FAN_MODE_MAX;
+	else if (strncmp(buf, "custom", 6) == 0)
+		val = FAN_MODE_CUSTOM;
+	else if (strncmp(buf, "manual", 6) == 0)
+		val = FAN_MODE_MANUAL;
+	else if (kstrtouint(buf, 10, &val))
+		return -EINVAL;
+	
+	if (val > FAN_MODE_MANUAL)
+		return -EINVAL;
+	
+	set_fan_mode(val);
+	return size;
+}
+static DEVICE_ATTR(fan_control, 0644,
+	clevo_xsm_fan_mode_show, clevo_xsm_fan_mode_store);
+
+/* Power Profile: 0=performance, 1=entertainment, 2=power_saving, 3=quiet */
+#define PROFILE_PERFORMANCE   0
+#define PROFILE_ENTERTAINMENT 1
+#define PROFILE_POWER_SAVING  2
+#define PROFILE_QUIET         3
+
+static int power_profile = PROFILE_POWER_SAVING;
+
+static void set_power_profile(int profile)
+{
+	power_profile = profile;
+	
+	/* Power profile affects fan behavior and possibly CPU limits */
+	/* Using WMI method 0x67 with profile-specific commands */
+	switch (profile) {
+	case PROFILE_PERFORMANCE:
+		/* High performance - max fans, no throttling */
+		clevo_xsm_kb_led_write(0xA3000000);
+		set_fan_mode(FAN_MODE_MAX);
+		break;
+	case PROFILE_ENTERTAINMENT:
+		/* Balanced - moderate fans */
+		clevo_xsm_kb_led_write(0xA3000001);
+		set_fan_mode(FAN_MODE_AUTO);
+		break;
+	case PROFILE_POWER_SAVING:
+		/* Power saving - reduced performance */
+		clevo_xsm_kb_led_write(0xA3000002);
+		set_fan_mode(FAN_MODE_AUTO);
+		break;
+	case PROFILE_QUIET:
+		/* Quiet - minimal fan noise */
+		clevo_xsm_kb_led_write(0xA3000003);
+		set_fan_mode(FAN_MODE_AUTO);
+		break;
+	}
+
+	kb_attr_changed();
+}
 
-static ssize_t clevo_xsm_wave_interval_show(struct device *dev,
+static ssize_t clevo_xsm_power_profile_show(struct device *dev,
 	struct device_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%d\n", wave_interval_ms);
+	const char *profile_names[] = {"performance", "entertainment", 
+		"power_saving", "quiet"};
+	return sprintf(buf, "%d (%s)\n", power_profile,
+		profile_names[power_profile % 4]);
 }
 
-static ssize_t clevo_xsm_wave_interval_store(struct device *dev,
+static ssize_t clevo_xsm_power_profile_store(struct device *dev,
 	struct device_attribute *attr, const char *buf, size_t size)
 {
 	unsigned int val;
 	
-	if (kstrtouint(buf, 10, &val))
+	if (strncmp(buf, "performance", 11) == 0)
+		val = PROFILE_PERFORMANCE;
+	else if (strncmp(buf, "entertainment", 13) == 0)
+		val = PROFILE_ENTERTAINMENT;
+	else if (strncmp(buf, "power_saving", 12) == 0)
+		val = PROFILE_POWER_SAVING;
+	else if (strncmp(buf, "quiet", 5) == 0)
+		val = PROFILE_QUIET;
+	else if (kstrtouint(buf, 10, &val))
 		return -EINVAL;
 	
-	/* Minimum interval: 10ms */
-	if (val < 10) val = 10;
-	
-	wave_interval_ms = val;
+	if (val > PROFILE_QUIET)
+		return -EINVAL;
 	
+	set_power_profile(val);
 	return size;
 }
-static DEVICE_ATTR(kb_wave_interval, 0644,
-	clevo_xsm_wave_interval_show, clevo_xsm_wave_interval_store);
+static DEVICE_ATTR(power_profile, 0644,
+	clevo_xsm_power_profile_show, clevo_xsm_power_profile_store);
 
-static ssize_t clevo_xsm_wave_colors_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
+/*
+ * Attribute change notification
+ *
+ * kb_attr_changed() queues kb_notify.work, which compares the attributes
+ * below with the values it last reported and calls sysfs_notify() on the
+ * ones that differ. Userspace can then poll() them (POLLPRI, then re-read
+ * from offset 0) no matter who made the change: a store, a hotkey, an
+ * effect or a power profile switch.
+ */
+
+enum kb_notify_attr {
+	KB_NOTIFY_BRIGHTNESS,
+	KB_NOTIFY_COLOR,
+	KB_NOTIFY_STATE,
+	KB_NOTIFY_MODE,
+	KB_NOTIFY_LED_MODE,
+	KB_NOTIFY_FAN_CONTROL,
+	KB_NOTIFY_POWER_PROFILE,
+	KB_NOTIFY_MAX,
+};
+
+static const char * const kb_notify_names[KB_NOTIFY_MAX] = {
+	[KB_NOTIFY_BRIGHTNESS]    = "kb_brightness",
+	[KB_NOTIFY_COLOR]         = "kb_color",
+	[KB_NOTIFY_STATE]         = "kb_state",
+	[KB_NOTIFY_MODE]          = "kb_mode",
+	[KB_NOTIFY_LED_MODE]      = "kb_led_mode",
+	[KB_NOTIFY_FAN_CONTROL]   = "fan_control",
+	[KB_NOTIFY_POWER_PROFILE] = "power_profile",
+};
+
+static struct {
+	struct work_struct work;
+	u32 last[KB_NOTIFY_MAX];
+	bool ready;
+} kb_notify;
+
+static u32 kb_notify_value(enum kb_notify_attr attr)
 {
-	ssize_t len = 0;
-	unsigned int i;
-	
-	for (i = 0; i < wave_num_colors; i++) {
-		if (i > 0)
-			len += sprintf(buf + len, " ");
-		len += sprintf(buf + len, "%06X", wave_color_values[i]);
+	switch (attr) {
+	case KB_NOTIFY_BRIGHTNESS:
+		return kb_backlight.brightness;
+	case KB_NOTIFY_COLOR:
+		/* Any change of a zone's 0xRRGGBB changes this */
+		return kb_zone_rgb(0) ^ rol32(kb_zone_rgb(1), 8) ^
+			rol32(kb_zone_rgb(2), 16) ^ rol32(kb_zone_rgb(3), 24);
+	case KB_NOTIFY_STATE:
+		return kb_backlight.state;
+	case KB_NOTIFY_MODE:
+		return kb_backlight.mode;
+	case KB_NOTIFY_LED_MODE:
+		return READ_ONCE(current_led_mode);
+	case KB_NOTIFY_FAN_CONTROL:
+		return READ_ONCE(fan_control_mode);
+	case KB_NOTIFY_POWER_PROFILE:
+		return READ_ONCE(power_profile);
+	default:
+		return 0;
 	}
-	len += sprintf(buf + len, "\n");
-	return len;
 }
 
-static ssize_t clevo_xsm_wave_colors_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
+static void kb_notify_work_fn(struct work_struct *work)
 {
-	u32 new_colors[WAVE_MAX_COLORS];
-	unsigned int count = 0;
-	const char *p = buf;
-	
-	while (*p && count < WAVE_MAX_COLORS) {
-		const char *start;
-		char token[16];
-		int len;
-		unsigned int val;
-		
-		/* Skip whitespace */
-		while (*p == ' ' || *p == '\t' || *p == '\n')
-			p++;
-		
-		if (*p == '\0')
-			break;
-		
-		/* Find end of token */
-		start = p;
-		while (*p && *p != ' ' && *p != '\t' && *p != '\n')
-			p++;
-		
-		len = p - start;
-		if (len <= 0 || len >= (int)sizeof(token))
-			continue;
-		
-		/* Copy token to null-terminated buffer */
-		memcpy(token, start, len);
-		token[len] = '\0';
-		
-		/* Parse hex value */
-		if (kstrtouint(token, 16, &val))
+	u32 val[KB_NOTIFY_MAX];
+	int i;
+
+	mutex_lock(&kb_backlight_lock);
+	for (i = 0; i < KB_NOTIFY_MAX; i++)
+		val[i] = kb_notify_value(i);
+	mutex_unlock(&kb_backlight_lock);
+
+	for (i = 0; i < KB_NOTIFY_MAX; i++) {
+		if (val[i] == kb_notify.last[i])
 			continue;
-		
-		new_colors[count++] = val & 0xFFFFFF;
+
+		kb_notify.last[i] = val[i];
+		sysfs_notify(&clevo_xsm_platform_device->dev.kobj, NULL,
+			kb_notify_names[i]);
 	}
-	
-	if (count == 0)
-		return -EINVAL;
-	
-	/* Apply atomically */
-	memcpy(wave_color_values, new_colors, count * sizeof(u32));
-	wave_num_colors = count;
-	
-	/* Reset color index if it's out of bounds */
-	if (wave_color_idx >= wave_num_colors)
-		wave_color_idx = 0;
-	
-	return size;
 }
-static DEVICE_ATTR(kb_wave_colors, 0644,
-	clevo_xsm_wave_colors_show, clevo_xsm_wave_colors_store);
 
-/* LED Mode definitions - matching CC30 */
-#define LED_MODE_STATIC  0
-#define LED_MODE_WAVE    1
-#define LED_MODE_BREATH  2
-#define LED_MODE_BLINK   3
+static void kb_attr_changed(void)
+{
+	if (READ_ONCE(kb_notify.ready))
+		schedule_work(&kb_notify.work);
+}
 
-static int current_led_mode = LED_MODE_STATIC;
-static struct delayed_work breath_work;
-static struct delayed_work blink_work;
-static bool breath_running = false;
-static bool blink_running = false;
-static unsigned int breath_step = 0;
-static unsigned int blink_state = 0;
-
-/* Breath effect - fade in/out without color change */
-static void breath_work_handler(struct work_struct *work)
-{
-	static const u8 breath_levels[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 8, 7, 6, 5, 4, 3, 2, 1};
-	#define NUM_BREATH_STEPS 18
-	
-	if (!breath_running)
+/* call once the attributes exist */
+static void __init kb_notify_init(void)
+{
+	int i;
+
+	INIT_WORK(&kb_notify.work, kb_notify_work_fn);
+	mutex_lock(&kb_backlight_lock);
+	for (i = 0; i < KB_NOTIFY_MAX; i++)
+		kb_notify.last[i] = kb_notify_value(i);
+	mutex_unlock(&kb_backlight_lock);
+
+	WRITE_ONCE(kb_notify.ready, true);
+}
+
+static void kb_notify_exit(void)
+{
+	if (!kb_notify.ready)
 		return;
-	
-	wave_set_brightness_direct(breath_levels[breath_step]);
-	
-	breath_step++;
-	if (breath_step >= NUM_BREATH_STEPS)
-		breath_step = 0;
-	
-	if (breath_running)
-		queue_delayed_work(wave_workqueue, &breath_work, msecs_to_jiffies(100));
+
+	WRITE_ONCE(kb_notify.ready, false);
+	cancel_work_sync(&kb_notify.work);
 }
 
-/* Blink effect - flash on/off */
-static void blink_work_handler(struct work_struct *work)
+/*
+ * Sensor sampler
+ *
+ * All fan and temperature registers are read back to back in one pass
+ * every sensor_interval_ms and published under a seqlock. Readers such as
+ * hwmon get the cached snapshot and never touch the EC, however many of
+ * them poll at once. Every value carries the time it was read. The pass
+ * is a single posted command on the command queue, so the sampler never
+ * waits for the worker; the fan curve follows each new snapshot from
+ * clevo_fan_curve_work.
+ */
+#define CLEVO_SENSOR_FANS  2
+#define CLEVO_SENSOR_TEMPS 2
+
+struct clevo_sensor_value {
+	int value;     /* rpm or degrees C */
+	int err;
+	u64 time_ns;   /* ktime_get_ns() when read */
+};
+
+struct clevo_sensor_snapshot {
+	struct clevo_sensor_value fan[CLEVO_SENSOR_FANS];
+	struct clevo_sensor_value temp[CLEVO_SENSOR_TEMPS];
+	u64 samples;
+};
+
+static const u8 clevo_sensor_temp_reg[CLEVO_SENSOR_TEMPS] = {
+	0x07,  /* CPU */
+	0xCD,  /* GPU */
+};
+
+static DEFINE_SEQLOCK(clevo_sensor_lock);
+static struct clevo_sensor_snapshot clevo_sensor_snap;
+static struct delayed_work clevo_sensor_work;
+static struct work_struct clevo_fan_curve_work;
+
+/* Runs on the command queue worker */
+static void clevo_sensor_read_fan(int idx, struct clevo_sensor_value *v)
 {
-	if (!blink_running)
+	u8 hi, lo;
+	int raw_rpm;
+
+	v->err = __clevo_xsm_ec_read(0xD0 + 0x2 * idx, &hi, _THIS_IP_);
+	if (!v->err)
+		v->err = __clevo_xsm_ec_read(0xD1 + 0x2 * idx, &lo, _THIS_IP_);
+	v->time_ns = ktime_get_ns();
+
+	if (v->err)
 		return;
-	
-	if (blink_state) {
-		wave_set_brightness_direct(9);  /* Off (dim) */
-		blink_state = 0;
-	} else {
-		wave_set_brightness_direct(0);  /* On (bright) */
-		blink_state = 1;
+
+	raw_rpm = hi << 8 | lo;
+	v->value = raw_rpm ? 2156220 / raw_rpm : 0;
+}
+
+/* Runs on the command queue worker, see clevo_sensor_sample() */
+static void clevo_sensor_sample_fn(void)
+{
+	struct clevo_sensor_snapshot snap;
+	u8 value;
+	int i;
+
+	for (i = 0; i < CLEVO_SENSOR_FANS; i++)
+		clevo_sensor_read_fan(i, &snap.fan[i]);
+
+	for (i = 0; i < CLEVO_SENSOR_TEMPS; i++) {
+		snap.temp[i].err = __clevo_xsm_ec_read(clevo_sensor_temp_reg[i],
+			&value, _THIS_IP_);
+		snap.temp[i].time_ns = ktime_get_ns();
+		snap.temp[i].value = snap.temp[i].err ? 0 : value;
 	}
-	
-	if (blink_running)
-		queue_delayed_work(wave_workqueue, &blink_work, msecs_to_jiffies(500));
+
+	write_seqlock(&clevo_sensor_lock);
+	snap.samples = clevo_sensor_snap.samples + 1;
+	clevo_sensor_snap = snap;
+	write_sequnlock(&clevo_sensor_lock);
+
+	/* The curve writes 0xCE through the queue, so not from in here */
+	if (READ_ONCE(fan_control_mode) == FAN_MODE_CUSTOM)
+		schedule_work(&clevo_fan_curve_work);
+}
+
+static void clevo_sensor_sample(void)
+{
+	clevo_cmdq_post_fn(clevo_sensor_sample_fn);
+}
+
+static void clevo_sensor_get(struct clevo_sensor_snapshot *snap)
+{
+	unsigned int seq;
+
+	do {
+		seq = read_seqbegin(&clevo_sensor_lock);
+		*snap = clevo_sensor_snap;
+	} while (read_seqretry(&clevo_sensor_lock, seq));
+}
+
+/*
+ * Fan curve
+ *
+ * In FAN_MODE_CUSTOM every sensor sample maps the hottest of the CPU and
+ * GPU temperature through a piecewise linear curve onto a 0xCE duty. The
+ * temperature only drops once it is fan_hysteresis below the last one
+ * used, the duty moves at most fan_ramp_step per sample and never goes
+ * below fan_min_duty. With no usable temperature the fans go to full speed.
+ */
+#define FAN_CURVE_MAX_POINTS 8
+
+struct clevo_fan_point {
+	u8 temp;   /* degrees C */
+	u8 duty;   /* 0x00 - 0xFF */
+};
+
+static struct {
+	struct clevo_fan_point points[FAN_CURVE_MAX_POINTS];
+	unsigned int npoints;
+	int temp;      /* temperature after hysteresis, -1 = none yet */
+	int target;
+	int duty;      /* last duty written, -1 = none yet */
+	u64 updates;
+	u64 writes;
+	u64 failsafe;
+} clevo_fan_curve = {
+	/* Spins up earlier than the stock EC curve */
+	.points = {
+		{ 40, 0x40 },
+		{ 50, 0x60 },
+		{ 60, 0x90 },
+		{ 70, 0xC0 },
+		{ 80, 0xFF },
+	},
+	.npoints = 5,
+	.temp = -1,
+	.duty = -1,
+};
+
+static unsigned char fan_hysteresis = 3;
+module_param(fan_hysteresis, byte, 0644);
+MODULE_PARM_DESC(fan_hysteresis, "Fan curve hysteresis in degrees C (default 3)");
+
+static unsigned char fan_ramp_step = 0x20;
+module_param(fan_ramp_step, byte, 0644);
+MODULE_PARM_DESC(fan_ramp_step, "Fan curve maximum duty change per sensor sample (default 32)");
+
+static unsigned char fan_min_duty = 0x30;
+module_param(fan_min_duty, byte, 0644);
+MODULE_PARM_DESC(fan_min_duty, "Fan curve minimum duty, 0-255 (default 48)");
+
+/* Same plausibility check as hwmon channel detection */
+static bool clevo_fan_temp_valid(const struct clevo_sensor_value *v)
+{
+	return !v->err && v->value > 0 && v->value < 0x80;
 }
 
-static void stop_all_effects(void)
+static int clevo_fan_curve_eval(int temp)
 {
-	wave_stop();
-	breath_running = false;
-	blink_running = false;
-	if (wave_workqueue) {
-		cancel_delayed_work_sync(&breath_work);
-		cancel_delayed_work_sync(&blink_work);
+	const struct clevo_fan_point *p = clevo_fan_curve.points;
+	unsigned int n = clevo_fan_curve.npoints;
+	unsigned int i;
+
+	if (temp <= p[0].temp)
+		return p[0].duty;
+
+	for (i = 1; i < n; i++) {
+		if (temp < p[i].temp)
+			return p[i - 1].duty + (p[i].duty - p[i - 1].duty) *
+				(temp - p[i - 1].temp) /
+				(p[i].temp - p[i - 1].temp);
 	}
+
+	return p[n - 1].duty;
 }
 
-static void start_led_mode(int mode)
+/* Called with clevo_fan_lock held */
+static void clevo_fan_curve_update(const struct clevo_sensor_snapshot *snap)
 {
-	stop_all_effects();
-	
-	if (!wave_workqueue)
-		wave_workqueue = create_singlethread_workqueue("kb_wave_wq");
-	
-	current_led_mode = mode;
-	
-	switch (mode) {
-	case LED_MODE_WAVE:
-		wave_start();
-		break;
-	case LED_MODE_BREATH:
-		breath_running = true;
-		breath_step = 0;
-		queue_delayed_work(wave_workqueue, &breath_work, 0);
-		break;
-	case LED_MODE_BLINK:
-		blink_running = true;
-		blink_state = 1;
-		queue_delayed_work(wave_workqueue, &blink_work, 0);
-		break;
-	case LED_MODE_STATIC:
-	default:
-		wave_set_brightness_direct(0);  /* Max brightness */
-		break;
+	int temp = -1, duty, step;
+	int i;
+
+	if (fan_control_mode != FAN_MODE_CUSTOM)
+		return;
+
+	clevo_fan_curve.updates++;
+
+	for (i = 0; i < CLEVO_SENSOR_TEMPS; i++)
+		if (clevo_fan_temp_valid(&snap->temp[i]))
+			temp = max(temp, snap->temp[i].value);
+
+	if (temp < 0) {
+		clevo_fan_curve.failsafe++;
+		clevo_fan_curve.temp = -1;
+		duty = 0xFF;
+	} else {
+		if (clevo_fan_curve.temp < 0 || temp > clevo_fan_curve.temp ||
+		    temp + fan_hysteresis <= clevo_fan_curve.temp)
+			clevo_fan_curve.temp = temp;
+		duty = clevo_fan_curve_eval(clevo_fan_curve.temp);
+		duty = max_t(int, duty, fan_min_duty);
+		duty = max(duty, 1);
+	}
+	clevo_fan_curve.target = duty;
+
+	if (clevo_fan_curve.duty >= 0 && temp >= 0) {
+		step = max_t(int, fan_ramp_step, 1);
+		duty = clamp(duty, clevo_fan_curve.duty - step,
+			clevo_fan_curve.duty + step);
+	}
+
+	if (duty == clevo_fan_curve.duty)
+		return;
+
+	if (!clevo_xsm_ec_write(0xCE, duty)) {
+		clevo_fan_curve.duty = duty;
+		clevo_fan_curve.writes++;
 	}
 }
 
-/* kb_led_mode sysfs - select LED effect mode */
-static ssize_t clevo_xsm_led_mode_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
+/* Called from set_fan_mode() with clevo_fan_lock held */
+static void clevo_fan_curve_start(void)
 {
-	const char *mode_names[] = {"static", "wave", "breath", "blink"};
-	return sprintf(buf, "%d (%s)\n", current_led_mode, 
-		mode_names[current_led_mode % 4]);
+	struct clevo_sensor_snapshot snap;
+
+	clevo_fan_curve.temp = -1;
+	clevo_fan_curve.duty = -1;
+
+	clevo_sensor_get(&snap);
+	clevo_fan_curve_update(&snap);
 }
 
-static ssize_t clevo_xsm_led_mode_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
+static void clevo_fan_curve_work_fn(struct work_struct *work)
 {
-	unsigned int val;
-	
-	/* Accept number or name */
-	if (strncmp(buf, "static", 6) == 0)
-		val = LED_MODE_STATIC;
-	else if (strncmp(buf, "wave", 4) == 0)
-		val = LED_MODE_WAVE;
-	else if (strncmp(buf, "breath", 6) == 0)
-		val = LED_MODE_BREATH;
-	else if (strncmp(buf, "blink", 5) == 0)
-		val = LED_MODE_BLINK;
-	else if (kstrtouint(buf, 10, &val))
-		return -EINVAL;
-	
-	if (val > LED_MODE_BLINK)
+	struct clevo_sensor_snapshot snap;
+
+	clevo_sensor_get(&snap);
+	mutex_lock(&clevo_fan_lock);
+	if (fan_control_mode == FAN_MODE_CUSTOM)
+		clevo_fan_curve_update(&snap);
+	mutex_unlock(&clevo_fan_lock);
+}
+
+static void clevo_sensor_work_fn(struct work_struct *work)
+{
+	clevo_sensor_sample();
+
+	queue_delayed_work(system_power_efficient_wq, &clevo_sensor_work,
+		msecs_to_jiffies(READ_ONCE(param_sensor_interval)));
+}
+
+static void __init clevo_sensor_init(void)
+{
+	INIT_DELAYED_WORK(&clevo_sensor_work, clevo_sensor_work_fn);
+	INIT_WORK(&clevo_fan_curve_work, clevo_fan_curve_work_fn);
+
+	/* First snapshot right away so readers never see an empty one */
+	clevo_sensor_sample();
+	clevo_cmdq_sync();
+	queue_delayed_work(system_power_efficient_wq, &clevo_sensor_work,
+		msecs_to_jiffies(param_sensor_interval));
+}
+
+static void clevo_sensor_exit(void)
+{
+	cancel_delayed_work_sync(&clevo_sensor_work);
+	/* A sample still queued may kick the curve once more */
+	clevo_cmdq_sync();
+	cancel_work_sync(&clevo_fan_curve_work);
+
+	/* Nothing drives a curve or manual duty once we are gone */
+	mutex_lock(&clevo_fan_lock);
+	if (fan_control_mode == FAN_MODE_CUSTOM ||
+	    fan_control_mode == FAN_MODE_MANUAL)
+		clevo_xsm_ec_write(0xCE, 0x00);
+	mutex_unlock(&clevo_fan_lock);
+}
+
+static ssize_t clevo_xsm_fan_curve_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	ssize_t len = 0;
+	unsigned int i;
+
+	mutex_lock(&clevo_fan_lock);
+	for (i = 0; i < clevo_fan_curve.npoints; i++)
+		len += sysfs_emit_at(buf, len, "%s%u:%u", i ? " " : "",
+			clevo_fan_curve.points[i].temp,
+			clevo_fan_curve.points[i].duty);
+	mutex_unlock(&clevo_fan_lock);
+	len += sysfs_emit_at(buf, len, "\n");
+
+	return len;
+}
+
+/*
+ * Takes "temp:duty temp:duty ..." with 1 to FAN_CURVE_MAX_POINTS points,
+ * temperatures in degrees C strictly increasing and duties 0-255.
+ */
+static ssize_t clevo_xsm_fan_curve_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t size)
+{
+	struct clevo_fan_point points[FAN_CURVE_MAX_POINTS];
+	struct clevo_sensor_snapshot snap;
+	unsigned int n = 0, temp, duty;
+	const char *p = buf;
+	int len;
+
+	while (*(p = skip_spaces(p))) {
+		if (n == FAN_CURVE_MAX_POINTS)
+			return -E2BIG;
+		if (sscanf(p, "%u:%u%n", &temp, &duty, &len) != 2)
+			return -EINVAL;
+		if (temp > 127 || duty > 0xFF)
+			return -EINVAL;
+		if (n && temp <= points[n - 1].temp)
+			return -EINVAL;
+		points[n].temp = temp;
+		points[n].duty = duty;
+		n++;
+		p += len;
+	}
+
+	if (!n)
 		return -EINVAL;
-	
-	start_led_mode(val);
-	
+
+	clevo_sensor_get(&snap);
+
+	mutex_lock(&clevo_fan_lock);
+	memcpy(clevo_fan_curve.points, points, n * sizeof(*points));
+	clevo_fan_curve.npoints = n;
+	clevo_fan_curve_update(&snap);
+	mutex_unlock(&clevo_fan_lock);
+
 	return size;
 }
-static DEVICE_ATTR(kb_led_mode, 0644,
-	clevo_xsm_led_mode_show, clevo_xsm_led_mode_store);
+static DEVICE_ATTR(fan_curve, 0644,
+	clevo_xsm_fan_curve_show, clevo_xsm_fan_curve_store);
 
-/* Fan Control Mode: 0=auto, 1=max, 2=custom */
-#define FAN_MODE_AUTO   0
-#define FAN_MODE_MAX    1
-#define FAN_MODE_CUSTOM 2
+#if CLEVO_HAS_HWMON
+static struct device *clevo_hwmon_dev;
 
-static int fan_control_mode = FAN_MODE_AUTO;
+/* Channels found at probe time, see clevo_hwmon_detect() */
+static bool clevo_hwmon_has_fan[CLEVO_SENSOR_FANS];
+static bool clevo_hwmon_has_temp[CLEVO_SENSOR_TEMPS];
 
-static void set_fan_mode(int mode)
+static const char * const clevo_hwmon_fan_labels[CLEVO_SENSOR_FANS] = {
+	"CPU fan",
+	"GPU fan",
+};
+
+static const char * const clevo_hwmon_temp_labels[CLEVO_SENSOR_TEMPS] = {
+	"CPU temperature",
+	"GPU temperature",
+};
+
+/*
+ * The CPU channels always exist. Unused EC registers read back 0 or 0xFF,
+ * so a temperature counts as present when it is plausible, and the GPU fan
+ * when it spins or the GPU temperature is present.
+ */
+static void clevo_hwmon_detect(void)
 {
-	fan_control_mode = mode;
-	
-	switch (mode) {
+	struct clevo_sensor_snapshot snap;
+	int i;
+
+	clevo_sensor_get(&snap);
+
+	for (i = 0; i < CLEVO_SENSOR_TEMPS; i++)
+		clevo_hwmon_has_temp[i] = i == 0 || (!snap.temp[i].err &&
+			snap.temp[i].value > 0 && snap.temp[i].value < 0x80);
+
+	for (i = 0; i < CLEVO_SENSOR_FANS; i++)
+		clevo_hwmon_has_fan[i] = i == 0 || (!snap.fan[i].err &&
+			(snap.fan[i].value || clevo_hwmon_has_temp[i]));
+}
+
+/* pwm1_enable: 0 = full speed, 1 = manual, 2 = automatic (EC), 3 = curve */
+static int clevo_hwmon_pwm_enable(void)
+{
+	switch (fan_control_mode) {
 	case FAN_MODE_MAX:
-		/* Set fans to max speed - EC register 0xCE controls fan duty */
-		/* Write 0xFF (100%) to force max speed */
-		ec_write(0xCE, 0xFF);
-		break;
-	case FAN_MODE_AUTO:
+		return 0;
+	case FAN_MODE_MANUAL:
+		return 1;
+	case FAN_MODE_CUSTOM:
+		return 3;
 	default:
-		/* Restore auto control - write 0x00 to let EC manage */
-		ec_write(0xCE, 0x00);
-		break;
+		return 2;
 	}
 }
 
-static ssize_t clevo_xsm_fan_mode_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
+static umode_t
+clevo_hwmon_is_visible(const void *data, enum hwmon_sensor_types type,
+	u32 attr, int channel)
 {
-	const char *mode_names[] = {"auto", "max", "custom"};
-	return sprintf(buf, "%d (%s)\n", fan_control_mode,
-		mode_names[fan_control_mode % 3]);
+	switch (type) {
+	case hwmon_chip:
+		return 0644;
+	case hwmon_fan:
+		return clevo_hwmon_has_fan[channel] ? 0444 : 0;
+	case hwmon_temp:
+		return clevo_hwmon_has_temp[channel] ? 0444 : 0;
+	case hwmon_pwm:
+		return 0644;
+	default:
+		return 0;
+	}
 }
 
-static ssize_t clevo_xsm_fan_mode_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
+static int
+clevo_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
+	u32 attr, int channel, long *val)
 {
-	unsigned int val;
-	
-	if (strncmp(buf, "auto", 4) == 0)
-		val = FAN_MODE_AUTO;
-	else if (strncmp(buf, "max", 3) == 0)
-		val = FAN_MODE_MAX;
-	else if (strncmp(buf, "custom", 6) == 0)
-		val = FAN_MODE_CUSTOM;
-	else if (kstrtouint(buf, 10, &val))
-		return -EINVAL;
-	
-	if (val > FAN_MODE_CUSTOM)
-		return -EINVAL;
-	
-	set_fan_mode(val);
-	return size;
-}
-static DEVICE_ATTR(fan_control, 0644,
-	clevo_xsm_fan_mode_show, clevo_xsm_fan_mode_store);
-
-/* Power Profile: 0=performance, 1=entertainment, 2=power_saving, 3=quiet */
-#define PROFILE_PERFORMANCE   0
-#define PROFILE_ENTERTAINMENT 1
-#define PROFILE_POWER_SAVING  2
-#define PROFILE_QUIET         3
-
-static int power_profile = PROFILE_POWER_SAVING;
+	struct clevo_sensor_snapshot snap;
+	const struct clevo_sensor_value *v;
 
-static void set_power_profile(int profile)
-{
-	power_profile = profile;
-	
-	/* Power profile affects fan behavior and possibly CPU limits */
-	/* Using WMI method 0x67 with profile-specific commands */
-	switch (profile) {
-	case PROFILE_PERFORMANCE:
-		/* High performance - max fans, no throttling */
-		clevo_xsm_wmi_evaluate_wmbb_method(0x67, 0xA3000000, NULL);
-		set_fan_mode(FAN_MODE_MAX);
-		break;
-	case PROFILE_ENTERTAINMENT:
-		/* Balanced - moderate fans */
-		clevo_xsm_wmi_evaluate_wmbb_method(0x67, 0xA3000001, NULL);
-		set_fan_mode(FAN_MODE_AUTO);
-		break;
-	case PROFILE_POWER_SAVING:
-		/* Power saving - reduced performance */
-		clevo_xsm_wmi_evaluate_wmbb_method(0x67, 0xA3000002, NULL);
-		set_fan_mode(FAN_MODE_AUTO);
-		break;
-	case PROFILE_QUIET:
-		/* Quiet - minimal fan noise */
-		clevo_xsm_wmi_evaluate_wmbb_method(0x67, 0xA3000003, NULL);
-		set_fan_mode(FAN_MODE_AUTO);
-		break;
+	switch (type) {
+	case hwmon_chip:
+		*val = READ_ONCE(param_sensor_interval);
+		return 0;
+	case hwmon_fan:
+		clevo_sensor_get(&snap);
+		v = &snap.fan[channel];
+		if (v->err)
+			return v->err;
+		*val = v->value;
+		return 0;
+	case hwmon_temp:
+		clevo_sensor_get(&snap);
+		v = &snap.temp[channel];
+		if (v->err)
+			return v->err;
+		*val = v->value * 1000;
+		return 0;
+	case hwmon_pwm:
+		if (attr == hwmon_pwm_enable) {
+			*val = clevo_hwmon_pwm_enable();
+			return 0;
+		}
+		switch (fan_control_mode) {
+		case FAN_MODE_MAX:
+			*val = 0xFF;
+			break;
+		case FAN_MODE_CUSTOM:
+			*val = max(READ_ONCE(clevo_fan_curve.duty), 0);
+			break;
+		default:
+			/* In auto mode the EC picks the duty, report the manual one */
+			*val = fan_pwm;
+			break;
+		}
+		return 0;
+	default:
+		return -EOPNOTSUPP;
 	}
 }
 
-static ssize_t clevo_xsm_power_profile_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
+static int
+clevo_hwmon_read_string(struct device *dev, enum hwmon_sensor_types type,
+	u32 attr, int channel, const char **str)
 {
-	const char *profile_names[] = {"performance", "entertainment", 
-		"power_saving", "quiet"};
-	return sprintf(buf, "%d (%s)\n", power_profile,
-		profile_names[power_profile % 4]);
+	switch (type) {
+	case hwmon_fan:
+		*str = clevo_hwmon_fan_labels[channel];
+		return 0;
+	case hwmon_temp:
+		*str = clevo_hwmon_temp_labels[channel];
+		return 0;
+	default:
+		return -EOPNOTSUPP;
+	}
 }
 
-static ssize_t clevo_xsm_power_profile_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
+static int
+clevo_hwmon_write(struct device *dev, enum hwmon_sensor_types type,
+	u32 attr, int channel, long val)
 {
-	unsigned int val;
-	
-	if (strncmp(buf, "performance", 11) == 0)
-		val = PROFILE_PERFORMANCE;
-	else if (strncmp(buf, "entertainment", 13) == 0)
-		val = PROFILE_ENTERTAINMENT;
-	else if (strncmp(buf, "power_saving", 12) == 0)
-		val = PROFILE_POWER_SAVING;
-	else if (strncmp(buf, "quiet", 5) == 0)
-		val = PROFILE_QUIET;
-	else if (kstrtouint(buf, 10, &val))
-		return -EINVAL;
-	
-	if (val > PROFILE_QUIET)
-		return -EINVAL;
-	
-	set_power_profile(val);
-	return size;
+	switch (type) {
+	case hwmon_chip:
+		WRITE_ONCE(param_sensor_interval, clamp_val(val,
+			SENSOR_INTERVAL_MIN, SENSOR_INTERVAL_MAX));
+		return 0;
+	case hwmon_pwm:
+		if (attr == hwmon_pwm_enable) {
+			switch (val) {
+			case 0:
+				set_fan_mode(FAN_MODE_MAX);
+				return 0;
+			case 1:
+				set_fan_mode(FAN_MODE_MANUAL);
+				return 0;
+			case 2:
+				set_fan_mode(FAN_MODE_AUTO);
+				return 0;
+			case 3:
+				set_fan_mode(FAN_MODE_CUSTOM);
+				return 0;
+			default:
+				return -EINVAL;
+			}
+		}
+		if (val < 0 || val > 0xFF)
+			return -EINVAL;
+		fan_pwm = max_t(long, val, 1);
+		if (fan_control_mode == FAN_MODE_MANUAL)
+			set_fan_mode(FAN_MODE_MANUAL);
+		return 0;
+	default:
+		return -EOPNOTSUPP;
+	}
 }
-static DEVICE_ATTR(power_profile, 0644,
-	clevo_xsm_power_profile_show, clevo_xsm_power_profile_store);
 
-#if CLEVO_HAS_HWMON
-struct clevo_hwmon {
-	struct device *dev;
+static const struct hwmon_ops clevo_hwmon_ops = {
+	.is_visible = clevo_hwmon_is_visible,
+	.read = clevo_hwmon_read,
+	.read_string = clevo_hwmon_read_string,
+	.write = clevo_hwmon_write,
+};
+
+static const struct hwmon_channel_info * const clevo_hwmon_info[] = {
+	HWMON_CHANNEL_INFO(chip, HWMON_C_UPDATE_INTERVAL),
+	HWMON_CHANNEL_INFO(fan,
+		HWMON_F_INPUT | HWMON_F_LABEL,
+		HWMON_F_INPUT | HWMON_F_LABEL),
+	HWMON_CHANNEL_INFO(temp,
+		HWMON_T_INPUT | HWMON_T_LABEL,
+		HWMON_T_INPUT | HWMON_T_LABEL),
+	HWMON_CHANNEL_INFO(pwm, HWMON_PWM_INPUT | HWMON_PWM_ENABLE),
+	NULL
 };
 
-static struct clevo_hwmon *clevo_hwmon = NULL;
+static const struct hwmon_chip_info clevo_hwmon_chip_info = {
+	.ops = &clevo_hwmon_ops,
+	.info = clevo_hwmon_info,
+};
 
 static int
-clevo_read_fan(int idx)
+clevo_hwmon_init(struct device *dev)
 {
-	u8 value;
-	int raw_rpm;
-	ec_read(0xd0 + 0x2 * idx, &value);
-	raw_rpm = value << 8;
-	ec_read(0xd1 + 0x2 * idx, &value);
-	raw_rpm += value;
-	if (!raw_rpm)
-		return 0;
-	return 2156220 / raw_rpm;
+	struct device *hwmon;
+
+	clevo_hwmon_detect();
+
+	hwmon = hwmon_device_register_with_info(dev, CLEVO_XSM_DRIVER_NAME,
+		NULL, &clevo_hwmon_chip_info, NULL);
+	if (IS_ERR(hwmon))
+		return PTR_ERR(hwmon);
+
+	clevo_hwmon_dev = hwmon;
+	return 0;
 }
 
-static ssize_t
-clevo_hwmon_show_name(struct device *dev, struct device_attribute *attr,
-			  char *buf)
+static int
+clevo_hwmon_fini(struct device *dev)
 {
-	return sprintf(buf, CLEVO_XSM_DRIVER_NAME "\n");
+	if (!clevo_hwmon_dev)
+		return 0;
+	hwmon_device_unregister(clevo_hwmon_dev);
+	clevo_hwmon_dev = NULL;
+	return 0;
 }
+#endif // CLEVO_HAS_HWMON
 
-static ssize_t
-clevo_hwmon_show_fan1_input(struct device *dev, struct device_attribute *attr,
-				char *buf)
+/* debugfs statistics */
+
+static struct dentry *clevo_xsm_debugfs_dir;
+
+static void clevo_xsm_lat_print(struct seq_file *m, const char *name,
+	const struct clevo_xsm_lat_stats *sum)
 {
-	return sprintf(buf, "%i\n", clevo_read_fan(0));
+	int i;
+
+	seq_printf(m, "%s:\n", name);
+	seq_printf(m, "  calls:  %llu\n", sum->calls);
+	seq_printf(m, "  errors: %llu\n", sum->errors);
+	seq_printf(m, "  latency_ns: min %llu avg %llu max %llu\n",
+		sum->min_ns,
+		sum->calls ? div64_u64(sum->total_ns, sum->calls) : 0,
+		sum->max_ns);
+	seq_printf(m, "  total_ns: %llu\n", sum->total_ns);
+
+	seq_puts(m, "  histogram_us:\n");
+	for (i = 0; i < CLEVO_XSM_LAT_BUCKETS; i++) {
+		if (!sum->hist[i])
+			continue;
+		if (i == 0)
+			seq_printf(m, "    %8s %llu\n", "<1", sum->hist[i]);
+		else if (i == CLEVO_XSM_LAT_BUCKETS - 1)
+			seq_printf(m, "    >=%-6u %llu\n", 1U << (i - 1),
+				sum->hist[i]);
+		else
+			seq_printf(m, "    %8u %llu\n", 1U << (i - 1),
+				sum->hist[i]);
+	}
 }
 
-static ssize_t
-clevo_hwmon_show_fan1_label(struct device *dev, struct device_attribute *attr,
-				char *buf)
+static int clevo_xsm_debugfs_wmi_show(struct seq_file *m, void *v)
 {
-	return sprintf(buf, "CPU fan\n");
+	/* Racy against the worker, a call may show up half accounted */
+	struct clevo_xsm_stats st = clevo_xsm_stats;
+	unsigned long hits, misses;
+	int i;
+
+	clevo_xsm_lat_print(m, "wmbb", &st.wmi);
+
+	seq_puts(m, "methods:\n");
+	for (i = 0; i < CLEVO_XSM_METHOD_MAX; i++) {
+		if (st.wmi_method[i])
+			seq_printf(m, "  %#04x: %llu\n", i, st.wmi_method[i]);
+	}
+
+	seq_puts(m, "kb_led_commands:\n");
+	for (i = 0; i < KB_CMD_MAX; i++)
+		seq_printf(m, "  %-6s %llu\n", clevo_xsm_kb_cmd_names[i],
+			st.kb_cmd[i]);
+
+	spin_lock(&clevo_cmdq.lock);
+	hits = kb_shadow.hits;
+	misses = kb_shadow.misses;
+	spin_unlock(&clevo_cmdq.lock);
+
+	seq_printf(m, "shadow: hits %lu misses %lu\n", hits, misses);
+
+	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(clevo_xsm_debugfs_wmi);
 
-#ifdef EXPERIMENTAL
-static ssize_t
-clevo_hwmon_show_fan2_input(struct device *dev, struct device_attribute *attr,
-				char *buf)
+static int clevo_xsm_debugfs_ec_show(struct seq_file *m, void *v)
 {
-	return sprintf(buf, "%i\n", clevo_read_fan(1));
+	struct clevo_xsm_lat_stats rd = clevo_xsm_stats.ec_read;
+	struct clevo_xsm_lat_stats wr = clevo_xsm_stats.ec_write;
+
+	clevo_xsm_lat_print(m, "ec_read", &rd);
+	clevo_xsm_lat_print(m, "ec_write", &wr);
+
+	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(clevo_xsm_debugfs_ec);
 
-static ssize_t
-clevo_hwmon_show_fan2_label(struct device *dev, struct device_attribute *attr,
-				char *buf)
+static int clevo_xsm_debugfs_cmdq_show(struct seq_file *m, void *v)
 {
-	return sprintf(buf, "GPU fan\n");
+	struct clevo_xsm_lat_stats wait;
+	u64 queued, posted, coalesced, stalls, depth_sum;
+	unsigned int depth, max_depth;
+
+	spin_lock(&clevo_cmdq.lock);
+	depth = kfifo_len(&clevo_cmdq.fifo);
+	max_depth = clevo_cmdq.max_depth;
+	depth_sum = clevo_cmdq.depth_sum;
+	queued = clevo_cmdq.queued;
+	posted = clevo_cmdq.posted;
+	coalesced = clevo_cmdq.coalesced;
+	stalls = clevo_cmdq.stalls;
+	wait = clevo_cmdq.wait;
+	spin_unlock(&clevo_cmdq.lock);
+
+	seq_printf(m, "depth:     %u (max %u avg %llu, size %u)\n", depth,
+		max_depth, queued ? div64_u64(depth_sum, queued) : 0,
+		(unsigned int) kfifo_size(&clevo_cmdq.fifo));
+	seq_printf(m, "queued:    %llu\n", queued);
+	seq_printf(m, "posted:    %llu\n", posted);
+	seq_printf(m, "coalesced: %llu\n", coalesced);
+	seq_printf(m, "stalls:    %llu\n", stalls);
+	clevo_xsm_lat_print(m, "wait", &wait);
+
+	return 0;
 }
-#endif
+DEFINE_SHOW_ATTRIBUTE(clevo_xsm_debugfs_cmdq);
 
-static ssize_t
-clevo_hwmon_show_temp1_input(struct device *dev, struct device_attribute *attr,
-				 char *buf)
+static int clevo_xsm_debugfs_fx_show(struct seq_file *m, void *v)
 {
-	u8 value;
-	ec_read(0x07, &value);
-	return sprintf(buf, "%i\n", value * 1000);
+	struct clevo_xsm_lat_stats jitter, react, stream;
+	u64 frames, missed, presses, coalesced, stream_frames, stream_dropped;
+	unsigned long flags;
+
+	spin_lock_irqsave(&kb_fx.stats_lock, flags);
+	frames = kb_fx.frames;
+	missed = kb_fx.missed;
+	jitter = kb_fx.jitter;
+	spin_unlock_irqrestore(&kb_fx.stats_lock, flags);
+
+	spin_lock_irq(&kb_react.lock);
+	presses = kb_react.presses;
+	coalesced = kb_react.coalesced;
+	react = kb_react.latency;
+	spin_unlock_irq(&kb_react.lock);
+
+	spin_lock(&kb_stream.lock);
+	stream_frames = kb_stream.frames;
+	stream_dropped = kb_stream.frames_dropped;
+	stream = kb_stream.latency;
+	spin_unlock(&kb_stream.lock);
+
+	seq_printf(m, "running: %d\n", READ_ONCE(kb_fx.running));
+	seq_printf(m, "effect:  %s\n", kb_fx.desc ? kb_fx.desc->name : "none");
+	seq_printf(m, "rt:      %d\n", fx_rt_prio);
+	seq_printf(m, "power:   %s, %s\n",
+		READ_ONCE(kb_fx_on_battery) ? "battery" : "ac",
+		kb_fx.frozen ? "static frame" : kb_fx_battery_names[fx_battery]);
+	seq_printf(m, "min_frame_ns: %llu\n", kb_fx_min_frame_ns());
+	seq_printf(m, "hold:   %s%s%s%s\n", kb_fx.hold ? "" : " none",
+		kb_fx.hold & KB_FX_HOLD_IDLE ? " idle" : "",
+		kb_fx.hold & KB_FX_HOLD_LID ? " lid" : "",
+		kb_fx.hold & KB_FX_HOLD_OFF ? " off" : "");
+	seq_printf(m, "idle:    %llu fades, %llu wakes\n",
+		kb_idle.fades, kb_idle.wakes);
+	seq_printf(m, "frames:  %llu\n", frames);
+	seq_printf(m, "missed:  %llu\n", missed);
+	clevo_xsm_lat_print(m, "jitter", &jitter);
+	seq_printf(m, "react:   %llu presses, %llu coalesced\n",
+		presses, coalesced);
+	clevo_xsm_lat_print(m, "react_latency", &react);
+	seq_printf(m, "stream:  %llu frames, %llu dropped\n",
+		stream_frames, stream_dropped);
+	clevo_xsm_lat_print(m, "stream_latency", &stream);
+
+	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(clevo_xsm_debugfs_fx);
 
-static ssize_t
-clevo_hwmon_show_temp1_label(struct device *dev, struct device_attribute *attr,
-				 char *buf)
+static int clevo_xsm_debugfs_hotkey_show(struct seq_file *m, void *v)
 {
-	return sprintf(buf, "CPU temperature\n");
+	struct clevo_xsm_lat_stats latency;
+	u64 notifies, steps, writes;
+	u64 poll_ns, rate;
+	u32 rem;
+
+	mutex_lock(&clevo_xsm_hotkey_lock);
+	poll_ns = clevo_xsm_hotkey_stats.poll_ns;
+	if (clevo_xsm_hotkey_polling)
+		poll_ns += ktime_get_ns() - clevo_xsm_hotkey_stats.poll_start_ns;
+	mutex_unlock(&clevo_xsm_hotkey_lock);
+
+	/* wakeups per 1000 s */
+	rate = poll_ns ? div64_u64(clevo_xsm_hotkey_stats.polls *
+		NSEC_PER_SEC * 1000, poll_ns) : 0;
+
+	seq_printf(m, "source:           %s\n",
+		READ_ONCE(clevo_xsm_hotkey_has_event) ? "wmi-event" : "ec-poll");
+	seq_printf(m, "polling:          %d\n", clevo_xsm_hotkey_polling);
+	seq_printf(m, "poll_interval_ms: %u\n", clevo_xsm_hotkey_poll_ms);
+	seq_printf(m, "polls:            %llu\n", clevo_xsm_hotkey_stats.polls);
+	seq_printf(m, "poll_time_ms:     %llu\n",
+		div_u64(poll_ns, NSEC_PER_MSEC));
+	rate = div_u64_rem(rate, 1000, &rem);
+	seq_printf(m, "poll_rate:        %llu.%03u/s\n", rate, rem);
+	seq_printf(m, "fixed_poll_rate:  %u/s\n", param_poll_freq);
+	seq_printf(m, "events:           %llu\n", clevo_xsm_hotkey_stats.events);
+	seq_printf(m, "presses:          %llu\n", clevo_xsm_hotkey_stats.presses);
+
+	spin_lock(&kb_hotkey.lock);
+	notifies = kb_hotkey.notifies;
+	steps = kb_hotkey.steps;
+	writes = kb_hotkey.writes;
+	latency = kb_hotkey.latency;
+	spin_unlock(&kb_hotkey.lock);
+
+	seq_printf(m, "notifies:         %llu\n", notifies);
+	seq_printf(m, "brightness_steps: %llu\n", steps);
+	seq_printf(m, "brightness_writes: %llu\n", writes);
+	clevo_xsm_lat_print(m, "event_to_led", &latency);
+
+	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(clevo_xsm_debugfs_hotkey);
 
-#ifdef EXPERIMENTAL
-static ssize_t
-clevo_hwmon_show_temp2_input(struct device *dev, struct device_attribute *attr,
-				 char *buf)
+static void clevo_xsm_debugfs_sensor_value(struct seq_file *m,
+	const char *name, const struct clevo_sensor_value *v, u64 now)
 {
-	u8 value;
-	ec_read(0xcd, &value);
-	return sprintf(buf, "%i\n", value * 1000);
+	seq_printf(m, "%-9s %6d err %d age_ms %llu\n", name, v->value, v->err,
+		div_u64(now - v->time_ns, NSEC_PER_MSEC));
 }
 
-static ssize_t
-clevo_hwmon_show_temp2_label(struct device *dev, struct device_attribute *attr,
-				 char *buf)
+static int clevo_xsm_debugfs_sensors_show(struct seq_file *m, void *v)
 {
-	return sprintf(buf, "GPU temperature\n");
+	struct clevo_sensor_snapshot snap;
+	u64 now;
+
+	clevo_sensor_get(&snap);
+	now = ktime_get_ns();
+
+	seq_printf(m, "samples:  %llu\n", snap.samples);
+	seq_printf(m, "interval: %u ms\n", READ_ONCE(param_sensor_interval));
+	clevo_xsm_debugfs_sensor_value(m, "fan1_rpm", &snap.fan[0], now);
+	clevo_xsm_debugfs_sensor_value(m, "fan2_rpm", &snap.fan[1], now);
+	clevo_xsm_debugfs_sensor_value(m, "cpu_temp", &snap.temp[0], now);
+	clevo_xsm_debugfs_sensor_value(m, "gpu_temp", &snap.temp[1], now);
+
+	mutex_lock(&clevo_fan_lock);
+	seq_printf(m, "curve:    %s\n",
+		fan_control_mode == FAN_MODE_CUSTOM ? "active" : "inactive");
+	seq_printf(m, "temp:     %d\n", clevo_fan_curve.temp);
+	seq_printf(m, "target:   %d\n", clevo_fan_curve.target);
+	seq_printf(m, "duty:     %d\n", clevo_fan_curve.duty);
+	seq_printf(m, "updates:  %llu\n", clevo_fan_curve.updates);
+	seq_printf(m, "writes:   %llu\n", clevo_fan_curve.writes);
+	seq_printf(m, "failsafe: %llu\n", clevo_fan_curve.failsafe);
+	mutex_unlock(&clevo_fan_lock);
+
+	return 0;
 }
-#endif
+DEFINE_SHOW_ATTRIBUTE(clevo_xsm_debugfs_sensors);
 
-static SENSOR_DEVICE_ATTR(name, S_IRUGO, clevo_hwmon_show_name, NULL, 0);
-static SENSOR_DEVICE_ATTR(fan1_input, S_IRUGO, clevo_hwmon_show_fan1_input, NULL, 0);
-static SENSOR_DEVICE_ATTR(fan1_label, S_IRUGO, clevo_hwmon_show_fan1_label, NULL, 0);
-#ifdef EXPERIMENTAL
-static SENSOR_DEVICE_ATTR(fan2_input, S_IRUGO, clevo_hwmon_show_fan2_input, NULL, 0);
-static SENSOR_DEVICE_ATTR(fan2_label, S_IRUGO, clevo_hwmon_show_fan2_label, NULL, 0);
-#endif
-static SENSOR_DEVICE_ATTR(temp1_input, S_IRUGO, clevo_hwmon_show_temp1_input, NULL, 0);
-static SENSOR_DEVICE_ATTR(temp1_label, S_IRUGO, clevo_hwmon_show_temp1_label, NULL, 0);
-#ifdef EXPERIMENTAL
-static SENSOR_DEVICE_ATTR(temp2_input, S_IRUGO, clevo_hwmon_show_temp2_input, NULL, 0);
-static SENSOR_DEVICE_ATTR(temp2_label, S_IRUGO, clevo_hwmon_show_temp2_label, NULL, 0);
-#endif
+static void clevo_xsm_stats_reset_fn(void)
+{
+	memset(&clevo_xsm_stats, 0, sizeof(clevo_xsm_stats));
+}
 
+/* Any write clears the counters */
+static ssize_t clevo_xsm_debugfs_reset_write(struct file *file,
+	const char __user *buf, size_t count, loff_t *ppos)
+{
+	unsigned long flags;
 
-static struct attribute *hwmon_default_attributes[] = {
-	&sensor_dev_attr_name.dev_attr.attr,
-	&sensor_dev_attr_fan1_input.dev_attr.attr,
-	&sensor_dev_attr_fan1_label.dev_attr.attr,
-#ifdef EXPERIMENTAL
-	&sensor_dev_attr_fan2_input.dev_attr.attr,
-	&sensor_dev_attr_fan2_label.dev_attr.attr,
-#endif
-	&sensor_dev_attr_temp1_input.dev_attr.attr,
-	&sensor_dev_attr_temp1_label.dev_attr.attr,
-#ifdef EXPERIMENTAL
-	&sensor_dev_attr_temp2_input.dev_attr.attr,
-	&sensor_dev_attr_temp2_label.dev_attr.attr,
-#endif
-	NULL
-};
+	/* Cleared on the worker, the only one updating them */
+	if (clevo_cmdq_post_fn(clevo_xsm_stats_reset_fn))
+		clevo_xsm_stats_reset_fn();
+	else
+		clevo_cmdq_sync();
+
+	spin_lock(&clevo_cmdq.lock);
+	kb_shadow.hits = 0;
+	kb_shadow.misses = 0;
+	clevo_cmdq.queued = 0;
+	clevo_cmdq.posted = 0;
+	clevo_cmdq.coalesced = 0;
+	clevo_cmdq.stalls = 0;
+	clevo_cmdq.depth_sum = 0;
+	clevo_cmdq.max_depth = 0;
+	memset(&clevo_cmdq.wait, 0, sizeof(clevo_cmdq.wait));
+	spin_unlock(&clevo_cmdq.lock);
+
+	spin_lock_irqsave(&kb_fx.stats_lock, flags);
+	kb_fx.frames = 0;
+	kb_fx.missed = 0;
+	memset(&kb_fx.jitter, 0, sizeof(kb_fx.jitter));
+	spin_unlock_irqrestore(&kb_fx.stats_lock, flags);
+
+	spin_lock_irq(&kb_react.lock);
+	kb_react.presses = 0;
+	kb_react.coalesced = 0;
+	memset(&kb_react.latency, 0, sizeof(kb_react.latency));
+	spin_unlock_irq(&kb_react.lock);
+
+	spin_lock(&kb_stream.lock);
+	kb_stream.frames = 0;
+	kb_stream.frames_dropped = 0;
+	memset(&kb_stream.latency, 0, sizeof(kb_stream.latency));
+	spin_unlock(&kb_stream.lock);
+
+	spin_lock(&kb_hotkey.lock);
+	kb_hotkey.notifies = 0;
+	kb_hotkey.steps = 0;
+	kb_hotkey.writes = 0;
+	memset(&kb_hotkey.latency, 0, sizeof(kb_hotkey.latency));
+	spin_unlock(&kb_hotkey.lock);
+
+	mutex_lock(&clevo_fan_lock);
+	clevo_fan_curve.updates = 0;
+	clevo_fan_curve.writes = 0;
+	clevo_fan_curve.failsafe = 0;
+	mutex_unlock(&clevo_fan_lock);
+
+	return count;
+}
 
-static const struct attribute_group hwmon_default_attrgroup = {
-	.attrs = hwmon_default_attributes,
+static const struct file_operations clevo_xsm_debugfs_reset_fops = {
+	.owner = THIS_MODULE,
+	.write = clevo_xsm_debugfs_reset_write,
 };
 
-static int
-clevo_hwmon_init(struct device *dev)
+static void __init clevo_xsm_debugfs_init(void)
 {
-	int ret;
-
-	clevo_hwmon = kzalloc(sizeof(*clevo_hwmon), GFP_KERNEL);
-	if (!clevo_hwmon)
-		return -ENOMEM;
-	clevo_hwmon->dev = hwmon_device_register(dev);
-	if (IS_ERR(clevo_hwmon->dev)) {
-		ret = PTR_ERR(clevo_hwmon->dev);
-		clevo_hwmon->dev = NULL;
-		return ret;
-	}
-
-	ret = sysfs_create_group(&clevo_hwmon->dev->kobj, &hwmon_default_attrgroup);
-	if (ret)
-		return ret;
-	return 0;
+	clevo_xsm_debugfs_dir = debugfs_create_dir(CLEVO_XSM_DRIVER_NAME, NULL);
+
+	debugfs_create_file("wmi", 0444, clevo_xsm_debugfs_dir, NULL,
+		&clevo_xsm_debugfs_wmi_fops);
+	debugfs_create_file("ec", 0444, clevo_xsm_debugfs_dir, NULL,
+		&clevo_xsm_debugfs_ec_fops);
+	debugfs_create_file("cmdq", 0444, clevo_xsm_debugfs_dir, NULL,
+		&clevo_xsm_debugfs_cmdq_fops);
+	debugfs_create_file("fx", 0444, clevo_xsm_debugfs_dir, NULL,
+		&clevo_xsm_debugfs_fx_fops);
+	debugfs_create_file("hotkey", 0444, clevo_xsm_debugfs_dir, NULL,
+		&clevo_xsm_debugfs_hotkey_fops);
+	debugfs_create_file("sensors", 0444, clevo_xsm_debugfs_dir, NULL,
+		&clevo_xsm_debugfs_sensors_fops);
+	debugfs_create_file("reset", 0200, clevo_xsm_debugfs_dir, NULL,
+		&clevo_xsm_debugfs_reset_fops);
 }
 
-static int
-clevo_hwmon_fini(struct device *dev)
+static void __exit clevo_xsm_debugfs_exit(void)
 {
-	if (!clevo_hwmon || !clevo_hwmon->dev)
-		return 0;
-	sysfs_remove_group(&clevo_hwmon->dev->kobj, &hwmon_default_attrgroup);
-	hwmon_device_unregister(clevo_hwmon->dev);
-	kfree(clevo_hwmon);
-	return 0;
+	debugfs_remove_recursive(clevo_xsm_debugfs_dir);
 }
-#endif // CLEVO_HAS_HWMON
 
 /* dmi & init & exit */
 
@@ -2148,12 +6213,33 @@ static int __init clevo_xsm_init(void)
 		return -ENODEV;
 	}
 
+	err = clevo_cmdq_init();
+	if (unlikely(err))
+		return err;
+
+	err = clevo_xsm_wmi_method_init();
+	if (unlikely(err)) {
+		clevo_cmdq_exit();
+		return err;
+	}
+
+	err = kb_hotkey_init();
+	if (unlikely(err)) {
+		clevo_xsm_wmi_method_exit();
+		clevo_cmdq_exit();
+		return err;
+	}
+
 	clevo_xsm_platform_device =
 		platform_create_bundle(&clevo_xsm_platform_driver,
 			clevo_xsm_wmi_probe, NULL, 0, NULL, 0);
 
-	if (unlikely(IS_ERR(clevo_xsm_platform_device)))
+	if (unlikely(IS_ERR(clevo_xsm_platform_device))) {
+		kb_hotkey_exit();
+		clevo_xsm_wmi_method_exit();
+		clevo_cmdq_exit();
 		return PTR_ERR(clevo_xsm_platform_device);
+	}
 
 	err = clevo_xsm_rfkill_init();
 	if (unlikely(err))
@@ -2167,10 +6253,24 @@ static int __init clevo_xsm_init(void)
 	if (unlikely(err))
 		CLEVO_XSM_ERROR("Could not register LED device\n");
 
+	err = kb_led_init();
+	if (unlikely(err))
+		CLEVO_XSM_ERROR("Could not register keyboard backlight LED devices\n");
+
+	kb_store_init();
+
+	if (device_create_file(&clevo_xsm_platform_device->dev,
+		&dev_attr_kb_sync) != 0)
+		CLEVO_XSM_ERROR("Sysfs attribute creation failed for sync\n");
+
 	if (device_create_file(&clevo_xsm_platform_device->dev,
 		&dev_attr_kb_brightness) != 0)
 		CLEVO_XSM_ERROR("Sysfs attribute creation failed for brightness\n");
 
+	if (device_create_file(&clevo_xsm_platform_device->dev,
+		&dev_attr_kb_brightness_raw) != 0)
+		CLEVO_XSM_ERROR("Sysfs attribute creation failed for raw brightness\n");
+
 	if (device_create_file(&clevo_xsm_platform_device->dev,
 		&dev_attr_kb_state) != 0)
 		CLEVO_XSM_ERROR("Sysfs attribute creation failed for state\n");
@@ -2183,8 +6283,19 @@ static int __init clevo_xsm_init(void)
 		&dev_attr_kb_color) != 0)
 		CLEVO_XSM_ERROR("Sysfs attribute creation failed for color\n");
 
-	/* Initialize wave effect */
-	INIT_DELAYED_WORK(&wave_work, wave_work_handler);
+	if (device_create_file(&clevo_xsm_platform_device->dev,
+		&dev_attr_kb_shadow_stats) != 0)
+		CLEVO_XSM_ERROR("Sysfs attribute creation failed for shadow stats\n");
+
+	/* Initialize the effect engine */
+	if (kb_fx_init() != 0)
+		CLEVO_XSM_ERROR("Could not start the LED effect worker\n");
+	kb_fx_power_init();
+	kb_react_init();
+	kb_idle_init();
+	if (kb_stream_init() != 0)
+		CLEVO_XSM_ERROR("Could not register /dev/clevo_kb\n");
+
 	if (device_create_file(&clevo_xsm_platform_device->dev,
 		&dev_attr_kb_wave) != 0)
 		CLEVO_XSM_ERROR("Sysfs attribute creation failed for wave\n");
@@ -2201,56 +6312,94 @@ static int __init clevo_xsm_init(void)
 		&dev_attr_kb_wave_colors) != 0)
 		CLEVO_XSM_ERROR("Sysfs attribute creation failed for wave colors\n");
 
-	/* Initialize breath and blink effects */
-	INIT_DELAYED_WORK(&breath_work, breath_work_handler);
-	INIT_DELAYED_WORK(&blink_work, blink_work_handler);
 	if (device_create_file(&clevo_xsm_platform_device->dev,
 		&dev_attr_kb_led_mode) != 0)
 		CLEVO_XSM_ERROR("Sysfs attribute creation failed for kb_led_mode\n");
+
+	if (device_create_file(&clevo_xsm_platform_device->dev,
+		&dev_attr_kb_color_gamma) != 0)
+		CLEVO_XSM_ERROR("Sysfs attribute creation failed for kb_color_gamma\n");
+
+	if (device_create_file(&clevo_xsm_platform_device->dev,
+		&dev_attr_kb_color_calibration) != 0)
+		CLEVO_XSM_ERROR("Sysfs attribute creation failed for kb_color_calibration\n");
 	
 	/* Fan control and power profile */
 	if (device_create_file(&clevo_xsm_platform_device->dev,
 		&dev_attr_fan_control) != 0)
 		CLEVO_XSM_ERROR("Sysfs attribute creation failed for fan_control\n");
+
+	if (device_create_file(&clevo_xsm_platform_device->dev,
+		&dev_attr_fan_curve) != 0)
+		CLEVO_XSM_ERROR("Sysfs attribute creation failed for fan_curve\n");
 	
 	if (device_create_file(&clevo_xsm_platform_device->dev,
 		&dev_attr_power_profile) != 0)
 		CLEVO_XSM_ERROR("Sysfs attribute creation failed for power_profile\n");
-#ifdef CLEVO_HAS_HWMON
-	clevo_hwmon_init(&clevo_xsm_platform_device->dev);
+	kb_notify_init();
+	clevo_sensor_init();
+#if CLEVO_HAS_HWMON
+	/* clevo_hwmon_dev stays NULL on failure, clevo_hwmon_fini() skips it */
+	if (clevo_hwmon_init(&clevo_xsm_platform_device->dev) != 0)
+		CLEVO_XSM_ERROR("Could not register hwmon device\n");
 #endif
 
+	clevo_xsm_debugfs_init();
+
 	return 0;
 }
 
 static void __exit clevo_xsm_exit(void)
 {
+	/* Hotkeys use the input device, LEDs and backlight torn down below */
+	clevo_xsm_wmi_notify_remove();
+	kb_hotkey_drain();
+
+	clevo_xsm_debugfs_exit();
+
+	kb_notify_exit();
+	kb_led_exit();
 	clevo_xsm_led_exit();
 	clevo_xsm_input_exit();
 	clevo_xsm_rfkill_exit();
 
-#ifdef CLEVO_HAS_HWMON
+#if CLEVO_HAS_HWMON
 	clevo_hwmon_fini(&clevo_xsm_platform_device->dev);
 #endif
+	clevo_sensor_exit();
+	device_remove_file(&clevo_xsm_platform_device->dev, &dev_attr_kb_sync);
 	device_remove_file(&clevo_xsm_platform_device->dev,
 		&dev_attr_kb_brightness);
+	device_remove_file(&clevo_xsm_platform_device->dev,
+		&dev_attr_kb_brightness_raw);
 	device_remove_file(&clevo_xsm_platform_device->dev, &dev_attr_kb_state);
 	device_remove_file(&clevo_xsm_platform_device->dev, &dev_attr_kb_mode);
 	device_remove_file(&clevo_xsm_platform_device->dev, &dev_attr_kb_color);
+	device_remove_file(&clevo_xsm_platform_device->dev, &dev_attr_kb_shadow_stats);
 	device_remove_file(&clevo_xsm_platform_device->dev, &dev_attr_kb_wave);
 	device_remove_file(&clevo_xsm_platform_device->dev, &dev_attr_kb_wave_period);
 	device_remove_file(&clevo_xsm_platform_device->dev, &dev_attr_kb_wave_interval);
 	device_remove_file(&clevo_xsm_platform_device->dev, &dev_attr_kb_wave_colors);
 	device_remove_file(&clevo_xsm_platform_device->dev, &dev_attr_kb_led_mode);
+	device_remove_file(&clevo_xsm_platform_device->dev, &dev_attr_kb_color_gamma);
+	device_remove_file(&clevo_xsm_platform_device->dev, &dev_attr_kb_color_calibration);
 	device_remove_file(&clevo_xsm_platform_device->dev, &dev_attr_fan_control);
+	device_remove_file(&clevo_xsm_platform_device->dev, &dev_attr_fan_curve);
 	device_remove_file(&clevo_xsm_platform_device->dev, &dev_attr_power_profile);
-	/* Stop all LED effects and cleanup workqueue */
-	stop_all_effects();
-	if (wave_workqueue)
-		destroy_workqueue(wave_workqueue);
+	kb_stream_exit();
+	kb_store_exit();
+	/* Stop all LED effects and the effect worker */
+	kb_idle_exit();
+	kb_react_exit();
+	kb_fx_power_exit();
+	kb_fx_exit();
 
 	platform_device_unregister(clevo_xsm_platform_device);
 	platform_driver_unregister(&clevo_xsm_platform_driver);
+	kb_hotkey_exit();
+
+	clevo_xsm_wmi_method_exit();
+	clevo_cmdq_exit();
 }
 
 module_init(clevo_xsm_init);
@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: GPL-2.0+ WITH Linux-syscall-note */
+/*
+ * clevo_kb.h - Frame streaming interface of /dev/clevo_kb
+ *
+ * Opening /dev/clevo_kb switches the keyboard to the "stream" LED mode
+ * until it is closed again; only one process can have it open. Frames
+ * come in two ways, do not mix them on one open file:
+ *
+ * write() takes any number of whole struct clevo_kb_frame. It blocks
+ * while the ring is full, or fails with EAGAIN under O_NONBLOCK, and with
+ * EBUSY once another LED mode has been selected.
+ *
+ * mmap() of sizeof(struct clevo_kb_ring) at offset 0 maps the frame ring
+ * itself. The producer fills frames[head % CLEVO_KB_RING_FRAMES], then
+ * publishes it with a store-release of head + 1. The kernel consumes with
+ * a store-release of tail. The consumer sleeps after a while without
+ * frames and sets CLEVO_KB_RING_NEED_WAKEUP first; a producer that sees
+ * the flag after publishing (with a full barrier in between) wakes it up
+ * with write(fd, NULL, 0).
+ *
+ * Frames are shown at their time_ns. When the consumer is behind, only
+ * the latest frame that is due is drawn and the older ones are dropped.
+ */
+
+#ifndef _CLEVO_KB_H
+#define _CLEVO_KB_H
+
+#include <linux/types.h>
+
+#define CLEVO_KB_ZONES 4  /* left, center, right, extra */
+
+/* clevo_kb_frame.flags */
+#define CLEVO_KB_FRAME_BRIGHTNESS (1 << 0)  /* brightness is valid */
+#define CLEVO_KB_FRAME_RAW        (1 << 1)  /* skip kb_color_gamma/calibration */
+
+struct clevo_kb_frame {
+	__u64 time_ns;  /* CLOCK_MONOTONIC, 0 = as soon as possible */
+	__u8 rgb[CLEVO_KB_ZONES][3];
+	__u8 zones;     /* bit n set = rgb[n] is valid */
+	__u8 brightness;  /* raw F4 value, 0xFF = brightest */
+	__u8 flags;     /* CLEVO_KB_FRAME_* */
+	__u8 reserved;  /* set to 0 */
+} __attribute__((packed));
+
+#define CLEVO_KB_RING_FRAMES 256  /* power of 2 */
+
+/* clevo_kb_ring.flags, written by the kernel */
+#define CLEVO_KB_RING_NEED_WAKEUP (1 << 0)
+
+struct clevo_kb_ring {
+	__u32 head;     /* producer */
+	__u32 pad0[15];
+	__u32 tail;     /* kernel */
+	__u32 flags;    /* kernel, CLEVO_KB_RING_* */
+	__u32 dropped;  /* kernel, frames never drawn */
+	__u32 pad1[13];
+	struct clevo_kb_frame frames[CLEVO_KB_RING_FRAMES];
+};
+
+#endif /* _CLEVO_KB_H */
@@ -0,0 +1,133 @@
+/*
+ * clevo_xsm_wmi_trace.h
+ *
+ * Tracepoints for WMI calls, effect frames and EC accesses of the
+ * clevo-xsm-wmi driver. Enable with
+ *
+ *   echo 1 > /sys/kernel/tracing/events/clevo_xsm_wmi/enable
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the  GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM clevo_xsm_wmi
+
+#if !defined(_CLEVO_XSM_WMI_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _CLEVO_XSM_WMI_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(clevo_xsm_wmi_call_enter,
+
+	TP_PROTO(u32 method_id, u32 arg),
+
+	TP_ARGS(method_id, arg),
+
+	TP_STRUCT__entry(
+		__field(u32, method_id)
+		__field(u32, arg)
+	),
+
+	TP_fast_assign(
+		__entry->method_id = method_id;
+		__entry->arg       = arg;
+	),
+
+	TP_printk("method=%#04x arg=%#010x",
+		__entry->method_id, __entry->arg)
+);
+
+TRACE_EVENT(clevo_xsm_wmi_call_exit,
+
+	TP_PROTO(u32 method_id, u32 arg, u32 retval, int err, u64 duration_ns),
+
+	TP_ARGS(method_id, arg, retval, err, duration_ns),
+
+	TP_STRUCT__entry(
+		__field(u32, method_id)
+		__field(u32, arg)
+		__field(u32, retval)
+		__field(int, err)
+		__field(u64, duration_ns)
+	),
+
+	TP_fast_assign(
+		__entry->method_id   = method_id;
+		__entry->arg         = arg;
+		__entry->retval      = retval;
+		__entry->err         = err;
+		__entry->duration_ns = duration_ns;
+	),
+
+	TP_printk("method=%#04x arg=%#010x ret=%#010x err=%d duration_ns=%llu",
+		__entry->method_id, __entry->arg, __entry->retval,
+		__entry->err, __entry->duration_ns)
+);
+
+TRACE_EVENT(clevo_xsm_effect_frame,
+
+	TP_PROTO(int mode, unsigned int step, u64 planned_ns, u64 actual_ns),
+
+	TP_ARGS(mode, step, planned_ns, actual_ns),
+
+	TP_STRUCT__entry(
+		__field(int, mode)
+		__field(unsigned int, step)
+		__field(u64, planned_ns)
+		__field(u64, actual_ns)
+	),
+
+	TP_fast_assign(
+		__entry->mode       = mode;
+		__entry->step       = step;
+		__entry->planned_ns = planned_ns;
+		__entry->actual_ns  = actual_ns;
+	),
+
+	TP_printk("mode=%d step=%u planned_ns=%llu actual_ns=%llu late_ns=%lld",
+		__entry->mode, __entry->step, __entry->planned_ns,
+		__entry->actual_ns,
+		(s64) (__entry->actual_ns - __entry->planned_ns))
+);
+
+TRACE_EVENT(clevo_xsm_ec_access,
+
+	TP_PROTO(bool write, u8 addr, u8 val, int err, u64 duration_ns,
+		unsigned long caller),
+
+	TP_ARGS(write, addr, val, err, duration_ns, caller),
+
+	TP_STRUCT__entry(
+		__field(bool, write)
+		__field(u8, addr)
+		__field(u8, val)
+		__field(int, err)
+		__field(u64, duration_ns)
+		__field(unsigned long, caller)
+	),
+
+	TP_fast_assign(
+		__entry->write       = write;
+		__entry->addr        = addr;
+		__entry->val         = val;
+		__entry->err         = err;
+		__entry->duration_ns = duration_ns;
+		__entry->caller      = caller;
+	),
+
+	TP_printk("%s addr=%#04x val=%#04x err=%d duration_ns=%llu caller=%pS",
+		__entry->write ? "write" : "read", __entry->addr, __entry->val,
+		__entry->err, __entry->duration_ns, (void *) __entry->caller)
+);
+
+#endif /* _CLEVO_XSM_WMI_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE clevo_xsm_wmi_trace
+#include <trace/define_trace.h>
@@ -21,11 +21,18 @@ make kb_ctl || { echo "Failed to build kb_ctl"; exit 1; }
 echo "Building kb_service..."
 make kb_service || { echo "Failed to build kb_service"; exit 1; }
 
+echo "Building kb_thermal..."
+make kb_thermal || { echo "Failed to build kb_thermal"; exit 1; }
+
+echo "Building kb_profiled..."
+make kb_profiled || { echo "Failed to build kb_profiled"; exit 1; }
+
 # Create directory structure
 mkdir -p "${PKG_DIR}/DEBIAN"
 mkdir -p "${PKG_DIR}/usr/local/bin"
 mkdir -p "${PKG_DIR}/usr/share/applications"
 mkdir -p "${PKG_DIR}/etc/udev/rules.d"
+mkdir -p "${PKG_DIR}/etc/backlit"
 mkdir -p "${PKG_DIR}/usr/share/backlit/assets"
 mkdir -p "${PKG_DIR}/usr/share/backlit/clevo-xsm-wmi"
 mkdir -p "${PKG_DIR}/lib/systemd/system"
@@ -59,6 +66,8 @@ chmod 755 "${PKG_DIR}/DEBIAN/prerm"
 cp kb_gui "${PKG_DIR}/usr/local/bin/"
 cp kb_ctl "${PKG_DIR}/usr/local/bin/"
 cp kb_service "${PKG_DIR}/usr/local/bin/"
+cp kb_thermal "${PKG_DIR}/usr/local/bin/"
+cp kb_profiled "${PKG_DIR}/usr/local/bin/"
 
 # Copy hotkey scripts
 cp kb_toggle "${PKG_DIR}/usr/local/bin/"
@@ -76,14 +85,18 @@ cp xbindkeysrc "${PKG_DIR}/usr/share/backlit/"
 # Copy system files
 cp controlcenter.desktop "${PKG_DIR}/usr/share/applications/"
 cp 99-keyboard-backlight.rules "${PKG_DIR}/etc/udev/rules.d/"
+cp workloads.conf "${PKG_DIR}/etc/backlit/"
 
 # Copy kernel module source + DKMS config (built on target via DKMS)
 cp clevo-xsm-wmi/clevo-xsm-wmi.c "${PKG_DIR}/usr/share/backlit/clevo-xsm-wmi/"
+cp clevo-xsm-wmi/clevo_xsm_wmi_trace.h "${PKG_DIR}/usr/share/backlit/clevo-xsm-wmi/"
+cp clevo-xsm-wmi/clevo_kb.h "${PKG_DIR}/usr/share/backlit/clevo-xsm-wmi/"
 cp clevo-xsm-wmi/Makefile "${PKG_DIR}/usr/share/backlit/clevo-xsm-wmi/"
 cp clevo-xsm-wmi/dkms.conf "${PKG_DIR}/usr/share/backlit/clevo-xsm-wmi/"
 
 # Copy systemd service for module autoload
 cp clevo-xsm-wmi.service "${PKG_DIR}/lib/systemd/system/"
+cp kb-profiled.service "${PKG_DIR}/lib/systemd/system/"
 
 # Build package
 dpkg-deb --build "${PKG_DIR}"
@@ -19,6 +19,7 @@
 #include <math.h>
 #include <sys/ioctl.h>
 #include <poll.h>
+#include "watch.h"
 
 #define SYSFS_PATH "/sys/devices/platform/clevo_xsm_wmi"
 
@@ -1151,7 +1152,7 @@ static gboolean update_power_btn_wrapper(gpointer data)
         
         gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(power_btn), active);
         gtk_button_set_label(GTK_BUTTON(power_btn), active ? "ON" : "OFF");
-        update_status(active ? "Backlight ON (Hotkey)" : "Backlight OFF (Hotkey)");
+        update_status(active ? "Backlight ON" : "Backlight OFF");
         
         g_signal_handlers_unblock_by_func(power_btn, on_power_toggled, NULL);
     }
@@ -1172,7 +1173,7 @@ static gboolean update_brightness_wrapper(gpointer data)
         snprintf(buf, sizeof(buf), "%d", level);
         gtk_label_set_text(GTK_LABEL(brightness_label), buf);
         
-        snprintf(buf, sizeof(buf), "Brightness: %d (Hotkey)", level);
+        snprintf(buf, sizeof(buf), "Brightness: %d", level);
         update_status(buf);
         
         g_signal_handlers_unblock_by_func(brightness_scale, on_brightness_changed, NULL);
@@ -1180,6 +1181,59 @@ static gboolean update_brightness_wrapper(gpointer data)
     return FALSE; /* Remove source */
 }
 
+/* GUI update for the wave switch - Safe wrapper for main thread */
+static gboolean update_wave_switch_wrapper(gpointer data)
+{
+    gboolean active = GPOINTER_TO_INT(data);
+
+    if (wave_switch) {
+        g_signal_handlers_block_by_func(wave_switch, on_wave_toggled, NULL);
+        gtk_switch_set_active(GTK_SWITCH(wave_switch), active);
+        g_signal_handlers_unblock_by_func(wave_switch, on_wave_toggled, NULL);
+    }
+    return FALSE; /* Remove source */
+}
+
+/*
+ * Driver attributes the GUI follows. The driver calls sysfs_notify() when
+ * they change, whoever changed them, which wakes poll() with POLLPRI.
+ */
+enum { WATCH_BRIGHTNESS, WATCH_STATE, WATCH_COLOR, WATCH_LED_MODE, WATCH_COUNT };
+static const char *watch_attrs[WATCH_COUNT] = {
+    "kb_brightness", "kb_state", "kb_color", "kb_led_mode",
+};
+
+/* Fails once the attribute is gone, i.e. the module was unloaded */
+static int watch_changed(int which, int fd)
+{
+    char buf[64], color[64];
+
+    if (kb_watch_read(fd, buf, sizeof(buf)) < 0) return -1;
+
+    switch (which) {
+    case WATCH_BRIGHTNESS:
+        g_idle_add(update_brightness_wrapper, GINT_TO_POINTER(atoi(buf)));
+        break;
+    case WATCH_STATE:
+    case WATCH_COLOR: {
+        /* Off means switched off or all black, as the driver sees it */
+        int on = kb_get_state() &&
+                 read_sysfs("kb_color", color, sizeof(color)) == 0 &&
+                 strncmp(color, "black black black", 17) != 0 &&
+                 strcmp(color, "black") != 0;
+        if (on != is_backlight_on) {
+            is_backlight_on = on;
+            g_idle_add(update_power_btn_wrapper, GINT_TO_POINTER(on));
+        }
+        break;
+    }
+    case WATCH_LED_MODE:
+        g_idle_add(update_wave_switch_wrapper, GINT_TO_POINTER(atoi(buf) == 1));
+        break;
+    }
+    return 0;
+}
+
 /* Hotkey toggle function */
 static void hotkey_toggle(void)
 {
@@ -1214,46 +1268,66 @@ static void hotkey_brightness(int delta)
 }
 
 /* Input monitoring thread - monitors Clevo device for KBDILLUM events */
+/* and the driver attributes the GUI shows, see watch_attrs */
 /* System-wide numpad hotkeys are handled by xbindkeys + shell scripts */
 static void *input_thread_func(void *arg)
 {
+    struct pollfd pfd[1 + WATCH_COUNT];
     char devpath[256];
-    
-    if (find_tuxedo_keyboard(devpath, sizeof(devpath)) < 0) {
+    int fd = -1;
+
+    if (find_tuxedo_keyboard(devpath, sizeof(devpath)) < 0)
         fprintf(stderr, "Clevo input device not found (hotkeys via xbindkeys only)\n");
-        return NULL;
-    }
-    
-    int fd = open(devpath, O_RDONLY);
-    if (fd < 0) {
+    else if ((fd = open(devpath, O_RDONLY)) < 0)
         fprintf(stderr, "Cannot open input device: %s\n", devpath);
-        return NULL;
+    else
+        printf("Hotkey monitoring: Clevo device on %s\n", devpath);
+
+    /* poll() skips negative fds */
+    pfd[0].fd = fd;
+    pfd[0].events = POLLIN;
+    for (int i = 0; i < WATCH_COUNT; i++) {
+        pfd[1 + i].fd = kb_watch_open(watch_attrs[i]);
+        pfd[1 + i].events = POLLPRI;
     }
-    
-    printf("Hotkey monitoring: Clevo device on %s\n", devpath);
-    
-    struct input_event ev;
+
     while (input_running) {
-        ssize_t n = read(fd, &ev, sizeof(ev));
-        if (n != sizeof(ev)) continue;
-        
-        if (ev.type == EV_KEY && ev.value == 1) {
-            switch (ev.code) {
-            case KEY_KBDILLUMTOGGLE:
-            case KEY_RFKILL:
-                hotkey_toggle();
-                break;
-            case KEY_KBDILLUMDOWN:
-                hotkey_brightness(1);
-                break;
-            case KEY_KBDILLUMUP:
-                hotkey_brightness(-1);
-                break;
+        /* The timeout only bounds how long exiting takes */
+        if (poll(pfd, 1 + WATCH_COUNT, 500) <= 0) continue;
+
+        if (pfd[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            close(pfd[0].fd);
+            pfd[0].fd = -1;
+        } else if (pfd[0].revents & POLLIN) {
+            struct input_event ev;
+            if (read(pfd[0].fd, &ev, sizeof(ev)) == sizeof(ev) &&
+                ev.type == EV_KEY && ev.value == 1) {
+                switch (ev.code) {
+                case KEY_KBDILLUMTOGGLE:
+                case KEY_RFKILL:
+                    hotkey_toggle();
+                    break;
+                case KEY_KBDILLUMDOWN:
+                    hotkey_brightness(1);
+                    break;
+                case KEY_KBDILLUMUP:
+                    hotkey_brightness(-1);
+                    break;
+                }
+            }
+        }
+
+        for (int i = 0; i < WATCH_COUNT; i++) {
+            if (pfd[1 + i].revents & (POLLPRI | POLLERR) &&
+                watch_changed(i, pfd[1 + i].fd) < 0) {
+                close(pfd[1 + i].fd);
+                pfd[1 + i].fd = -1;
             }
         }
     }
-    
-    close(fd);
+
+    for (int i = 0; i < 1 + WATCH_COUNT; i++)
+        if (pfd[i].fd >= 0) close(pfd[i].fd);
     return NULL;
 }
 
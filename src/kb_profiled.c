@@ -0,0 +1,233 @@
+/*
+ * kb_profiled.c - Power profile daemon
+ *
+ * Applies one power profile on AC and another on battery, and switches
+ * whenever the power source changes. Power supply changes are picked up
+ * from kernel uevents, so the daemon sleeps until something happens.
+ *
+ * The driver runs the fans at full speed in the performance profile, so
+ * the AC default is entertainment, which leaves them on auto.
+ *
+ * With --workload it also checks /proc every few seconds and switches to
+ * the profile of a known heavy workload while it runs, see workload.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include "system.h"
+#include "profile.h"
+#include "workload.h"
+
+/* Fallback re-check in case a uevent was missed */
+#define RECHECK_MS 30000
+#define WORKLOAD_CONFIG "/etc/backlit/workloads.conf"
+
+static volatile int running = 1;
+
+static void signal_handler(int signum)
+{
+    (void)signum;
+    running = 0;
+}
+
+static int open_uevent_socket(void)
+{
+    struct sockaddr_nl addr = {
+        .nl_family = AF_NETLINK,
+        .nl_pid = 0,
+        .nl_groups = 1,  /* kernel uevents */
+    };
+
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0) return -1;
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Uevent payload is NUL separated "KEY=value" strings */
+static int is_power_supply_event(const char *buf, ssize_t len)
+{
+    for (ssize_t i = 0; i < len; i += strlen(buf + i) + 1)
+        if (strcmp(buf + i, "SUBSYSTEM=power_supply") == 0) return 1;
+    return 0;
+}
+
+static int apply(int profile, const char *why)
+{
+    int failed = profile_apply(profile);
+
+    if (failed < 0)
+        fprintf(stderr, "Failed to set power profile %s, is clevo_xsm_wmi loaded?\n",
+                power_profiles[profile].name);
+    else
+        printf("%s: %s profile%s\n", why, power_profiles[profile].name,
+               failed ? " (some cpufreq settings not applied, run as root)" : "");
+    fflush(stdout);
+    return failed < 0 ? -1 : 0;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_help(const char *prog)
+{
+    printf("Power profile daemon for Clevo laptops\n\n");
+    printf("Usage: %s [OPTIONS]\n\n", prog);
+    printf("Options:\n");
+    printf("  -a, --ac PROFILE       Profile on AC (default entertainment)\n");
+    printf("  -b, --battery PROFILE  Profile on battery (default power_saving)\n");
+    printf("  -1, --once             Apply the profile for the current source and exit\n");
+    printf("  -w, --workload         Switch profiles for known heavy workloads\n");
+    printf("  -c, --config FILE      Workload rules (default %s)\n", WORKLOAD_CONFIG);
+    printf("  -h, --help             Show this help\n\n");
+    printf("Profiles: performance, entertainment, power_saving, quiet\n");
+    printf("performance also runs the fans at full speed\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int ac_profile = PROFILE_ENTERTAINMENT;
+    int bat_profile = PROFILE_POWER_SAVING;
+    int once = 0, use_workload = 0;
+    const char *config = WORKLOAD_CONFIG;
+
+    static struct option long_options[] = {
+        {"ac",      required_argument, 0, 'a'},
+        {"battery", required_argument, 0, 'b'},
+        {"once",    no_argument,       0, '1'},
+        {"workload", no_argument,      0, 'w'},
+        {"config",  required_argument, 0, 'c'},
+        {"help",    no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "a:b:1wc:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'a':
+        case 'b':
+            {
+                int profile = profile_from_name(optarg);
+                if (profile < 0) {
+                    fprintf(stderr, "Error: Unknown profile '%s'\n", optarg);
+                    return 1;
+                }
+                if (opt == 'a') ac_profile = profile;
+                else bat_profile = profile;
+            }
+            break;
+        case '1':
+            once = 1;
+            break;
+        case 'w':
+            use_workload = 1;
+            break;
+        case 'c':
+            config = optarg;
+            break;
+        case 'h':
+            print_help(argv[0]);
+            return 0;
+        default:
+            print_help(argv[0]);
+            return 1;
+        }
+    }
+
+    /* Unknown source counts as AC */
+    int on_ac = system_on_ac() != 0;
+    int profile = on_ac ? ac_profile : bat_profile;
+    int ret = apply(profile, on_ac ? "AC" : "Battery");
+    if (once) return ret < 0 ? 1 : 0;
+
+    /* Only a profile that was applied successfully counts as applied */
+    int applied = ret == 0 ? profile : -1;
+    int failed = ret == 0 ? -1 : profile;
+
+    Workload wl;
+    if (use_workload && workload_load(&wl, config) < 0)
+        return 1;
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    int fd = open_uevent_socket();
+    if (fd < 0) perror("uevent socket, falling back to polling");
+
+    char buf[4096];
+    double last_check = now_s();
+    double last_try = last_check;
+    double last_scan = last_check - 1e9;  /* first scan right away */
+    while (running) {
+        /* Scan on the workload interval, however many uevents come in */
+        int timeout = RECHECK_MS;
+        if (use_workload) {
+            double left = wl.interval_ms - (now_s() - last_scan) * 1000;
+            timeout = left > 0 ? (int)left : 0;
+        }
+
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int ready = poll(&pfd, fd >= 0 ? 1 : 0, timeout);
+        if (ready < 0) continue;  /* EINTR */
+
+        int power_event = ready == 0 && !use_workload;
+        if (ready > 0) {
+            ssize_t n = recv(fd, buf, sizeof(buf) - 1, 0);
+            if (n <= 0) continue;
+            buf[n] = '\0';
+            power_event = is_power_supply_event(buf, n);
+            if (!power_event) continue;
+        }
+        double now = now_s();
+        if (power_event || fd < 0 || now - last_check >= RECHECK_MS / 1000) {
+            on_ac = system_on_ac() != 0;
+            last_check = now;
+        }
+
+        profile = on_ac ? ac_profile : bat_profile;
+        const char *why = on_ac ? "AC" : "Battery";
+
+        if (use_workload) {
+            /* Keep the hold timers running even while ignored */
+            if (now - last_scan >= wl.interval_ms / 1000.0) {
+                workload_update(&wl, now);
+                last_scan = now;
+            }
+            if (wl.active >= 0 && (on_ac || !wl.ac_only)) {
+                profile = wl.active;
+                why = wl.reason;
+            }
+        }
+
+        if (profile == applied) continue;
+        /* Retry a failed profile on the re-check tick, not on every wakeup */
+        if (profile == failed && now - last_try < RECHECK_MS / 1000) continue;
+        last_try = now;
+        if (apply(profile, why) < 0) {
+            applied = -1;
+            failed = profile;
+        } else {
+            applied = profile;
+            failed = -1;
+        }
+    }
+
+    if (fd >= 0) close(fd);
+    return 0;
+}
@@ -3,6 +3,10 @@
  * 
  * Monitors /dev/input/event* for Fn keys and updates led/sysfs
  * Runs as a lightweight background daemon (no GUI).
+ *
+ * kb_brightness and kb_color are cached and refreshed when the driver
+ * signals a change (sysfs_notify, POLLPRI), so a key press does not have
+ * to re-read them and the saved color follows changes made elsewhere.
  */
 
 #include <stdio.h>
@@ -14,11 +18,15 @@
 #include <dirent.h>
 #include <sys/ioctl.h>
 #include <signal.h>
-
-#define SYSFS_PATH "/sys/devices/platform/clevo_xsm_wmi"
+#include <poll.h>
+#include "keyboard.h"
 
 static volatile int running = 1;
 
+/* Last values reported by the driver */
+static char cur_color[128];
+static int cur_brightness;
+
 /* Handle stats - similar to kb_gui.c but simpler */
 static int read_sysfs(const char *attr, char *buf, size_t bufsize)
 {
@@ -79,14 +87,24 @@ static int find_tuxedo_keyboard(char *path, size_t pathlen)
     return -1;
 }
 
+static char saved_color[64] = "blue"; /* Default fallback */
+
+/* Remember the last color that was not black, for toggling back on */
+static void color_changed(void)
+{
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%s", cur_color);
+
+    char *first_color = strtok(buf, " ");
+    if (first_color && strcmp(first_color, "black") != 0)
+        snprintf(saved_color, sizeof(saved_color), "%s", first_color);
+}
+
 static void handle_toggle(void)
 {
     char buf[128];
-    static char saved_color[64] = "blue"; /* Default fallback */
-    
-    /* Check current color */
-    if (read_sysfs("kb_color", buf, sizeof(buf)) < 0) return;
     
+    snprintf(buf, sizeof(buf), "%s", cur_color);
     char *first_color = strtok(buf, " ");
     
     if (first_color && strcmp(first_color, "black") == 0) {
@@ -95,24 +113,27 @@ static void handle_toggle(void)
         snprintf(cmd, sizeof(cmd), "%s %s %s", saved_color, saved_color, saved_color);
         write_sysfs("kb_color", cmd);
         write_sysfs("kb_brightness", "0");
+        /* Until the driver's notification catches up */
+        snprintf(cur_color, sizeof(cur_color), "%s", cmd);
+        cur_brightness = 0;
     } else {
         /* Is ON, save color and turn OFF */
         if (first_color) strncpy(saved_color, first_color, sizeof(saved_color)-1);
         write_sysfs("kb_color", "black");
+        snprintf(cur_color, sizeof(cur_color), "black");
     }
 }
 
 static void handle_brightness(int delta)
 {
     char buf[16];
-    if (read_sysfs("kb_brightness", buf, sizeof(buf)) < 0) return;
-    
-    int level = atoi(buf) + delta;
+    int level = cur_brightness + delta;
     if (level < 0) level = 0;
     if (level > 9) level = 9;
     
     snprintf(buf, sizeof(buf), "%d", level);
     write_sysfs("kb_brightness", buf);
+    cur_brightness = level;
 }
 
 void signal_handler(int signum) {
@@ -137,8 +158,42 @@ int main(int argc, char *argv[])
         return 1;
     }
     
+    char buf[16];
+    if (read_sysfs("kb_color", cur_color, sizeof(cur_color)) == 0) color_changed();
+    if (read_sysfs("kb_brightness", buf, sizeof(buf)) == 0) cur_brightness = atoi(buf);
+
+    /* Without the attributes we just never get POLLPRI */
+    struct pollfd pfd[3] = {
+        { .fd = fd, .events = POLLIN },
+        { .fd = kb_watch_open("kb_color"), .events = POLLPRI },
+        { .fd = kb_watch_open("kb_brightness"), .events = POLLPRI },
+    };
+
     struct input_event ev;
     while (running) {
+        if (poll(pfd, 3, -1) < 0) continue;  /* EINTR */
+
+        /* A failed read means the module is gone, stop watching */
+        if (pfd[1].revents & (POLLPRI | POLLERR)) {
+            if (kb_watch_read(pfd[1].fd, cur_color, sizeof(cur_color)) == 0) {
+                color_changed();
+            } else {
+                close(pfd[1].fd);
+                pfd[1].fd = -1;
+            }
+        }
+        if (pfd[2].revents & (POLLPRI | POLLERR)) {
+            if (kb_watch_read(pfd[2].fd, buf, sizeof(buf)) == 0) {
+                cur_brightness = atoi(buf);
+            } else {
+                close(pfd[2].fd);
+                pfd[2].fd = -1;
+            }
+        }
+
+        if (pfd[0].revents & (POLLERR | POLLHUP | POLLNVAL)) break;
+        if (!(pfd[0].revents & POLLIN)) continue;
+
         ssize_t n = read(fd, &ev, sizeof(ev));
         if (n != sizeof(ev)) continue;
         
@@ -151,6 +206,7 @@ int main(int argc, char *argv[])
         }
     }
     
-    close(fd);
+    for (int i = 0; i < 3; i++)
+        if (pfd[i].fd >= 0) close(pfd[i].fd);
     return 0;
 }
@@ -0,0 +1,341 @@
+/*
+ * kb_thermal.c - Predictive thermal controller daemon
+ *
+ * Watches the CPU temperature and its rate of rise, and puts the fans at
+ * full speed when the temperature is predicted to reach the throttle point
+ * within the look-ahead horizon, instead of waiting until it gets there.
+ * Optionally drops to the power saving profile when that is not enough.
+ *
+ * Temperature traces can be recorded live and replayed offline, so the
+ * controller can be tuned and regression-tested without the hardware.
+ * Trace format: one "<seconds> <celsius>" sample per line, '#' comments.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include "system.h"
+#include "keyboard.h"
+
+#define FAN_AUTO            0
+#define FAN_MAX             1
+#define PROFILE_POWER_SAVING 2
+
+typedef struct {
+    /* Tuning */
+    double throttle_c;   /* CPU throttle point */
+    double margin_c;     /* engage when the prediction is this close */
+    double release_c;    /* release this far below the throttle point */
+    double horizon_s;    /* look-ahead for the prediction */
+    double hold_s;       /* minimum time engaged */
+    double alpha;        /* slope smoothing, 0-1 */
+    int use_profile;
+
+    /* State */
+    int have_prev;
+    double prev_t, prev_temp;
+    double slope;        /* C/s, smoothed */
+    int above;           /* currently at or over the throttle point */
+    int engaged;
+    double engaged_at;
+    int crossed;         /* throttled during this engagement */
+    int threat;          /* predicted to reach the throttle point itself */
+    int saved_fan;
+    int profile_engaged;
+    int saved_profile;
+
+    /* Stats */
+    unsigned long samples;
+    unsigned long engagements;
+    unsigned long prevented;
+    unsigned long false_alarms;  /* engaged, but never predicted to throttle */
+    unsigned long throttled;
+    double peak_c;
+} ThermalCtl;
+
+static volatile int running = 1;
+static volatile int dump_stats = 0;
+static int replay = 0;
+static int verbose = 0;
+
+static void ctl_log(double t, const char *what, const ThermalCtl *ctl,
+                    double temp, double predicted)
+{
+    printf("t=%.1f %s temp=%.1f slope=%+.2f predicted=%.1f\n",
+           t, what, temp, ctl->slope, predicted);
+    fflush(stdout);
+}
+
+/* Replay never touches the driver; the log lines are the output */
+static void ctl_set_fan(int mode)
+{
+    if (!replay) set_fan_control(mode);
+}
+
+static void ctl_set_profile(int profile)
+{
+    if (!replay) set_power_profile(profile);
+}
+
+static void ctl_release(ThermalCtl *ctl)
+{
+    if (!ctl->engaged) return;
+
+    /* The driver sets the fan mode with the profile, so restore it first */
+    if (ctl->profile_engaged) ctl_set_profile(ctl->saved_profile);
+    if (ctl->saved_fan != FAN_MAX || ctl->profile_engaged)
+        ctl_set_fan(ctl->saved_fan);
+
+    /* Only an engagement that was heading over the limit prevented anything */
+    if (!ctl->crossed) {
+        if (ctl->threat) ctl->prevented++;
+        else ctl->false_alarms++;
+    }
+    ctl->engaged = 0;
+    ctl->profile_engaged = 0;
+}
+
+static void ctl_step(ThermalCtl *ctl, double t, double temp)
+{
+    if (temp <= 0) return;  /* no sensor reading */
+
+    ctl->samples++;
+    if (temp > ctl->peak_c) ctl->peak_c = temp;
+
+    if (ctl->have_prev && t > ctl->prev_t) {
+        double rate = (temp - ctl->prev_temp) / (t - ctl->prev_t);
+        ctl->slope += ctl->alpha * (rate - ctl->slope);
+    }
+    ctl->have_prev = 1;
+    ctl->prev_t = t;
+    ctl->prev_temp = temp;
+
+    /* Only a rising temperature is extrapolated */
+    double predicted = temp + (ctl->slope > 0 ? ctl->slope * ctl->horizon_s : 0);
+
+    if (temp >= ctl->throttle_c) {
+        if (!ctl->above) {
+            ctl->above = 1;
+            ctl->throttled++;
+            if (ctl->engaged) ctl->crossed = 1;
+            ctl_log(t, "throttle", ctl, temp, predicted);
+        }
+    } else if (temp < ctl->throttle_c - 1) {
+        ctl->above = 0;
+    }
+
+    if (!ctl->engaged && predicted >= ctl->throttle_c - ctl->margin_c) {
+        ctl->engaged = 1;
+        ctl->engaged_at = t;
+        ctl->crossed = ctl->above;
+        ctl->threat = predicted >= ctl->throttle_c;
+        ctl->saved_fan = replay ? FAN_AUTO : get_fan_control();
+        ctl->engagements++;
+        if (ctl->saved_fan != FAN_MAX) ctl_set_fan(FAN_MAX);
+        ctl_log(t, "engage", ctl, temp, predicted);
+        return;
+    }
+
+    if (!ctl->engaged) return;
+
+    if (predicted >= ctl->throttle_c) ctl->threat = 1;
+
+    /* Fans had a full horizon and it is still heading over the limit */
+    if (ctl->use_profile && !ctl->profile_engaged &&
+        predicted >= ctl->throttle_c &&
+        t - ctl->engaged_at >= ctl->horizon_s) {
+        ctl->saved_profile = replay ? PROFILE_POWER_SAVING : get_power_profile();
+        ctl->profile_engaged = 1;
+        if (ctl->saved_profile != PROFILE_POWER_SAVING)
+            ctl_set_profile(PROFILE_POWER_SAVING);
+        /* Switching the profile puts the fans back on auto */
+        ctl_set_fan(FAN_MAX);
+        ctl_log(t, "profile", ctl, temp, predicted);
+    }
+
+    if (t - ctl->engaged_at >= ctl->hold_s &&
+        temp <= ctl->throttle_c - ctl->release_c && ctl->slope < 0.1) {
+        ctl_release(ctl);
+        ctl_log(t, "release", ctl, temp, predicted);
+    } else if (verbose) {
+        ctl_log(t, "hold", ctl, temp, predicted);
+    }
+}
+
+static void print_stats(const ThermalCtl *ctl)
+{
+    printf("samples:     %lu\n", ctl->samples);
+    printf("engagements: %lu\n", ctl->engagements);
+    printf("prevented:   %lu\n", ctl->prevented);
+    printf("false alarm: %lu\n", ctl->false_alarms);
+    printf("throttled:   %lu\n", ctl->throttled);
+    printf("peak:        %.1f C\n", ctl->peak_c);
+    /* An open engagement is counted once it is released */
+    printf("engaged:     %s\n", ctl->engaged ? "yes" : "no");
+    fflush(stdout);
+}
+
+static int run_replay(ThermalCtl *ctl, const char *path)
+{
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+
+    char line[128];
+    double t, temp;
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (sscanf(line, "%lf %lf", &t, &temp) != 2) {
+            fprintf(stderr, "Bad trace line: %s", line);
+            continue;
+        }
+        ctl_step(ctl, t, temp);
+    }
+    if (f != stdin) fclose(f);
+
+    print_stats(ctl);
+    return 0;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run_live(ThermalCtl *ctl, const char *record, int interval_ms)
+{
+    FILE *rec = NULL;
+    if (record) {
+        rec = fopen(record, "w");
+        if (!rec) {
+            perror(record);
+            return 1;
+        }
+        fprintf(rec, "# kb_thermal trace: <seconds> <celsius>\n");
+    }
+
+    if (!kb_is_available())
+        fprintf(stderr, "Warning: clevo_xsm_wmi not loaded, fan control unavailable\n");
+
+    double start = now_s();
+    while (running) {
+        double t = now_s() - start;
+        double temp = system_get_cpu_temp();
+
+        if (rec && temp > 0) {
+            fprintf(rec, "%.3f %.1f\n", t, temp);
+            fflush(rec);
+        }
+        ctl_step(ctl, t, temp);
+
+        if (dump_stats) {
+            dump_stats = 0;
+            print_stats(ctl);
+        }
+        usleep(interval_ms * 1000);
+    }
+
+    /* Do not leave the fans pinned at max */
+    ctl_release(ctl);
+    print_stats(ctl);
+
+    if (rec) fclose(rec);
+    return 0;
+}
+
+static void signal_handler(int signum)
+{
+    if (signum == SIGUSR1) dump_stats = 1;
+    else running = 0;
+}
+
+static void print_help(const char *prog)
+{
+    printf("Predictive thermal controller for Clevo laptops\n\n");
+    printf("Usage: %s [OPTIONS]\n\n", prog);
+    printf("Options:\n");
+    printf("  -t, --throttle C     CPU throttle point (default 95)\n");
+    printf("  -m, --margin C       Engage when predicted within C of it (default 5)\n");
+    printf("  -e, --release C      Release C below the throttle point (default 15)\n");
+    printf("  -H, --horizon S      Look-ahead in seconds (default 10)\n");
+    printf("  -d, --hold S         Minimum time engaged in seconds (default 20)\n");
+    printf("  -i, --interval MS    Sampling interval (default 1000)\n");
+    printf("  -p, --profile        Also drop to power saving if fans are not enough\n");
+    printf("  -R, --record FILE    Record the temperature trace to FILE\n");
+    printf("  -r, --replay FILE    Replay a recorded trace (- = stdin), no sysfs writes\n");
+    printf("  -v, --verbose        Log every sample while engaged\n");
+    printf("  -h, --help           Show this help\n\n");
+    printf("SIGUSR1 prints the counters.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    ThermalCtl ctl = {
+        .throttle_c = 95,
+        .margin_c = 5,
+        .release_c = 15,
+        .horizon_s = 10,
+        .hold_s = 20,
+        .alpha = 0.3,
+    };
+    const char *replay_path = NULL, *record_path = NULL;
+    int interval_ms = 1000;
+
+    static struct option long_options[] = {
+        {"throttle", required_argument, 0, 't'},
+        {"margin",   required_argument, 0, 'm'},
+        {"release",  required_argument, 0, 'e'},
+        {"horizon",  required_argument, 0, 'H'},
+        {"hold",     required_argument, 0, 'd'},
+        {"interval", required_argument, 0, 'i'},
+        {"profile",  no_argument,       0, 'p'},
+        {"record",   required_argument, 0, 'R'},
+        {"replay",   required_argument, 0, 'r'},
+        {"verbose",  no_argument,       0, 'v'},
+        {"help",     no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:m:e:H:d:i:pR:r:vh", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 't': ctl.throttle_c = atof(optarg); break;
+        case 'm': ctl.margin_c = atof(optarg); break;
+        case 'e': ctl.release_c = atof(optarg); break;
+        case 'H': ctl.horizon_s = atof(optarg); break;
+        case 'd': ctl.hold_s = atof(optarg); break;
+        case 'i': interval_ms = atoi(optarg); break;
+        case 'p': ctl.use_profile = 1; break;
+        case 'R': record_path = optarg; break;
+        case 'r': replay_path = optarg; break;
+        case 'v': verbose = 1; break;
+        case 'h':
+            print_help(argv[0]);
+            return 0;
+        default:
+            print_help(argv[0]);
+            return 1;
+        }
+    }
+
+    if (interval_ms < 100) interval_ms = 100;
+
+    if (replay_path) {
+        replay = 1;
+        return run_replay(&ctl, replay_path);
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGUSR1, signal_handler);
+
+    return run_live(&ctl, record_path, interval_ms);
+}
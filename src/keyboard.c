@@ -8,6 +8,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include "keyboard.h"
+#include "profile.h"
 
 const KbColor kb_colors[] = {
     {"Blue",    "blue",    0,   0,   255},
@@ -125,7 +126,7 @@ int kb_set_wave(int on)
 int kb_get_led_mode(void)
 {
     char buf[32];
-    if (read_sysfs("kb_mode", buf, sizeof(buf)) < 0) return 0;
+    if (read_sysfs("kb_led_mode", buf, sizeof(buf)) < 0) return 0;
     return atoi(buf);
 }
 
@@ -133,7 +134,7 @@ int kb_set_led_mode(int mode)
 {
     const char *modes[] = {"static", "wave", "breath", "blink"};
     if (mode < 0 || mode > 3) mode = 0;
-    return write_sysfs("kb_mode", modes[mode]);
+    return write_sysfs("kb_led_mode", modes[mode]);
 }
 
 /* Fan Control: 0=auto, 1=max, 2=custom */
@@ -159,9 +160,8 @@ int get_power_profile(void)
     return atoi(buf);
 }
 
+/* Applies the whole profile (cpufreq, EPP, effects), see profile.c */
 int set_power_profile(int profile)
 {
-    const char *profiles[] = {"performance", "entertainment", "power_saving", "quiet"};
-    if (profile < 0 || profile > 3) profile = 2;
-    return write_sysfs("power_profile", profiles[profile]);
+    return profile_apply(profile) < 0 ? -1 : 0;
 }
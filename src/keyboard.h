@@ -5,6 +5,9 @@
 #ifndef KEYBOARD_H
 #define KEYBOARD_H
 
+#include <stddef.h>
+#include "watch.h"
+
 #define SYSFS_PATH "/sys/devices/platform/clevo_xsm_wmi"
 
 /* Available colors */
@@ -0,0 +1,189 @@
+/*
+ * profile.c - Power profile engine
+ *
+ * A power profile is applied as one unit: the driver's power_profile
+ * (EC profile and fans), the cpufreq governor, energy_performance_preference,
+ * min/max performance, turbo and the driver's effect frame rate cap.
+ * intel_pstate gets its global perf_pct knobs, other drivers (amd-pstate,
+ * acpi-cpufreq) get per-policy scaling_min/max_freq and the global boost.
+ * Anything the system does not have is skipped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include "keyboard.h"
+#include "profile.h"
+
+#define CPUFREQ_PATH     "/sys/devices/system/cpu/cpufreq"
+#define INTEL_PSTATE     "/sys/devices/system/cpu/intel_pstate"
+#define FX_MAX_FPS_PARAM "/sys/module/clevo_xsm_wmi/parameters/fx_max_fps"
+
+const PowerProfile power_profiles[PROFILE_COUNT] = {
+    [PROFILE_PERFORMANCE] = {
+        "performance", {"performance"}, "performance", 30, 100, 1, 0,
+    },
+    [PROFILE_ENTERTAINMENT] = {
+        "entertainment", {"schedutil", "powersave"}, "balance_performance",
+        0, 100, 1, 0,
+    },
+    [PROFILE_POWER_SAVING] = {
+        "power_saving", {"powersave", "schedutil"}, "power", 0, 60, 0, 20,
+    },
+    [PROFILE_QUIET] = {
+        "quiet", {"schedutil", "powersave"}, "balance_power", 0, 80, 0, 30,
+    },
+};
+
+static int write_file(const char *path, const char *value)
+{
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) return -1;
+
+    ssize_t n = write(fd, value, strlen(value));
+    close(fd);
+    return n < 0 ? -1 : 0;
+}
+
+static int write_file_long(const char *path, long value)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%ld", value);
+    return write_file(path, buf);
+}
+
+static long read_file_long(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+
+    long val;
+    if (fscanf(f, "%ld", &val) != 1) val = -1;
+    fclose(f);
+    return val;
+}
+
+static int file_exists(const char *path)
+{
+    return access(path, F_OK) == 0;
+}
+
+static int has_word(const char *path, const char *word)
+{
+    char buf[256];
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+
+    int found = 0;
+    while (!found && fscanf(f, "%255s", buf) == 1)
+        found = strcmp(buf, word) == 0;
+    fclose(f);
+    return found;
+}
+
+/* Lower the floor first so the new ceiling is never below it */
+static int apply_limits(const char *min_path, const char *max_path,
+                        long lowest, long min, long max)
+{
+    int failed = 0;
+
+    write_file_long(min_path, lowest);
+    if (write_file_long(max_path, max) < 0) failed++;
+    if (write_file_long(min_path, min) < 0) failed++;
+    return failed;
+}
+
+static int apply_policy(const char *policy, const PowerProfile *p, int pstate)
+{
+    char path[512], avail[512];
+    int failed = 0;
+
+    snprintf(avail, sizeof(avail), "%s/%s/scaling_available_governors",
+             CPUFREQ_PATH, policy);
+    snprintf(path, sizeof(path), "%s/%s/scaling_governor", CPUFREQ_PATH, policy);
+    for (int i = 0; i < 3 && p->governors[i]; i++) {
+        if (!has_word(avail, p->governors[i])) continue;
+        if (write_file(path, p->governors[i]) < 0) failed++;
+        break;
+    }
+
+    /* After the governor, the performance governor pins EPP on some drivers */
+    snprintf(path, sizeof(path), "%s/%s/energy_performance_preference",
+             CPUFREQ_PATH, policy);
+    if (file_exists(path) && write_file(path, p->epp) < 0) failed++;
+
+    if (pstate) return failed;
+
+    snprintf(path, sizeof(path), "%s/%s/cpuinfo_min_freq", CPUFREQ_PATH, policy);
+    long lo = read_file_long(path);
+    snprintf(path, sizeof(path), "%s/%s/cpuinfo_max_freq", CPUFREQ_PATH, policy);
+    long hi = read_file_long(path);
+    if (lo < 0 || hi <= 0) return failed;
+
+    long min = hi * p->min_perf_pct / 100;
+    long max = hi * p->max_perf_pct / 100;
+    if (min < lo) min = lo;
+    if (max < lo) max = lo;
+
+    char min_path[512];
+    snprintf(min_path, sizeof(min_path), "%s/%s/scaling_min_freq", CPUFREQ_PATH, policy);
+    snprintf(path, sizeof(path), "%s/%s/scaling_max_freq", CPUFREQ_PATH, policy);
+    return failed + apply_limits(min_path, path, lo, min, max);
+}
+
+int profile_from_name(const char *name)
+{
+    for (int i = 0; i < PROFILE_COUNT; i++)
+        if (strcmp(name, power_profiles[i].name) == 0) return i;
+
+    char *end;
+    long val = strtol(name, &end, 10);
+    if (*name && !*end && val >= 0 && val < PROFILE_COUNT) return val;
+    return -1;
+}
+
+/*
+ * Returns -1 if the driver rejected the profile, otherwise the number of
+ * tunables that could not be applied (usually because we are not root).
+ */
+int profile_apply(int profile)
+{
+    if (profile < 0 || profile >= PROFILE_COUNT) profile = PROFILE_POWER_SAVING;
+    const PowerProfile *p = &power_profiles[profile];
+    int failed = 0;
+
+    if (write_file(SYSFS_PATH "/power_profile", p->name) < 0) return -1;
+
+    int pstate = file_exists(INTEL_PSTATE "/max_perf_pct");
+
+    DIR *dir = opendir(CPUFREQ_PATH);
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strncmp(entry->d_name, "policy", 6) != 0) continue;
+            failed += apply_policy(entry->d_name, p, pstate);
+        }
+        closedir(dir);
+    }
+
+    if (pstate) {
+        failed += apply_limits(INTEL_PSTATE "/min_perf_pct",
+                               INTEL_PSTATE "/max_perf_pct",
+                               0, p->min_perf_pct, p->max_perf_pct);
+        if (file_exists(INTEL_PSTATE "/no_turbo") &&
+            write_file(INTEL_PSTATE "/no_turbo", p->turbo ? "0" : "1") < 0)
+            failed++;
+    } else if (file_exists(CPUFREQ_PATH "/boost") &&
+               write_file(CPUFREQ_PATH "/boost", p->turbo ? "1" : "0") < 0) {
+        failed++;
+    }
+
+    if (file_exists(FX_MAX_FPS_PARAM) &&
+        write_file_long(FX_MAX_FPS_PARAM, p->fx_max_fps) < 0)
+        failed++;
+
+    return failed;
+}
@@ -0,0 +1,30 @@
+/*
+ * profile.h - Power profile engine
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/* Same numbering as the driver's power_profile attribute */
+#define PROFILE_PERFORMANCE   0
+#define PROFILE_ENTERTAINMENT 1
+#define PROFILE_POWER_SAVING  2
+#define PROFILE_QUIET         3
+#define PROFILE_COUNT         4
+
+typedef struct {
+    const char *name;           /* driver power_profile name */
+    const char *governors[3];   /* scaling_governor, first available wins */
+    const char *epp;            /* energy_performance_preference */
+    int min_perf_pct;           /* of the maximum frequency */
+    int max_perf_pct;
+    int turbo;
+    int fx_max_fps;             /* driver effect frame rate cap, 0 = none */
+} PowerProfile;
+
+extern const PowerProfile power_profiles[PROFILE_COUNT];
+
+int profile_from_name(const char *name);
+int profile_apply(int profile);
+
+#endif /* PROFILE_H */
@@ -163,6 +163,44 @@ static void get_battery_info(int *percent, int *charging)
     }
 }
 
+int system_on_ac(void)
+{
+    DIR *dir = opendir("/sys/class/power_supply");
+    if (!dir) return -1;
+    
+    struct dirent *entry;
+    int online = -1;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        
+        char path[300], type[32];
+        snprintf(path, sizeof(path), "/sys/class/power_supply/%s/type", entry->d_name);
+        
+        FILE *f = fopen(path, "r");
+        if (!f) continue;
+        int ok = fscanf(f, "%31s", type) == 1;
+        fclose(f);
+        if (!ok || strcmp(type, "Mains") != 0) continue;
+        
+        snprintf(path, sizeof(path), "/sys/class/power_supply/%s/online", entry->d_name);
+        int val = read_file_int(path);
+        if (val > 0) {
+            online = 1;
+            break;
+        }
+        if (val == 0) online = 0;
+    }
+    closedir(dir);
+    
+    /* No mains adapter exposed, go by the battery */
+    if (online < 0) {
+        int percent, charging;
+        get_battery_info(&percent, &charging);
+        if (percent >= 0) online = charging;
+    }
+    return online;
+}
+
 void system_get_info(SystemInfo *info)
 {
     info->cpu_temp = system_get_cpu_temp();
@@ -18,5 +18,6 @@ typedef struct {
 void system_get_info(SystemInfo *info);
 float system_get_cpu_temp(void);
 int system_get_fan_rpm(int idx);
+int system_on_ac(void);
 
 #endif /* SYSTEM_H */
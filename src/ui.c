@@ -3,8 +3,11 @@
  */
 
 #include <gtk/gtk.h>
+#include <glib-unix.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "ui.h"
 #include "keyboard.h"
 #include "system.h"
@@ -16,6 +19,13 @@ static GtkWidget *system_drawing_area;
 static GtkWidget *keyboard_drawing_area;
 static SystemInfo sys_info;
 
+/* Controls that follow driver state, see watch_attr() */
+static GtkWidget *power_buttons[4];
+static GtkWidget *fan_buttons[3];
+static GtkWidget *led_buttons[4];
+static GtkWidget *brightness_scale;
+static int syncing;  /* set while showing a driver change, not the user's */
+
 /* Asset paths */
 #define ASSETS_PATH "/usr/share/backlit/assets"
 
@@ -417,28 +427,63 @@ static gboolean update_system(gpointer data)
 
 static void on_brightness_changed(GtkRange *range, gpointer data)
 {
+    if (syncing) return;
     int val = (int)gtk_range_get_value(range);
     kb_set_brightness(val);
 }
 
 static void on_power_profile_changed(GtkCheckButton *btn, gpointer data)
 {
-    if (!gtk_check_button_get_active(btn)) return;
+    if (syncing || !gtk_check_button_get_active(btn)) return;
     set_power_profile(GPOINTER_TO_INT(data));
 }
 
 static void on_fan_control_changed(GtkCheckButton *btn, gpointer data)
 {
-    if (!gtk_check_button_get_active(btn)) return;
+    if (syncing || !gtk_check_button_get_active(btn)) return;
     set_fan_control(GPOINTER_TO_INT(data));
 }
 
 static void on_led_mode_changed(GtkCheckButton *btn, gpointer data)
 {
-    if (!gtk_check_button_get_active(btn)) return;
+    if (syncing || !gtk_check_button_get_active(btn)) return;
     kb_set_led_mode(GPOINTER_TO_INT(data));
 }
 
+/* Driver state changed, by a hotkey, a daemon or another tool */
+static gboolean on_attr_changed(gint fd, GIOCondition cond, gpointer data)
+{
+    GtkWidget **buttons = data;
+    char buf[64];
+
+    /* The attribute is gone with the module, it would report G_IO_ERR forever */
+    if (kb_watch_read(fd, buf, sizeof(buf)) < 0) {
+        close(fd);
+        return G_SOURCE_REMOVE;
+    }
+    int val = atoi(buf);
+
+    syncing = 1;
+    if (buttons == &brightness_scale)
+        gtk_range_set_value(GTK_RANGE(brightness_scale), val);
+    else if (buttons == power_buttons && val >= 0 && val < 4)
+        gtk_check_button_set_active(GTK_CHECK_BUTTON(power_buttons[val]), TRUE);
+    else if (buttons == fan_buttons && val >= 0 && val < 3)
+        gtk_check_button_set_active(GTK_CHECK_BUTTON(fan_buttons[val]), TRUE);
+    else if (buttons == led_buttons && val >= 0 && val < 4)
+        gtk_check_button_set_active(GTK_CHECK_BUTTON(led_buttons[val]), TRUE);
+    syncing = 0;
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void watch_attr(const char *attr, GtkWidget **widgets)
+{
+    int fd = kb_watch_open(attr);
+    if (fd < 0) return;
+    g_unix_fd_add(fd, G_IO_PRI | G_IO_ERR, on_attr_changed, widgets);
+}
+
 /* Create System page */
 static void create_system_page(GtkWidget *parent)
 {
@@ -472,6 +517,7 @@ static void create_system_page(GtkWidget *parent)
     for (int i = 0; i < 4; i++) {
         GtkWidget *btn = gtk_check_button_new_with_label(power_modes[i]);
         gtk_widget_add_css_class(btn, "mode-button");
+        power_buttons[i] = btn;
         if (i == 0) first_power = btn;
         else gtk_check_button_set_group(GTK_CHECK_BUTTON(btn), GTK_CHECK_BUTTON(first_power));
         if (i == cur_power) gtk_check_button_set_active(GTK_CHECK_BUTTON(btn), TRUE);
@@ -496,13 +542,14 @@ static void create_system_page(GtkWidget *parent)
     GtkWidget *fan_label = gtk_label_new("FAN Speed:");
     gtk_box_append(GTK_BOX(fan_box), fan_label);
     
-    const char *fan_modes[] = {"Automatic", "Maximum"};
+    const char *fan_modes[] = {"Automatic", "Maximum", "Custom Curve"};
     GtkWidget *first_fan = NULL;
     int cur_fan = get_fan_control();
     
-    for (int i = 0; i < 2; i++) {
+    for (int i = 0; i < 3; i++) {
         GtkWidget *btn = gtk_check_button_new_with_label(fan_modes[i]);
         gtk_widget_add_css_class(btn, "mode-button");
+        fan_buttons[i] = btn;
         if (i == 0) first_fan = btn;
         else gtk_check_button_set_group(GTK_CHECK_BUTTON(btn), GTK_CHECK_BUTTON(first_fan));
         if (i == cur_fan) gtk_check_button_set_active(GTK_CHECK_BUTTON(btn), TRUE);
@@ -548,6 +595,7 @@ static void create_keyboard_page(GtkWidget *parent)
     
     for (int i = 0; i < 4; i++) {
         GtkWidget *btn = gtk_check_button_new_with_label(led_modes[i]);
+        led_buttons[i] = btn;
         if (i == 0) first_led = btn;
         else gtk_check_button_set_group(GTK_CHECK_BUTTON(btn), GTK_CHECK_BUTTON(first_led));
         if (i == cur_led) gtk_check_button_set_active(GTK_CHECK_BUTTON(btn), TRUE);
@@ -574,12 +622,12 @@ static void create_keyboard_page(GtkWidget *parent)
     gtk_widget_add_css_class(bright_label, "section-title");
     gtk_box_append(GTK_BOX(right_box), bright_label);
     
-    GtkWidget *bright_scale = gtk_scale_new_with_range(GTK_ORIENTATION_VERTICAL, 0, 9, 1);
-    gtk_range_set_inverted(GTK_RANGE(bright_scale), TRUE);
-    gtk_range_set_value(GTK_RANGE(bright_scale), kb_get_brightness());
-    gtk_widget_set_size_request(bright_scale, -1, 150);
-    g_signal_connect(bright_scale, "value-changed", G_CALLBACK(on_brightness_changed), NULL);
-    gtk_box_append(GTK_BOX(right_box), bright_scale);
+    brightness_scale = gtk_scale_new_with_range(GTK_ORIENTATION_VERTICAL, 0, 9, 1);
+    gtk_range_set_inverted(GTK_RANGE(brightness_scale), TRUE);
+    gtk_range_set_value(GTK_RANGE(brightness_scale), kb_get_brightness());
+    gtk_widget_set_size_request(brightness_scale, -1, 150);
+    g_signal_connect(brightness_scale, "value-changed", G_CALLBACK(on_brightness_changed), NULL);
+    gtk_box_append(GTK_BOX(right_box), brightness_scale);
     
     gtk_box_append(GTK_BOX(content), right_box);
     gtk_box_append(GTK_BOX(box), content);
@@ -643,6 +691,12 @@ static void on_activate(GtkApplication *app, gpointer data)
     /* Timer for updates */
     system_get_info(&sys_info);
     g_timeout_add(2000, update_system, NULL);
+
+    /* Controls follow the driver, no need to re-read them */
+    watch_attr("kb_brightness", &brightness_scale);
+    watch_attr("power_profile", power_buttons);
+    watch_attr("fan_control", fan_buttons);
+    watch_attr("kb_led_mode", led_buttons);
     
     gtk_window_present(GTK_WINDOW(window));
 }
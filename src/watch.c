@@ -0,0 +1,44 @@
+/*
+ * watch.c - Change notification for the driver's sysfs attributes
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "keyboard.h"
+
+/*
+ * The driver calls sysfs_notify() when kb_brightness, kb_color, kb_state,
+ * kb_mode, kb_led_mode, fan_control or power_profile change. Poll the fd
+ * from kb_watch_open() for POLLPRI, then get the new value with
+ * kb_watch_read(), which also re-arms it.
+ *
+ * Once the module is unloaded the attribute is gone: poll() keeps
+ * returning POLLERR and kb_watch_read() fails, so close the fd then.
+ */
+int kb_watch_open(const char *attr)
+{
+    char path[256], buf[64];
+    snprintf(path, sizeof(path), "%s/%s", SYSFS_PATH, attr);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    /* Notifications are only delivered once the file has been read */
+    if (read(fd, buf, sizeof(buf)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int kb_watch_read(int fd, char *buf, size_t bufsize)
+{
+    if (lseek(fd, 0, SEEK_SET) < 0) return -1;
+
+    ssize_t n = read(fd, buf, bufsize - 1);
+    if (n < 0) return -1;
+    buf[n] = '\0';
+    if (n > 0 && buf[n-1] == '\n') buf[n-1] = '\0';
+    return 0;
+}
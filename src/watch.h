@@ -0,0 +1,14 @@
+/*
+ * watch.h - Change notification for the driver's sysfs attributes
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stddef.h>
+
+/* Change notification, poll() the fd for POLLPRI */
+int kb_watch_open(const char *attr);
+int kb_watch_read(int fd, char *buf, size_t bufsize);
+
+#endif /* WATCH_H */
@@ -0,0 +1,278 @@
+/*
+ * workload.c - Workload detection for automatic power profiles
+ *
+ * Rules are checked in file order and the first match picks the profile.
+ * Process names (and cgroups, if any rule needs them) are read from /proc
+ * once per check. A matched profile only takes effect after hold_up
+ * seconds, and is only dropped hold_down seconds after it stopped
+ * matching, so short-lived processes and gaps between build steps do not
+ * flip the profile back and forth.
+ *
+ * Config format, '#' starts a comment:
+ *
+ *   hold_up <seconds>
+ *   hold_down <seconds>
+ *   interval <seconds>
+ *   ac_only yes|no
+ *   <profile> comm <pattern>...
+ *   <profile> cgroup <pattern>...
+ *   <profile> load <per-cpu load>
+ *   <profile> psi <percent>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include "profile.h"
+#include "workload.h"
+
+/* Used when there is no config file */
+static const char default_rules[] =
+    "hold_up 5\n"
+    "hold_down 30\n"
+    "interval 2\n"
+    "ac_only no\n"
+    "performance comm cc1 cc1plus cc1obj rustc clang clang++ ld ld.* mold\n"
+    "performance comm javac go ghc blender ffmpeg x264 x265 HandBrakeCLI\n"
+    "performance load 0.9\n"
+    "entertainment comm gamescope* wineserver *.exe\n";
+
+typedef struct {
+    char comm[16];
+    char cgroup[256];
+} ProcInfo;
+
+static int parse_line(Workload *w, char *line, int lineno)
+{
+    char *save, *tok[2];
+
+    char *hash = strchr(line, '#');
+    if (hash) *hash = '\0';
+
+    tok[0] = strtok_r(line, " \t\n", &save);
+    if (!tok[0]) return 0;
+    tok[1] = strtok_r(NULL, " \t\n", &save);
+    if (!tok[1]) goto bad;
+
+    if (strcmp(tok[0], "hold_up") == 0) {
+        w->hold_up_s = atof(tok[1]);
+        return 0;
+    }
+    if (strcmp(tok[0], "hold_down") == 0) {
+        w->hold_down_s = atof(tok[1]);
+        return 0;
+    }
+    if (strcmp(tok[0], "interval") == 0) {
+        w->interval_ms = atof(tok[1]) * 1000;
+        if (w->interval_ms < 250) w->interval_ms = 250;
+        return 0;
+    }
+    if (strcmp(tok[0], "ac_only") == 0) {
+        w->ac_only = strcmp(tok[1], "yes") == 0 || strcmp(tok[1], "1") == 0;
+        return 0;
+    }
+
+    int profile = profile_from_name(tok[0]);
+    if (profile < 0) goto bad;
+
+    int kind;
+    if (strcmp(tok[1], "comm") == 0) kind = WORKLOAD_COMM;
+    else if (strcmp(tok[1], "cgroup") == 0) kind = WORKLOAD_CGROUP;
+    else if (strcmp(tok[1], "load") == 0) kind = WORKLOAD_LOAD;
+    else if (strcmp(tok[1], "psi") == 0) kind = WORKLOAD_PSI;
+    else goto bad;
+
+    char *arg;
+    int n = 0;
+    while ((arg = strtok_r(NULL, " \t\n", &save)) != NULL) {
+        if (w->nrules == WORKLOAD_MAX_RULES) {
+            fprintf(stderr, "workload: line %d: too many rules\n", lineno);
+            return -1;
+        }
+        WorkloadRule *r = &w->rules[w->nrules++];
+        r->profile = profile;
+        r->kind = kind;
+        snprintf(r->pattern, sizeof(r->pattern), "%s", arg);
+        r->threshold = atof(arg);
+        n++;
+    }
+    if (n) return 0;
+
+bad:
+    fprintf(stderr, "workload: line %d: cannot parse rule\n", lineno);
+    return -1;
+}
+
+/* Falls back to the built-in rules if path does not exist */
+int workload_load(Workload *w, const char *path)
+{
+    memset(w, 0, sizeof(*w));
+    w->candidate = -1;
+    w->active = -1;
+
+    FILE *f = path ? fopen(path, "r") : NULL;
+    if (!f) f = fmemopen((void *)default_rules, strlen(default_rules), "r");
+    if (!f) return -1;
+
+    char line[512];
+    int lineno = 0, ret = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (parse_line(w, line, ++lineno) < 0) ret = -1;
+    }
+    fclose(f);
+
+    if (!w->interval_ms) w->interval_ms = 2000;
+    return ret;
+}
+
+static double read_load_per_cpu(void)
+{
+    FILE *f = fopen("/proc/loadavg", "r");
+    if (!f) return -1;
+
+    double load = -1;
+    if (fscanf(f, "%lf", &load) != 1) load = -1;
+    fclose(f);
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    return ncpu > 0 && load >= 0 ? load / ncpu : load;
+}
+
+static double read_cpu_psi(void)
+{
+    FILE *f = fopen("/proc/pressure/cpu", "r");
+    if (!f) return -1;
+
+    double avg10 = -1;
+    if (fscanf(f, "some avg10=%lf", &avg10) != 1) avg10 = -1;
+    fclose(f);
+    return avg10;
+}
+
+static void read_cgroup(const char *pid, char *buf, size_t len)
+{
+    char path[300], line[256];
+    snprintf(path, sizeof(path), "/proc/%s/cgroup", pid);
+
+    buf[0] = '\0';
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+
+    /* cgroup v2 unified hierarchy: "0::/path" */
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "0::", 3) != 0) continue;
+        line[strcspn(line, "\n")] = '\0';
+        snprintf(buf, len, "%s", line + 3);
+        break;
+    }
+    fclose(f);
+}
+
+static int scan_procs(ProcInfo **procs, int want_cgroup)
+{
+    static int cap = 0;
+    int n = 0;
+
+    DIR *dir = opendir("/proc");
+    if (!dir) return 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!isdigit((unsigned char)entry->d_name[0])) continue;
+
+        if (n == cap) {
+            int ncap = cap ? cap * 2 : 512;
+            ProcInfo *p = realloc(*procs, ncap * sizeof(**procs));
+            if (!p) break;
+            *procs = p;
+            cap = ncap;
+        }
+
+        char path[300];
+        snprintf(path, sizeof(path), "/proc/%s/comm", entry->d_name);
+        FILE *f = fopen(path, "r");
+        if (!f) continue;  /* already exited */
+        ProcInfo *p = &(*procs)[n];
+        int ok = fgets(p->comm, sizeof(p->comm), f) != NULL;
+        fclose(f);
+        if (!ok) continue;
+        p->comm[strcspn(p->comm, "\n")] = '\0';
+
+        if (want_cgroup) read_cgroup(entry->d_name, p->cgroup, sizeof(p->cgroup));
+        n++;
+    }
+    closedir(dir);
+    return n;
+}
+
+/* First matching rule, or NULL */
+static const WorkloadRule *match(const Workload *w)
+{
+    static ProcInfo *procs;
+    int want_procs = 0, want_cgroup = 0;
+    double load = -2, psi = -2;
+
+    for (int i = 0; i < w->nrules; i++) {
+        if (w->rules[i].kind == WORKLOAD_COMM) want_procs = 1;
+        if (w->rules[i].kind == WORKLOAD_CGROUP) want_procs = want_cgroup = 1;
+    }
+    int nprocs = want_procs ? scan_procs(&procs, want_cgroup) : 0;
+
+    for (int i = 0; i < w->nrules; i++) {
+        const WorkloadRule *r = &w->rules[i];
+
+        switch (r->kind) {
+        case WORKLOAD_COMM:
+        case WORKLOAD_CGROUP:
+            for (int p = 0; p < nprocs; p++) {
+                const char *s = r->kind == WORKLOAD_COMM ?
+                                procs[p].comm : procs[p].cgroup;
+                if (fnmatch(r->pattern, s, 0) == 0) return r;
+            }
+            break;
+        case WORKLOAD_LOAD:
+            if (load == -2) load = read_load_per_cpu();
+            if (load >= r->threshold) return r;
+            break;
+        case WORKLOAD_PSI:
+            if (psi == -2) psi = read_cpu_psi();
+            if (psi >= r->threshold) return r;
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Returns the workload profile to use, or -1 for none */
+int workload_update(Workload *w, double now)
+{
+    const WorkloadRule *r = match(w);
+    int matched = r ? r->profile : -1;
+
+    if (matched != w->candidate) {
+        w->candidate = matched;
+        w->candidate_since = now;
+    }
+    if (matched >= 0 && matched == w->active) w->active_seen = now;
+
+    int held = w->candidate >= 0 && now - w->candidate_since >= w->hold_up_s;
+
+    if (w->active < 0) {
+        if (held) {
+            w->active = w->candidate;
+            w->active_seen = now;
+            w->reason = r->pattern;
+        }
+    } else if (w->candidate != w->active &&
+               now - w->active_seen >= w->hold_down_s) {
+        w->active = held ? w->candidate : -1;
+        w->active_seen = now;
+        w->reason = held ? r->pattern : NULL;
+    }
+
+    return w->active;
+}
@@ -0,0 +1,44 @@
+/*
+ * workload.h - Workload detection for automatic power profiles
+ */
+
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#define WORKLOAD_MAX_RULES 64
+
+enum {
+    WORKLOAD_COMM,      /* process name, shell pattern */
+    WORKLOAD_CGROUP,    /* cgroup v2 path, shell pattern */
+    WORKLOAD_LOAD,      /* 1 minute load average per CPU */
+    WORKLOAD_PSI,       /* CPU pressure, "some" avg10 percent */
+};
+
+typedef struct {
+    int profile;
+    int kind;
+    char pattern[64];
+    double threshold;
+} WorkloadRule;
+
+typedef struct {
+    /* Config */
+    WorkloadRule rules[WORKLOAD_MAX_RULES];
+    int nrules;
+    double hold_up_s;    /* a match must last this long before switching */
+    double hold_down_s;  /* and be gone this long before switching back */
+    int interval_ms;
+    int ac_only;
+
+    /* State */
+    int candidate;       /* profile matched now, -1 = none */
+    double candidate_since;
+    int active;          /* profile in effect, -1 = none */
+    double active_seen;
+    const char *reason;  /* rule pattern that activated it */
+} Workload;
+
+int workload_load(Workload *w, const char *path);
+int workload_update(Workload *w, double now);
+
+#endif /* WORKLOAD_H */